@@ -1,10 +1,10 @@
 #include "SimpleModbusSlave.h"
 
-#define BUFFER_SIZE 128
+#define BUFFER_SIZE 256 // maximum RTU frame, 125 registers read or 123 written in one request
 
 // frame[] is used to recieve and transmit packages. 
-// The maximum serial ring buffer size is 128
 unsigned char frame[BUFFER_SIZE];
+unsigned char rxMemory[BUFFER_SIZE]; // added to the receive ring of Serial1, see modbus_configure()
 uint16_t holdingRegsSize; // size of the register array 
 unsigned char broadcastFlag;
 unsigned char slaveID;
@@ -13,6 +13,12 @@ unsigned char TxEnablePin;
 uint16_t errorCount;
 uint16_t T1_5; // inter character time out
 uint16_t T3_5; // frame delay
+uint16_t rxCount = 0;         // bytes of the frame received so far
+unsigned char rxOverflow = 0; // frame longer than BUFFER_SIZE
+unsigned long rxTime = 0;     // micros() of the last received byte
+uint16_t (*readRegister)(uint16_t address) = NULL;               // register map getter, NULL = use holdingRegs[]
+void (*writeRegister)(uint16_t address, uint16_t value) = NULL;  // register map setter, NULL = use holdingRegs[]
+void (*readFrame)(uint16_t startingAddress, uint16_t count) = NULL; // start of a function 3/4 response
 
 // function definitions
 void exceptionResponse(unsigned char exception);
@@ -21,26 +27,34 @@ void sendPacket(unsigned char bufferSize);
 
 uint16_t modbus_update(uint16_t *holdingRegs)
 {
-  unsigned char buffer = 0;
-  unsigned char overflow = 0;
-  
   while (Serial1.available())  // modified for using Serial1 on Teensy 3.2
   {
-    // The maximum number of bytes is limited to the serial buffer size of 128 bytes
+    // The Teensy 3 core keeps 64 bytes of Serial1, modbus_configure() adds BUFFER_SIZE
+    // so a whole frame fits between two calls
     // If more bytes is received than the BUFFER_SIZE the overflow flag will be set and the 
     // serial buffer will be red untill all the data is cleared from the receive buffer.
-    if (overflow) 
+    if (rxOverflow) 
       Serial1.read();
     else
     {
-      if (buffer == BUFFER_SIZE)
-        overflow = 1;
-      frame[buffer] = Serial1.read();
-      buffer++;
+      if (rxCount == BUFFER_SIZE)
+        rxOverflow = 1;
+      else
+        frame[rxCount++] = Serial1.read();
     }
-    delayMicroseconds(T1_5); // inter character time out
+    rxTime = micros();
   }
   
+  // The frame is complete after T1_5 without a new byte. Until then return
+  // and collect the rest in the next call instead of waiting here.
+  if ((!rxCount && !rxOverflow) || (micros() - rxTime < T1_5))
+    return errorCount;
+  
+  uint16_t buffer = rxCount;
+  unsigned char overflow = rxOverflow;
+  rxCount = 0;
+  rxOverflow = 0;
+  
   // If an overflow occurred increment the errorCount
   // variable and return to the main sketch without 
   // responding to the request i.e. force a timeout
@@ -66,7 +80,7 @@ uint16_t modbus_update(uint16_t *holdingRegs)
         uint16_t startingAddress = ((frame[2] << 8) | frame[3]); // combine the starting address bytes
         uint16_t no_of_registers = ((frame[4] << 8) | frame[5]); // combine the number of register bytes  
         uint16_t maxData = startingAddress + no_of_registers;
-        unsigned char index;
+        uint16_t index;
         unsigned char address;
         uint16_t crc16;
         
@@ -75,7 +89,7 @@ uint16_t modbus_update(uint16_t *holdingRegs)
         {
           if (startingAddress < holdingRegsSize) // check exception 2 ILLEGAL DATA ADDRESS
           {
-            if (maxData <= holdingRegsSize) // check exception 3 ILLEGAL DATA VALUE
+            if (maxData <= holdingRegsSize && no_of_registers <= (BUFFER_SIZE - 5) / 2) // check exception 3 ILLEGAL DATA VALUE
             {
               unsigned char noOfBytes = no_of_registers * 2;
               unsigned char responseFrameSize = 5 + noOfBytes; // ID, function, noOfBytes, (dataLo + dataHi) * number of registers, crcLo, crcHi
@@ -85,9 +99,14 @@ uint16_t modbus_update(uint16_t *holdingRegs)
               address = 3; // PDU starts at the 4th byte
               uint16_t temp;
               
+              if (readFrame)
+                readFrame(startingAddress, no_of_registers);
               for (index = startingAddress; index < maxData; index++)
               {
-                temp = holdingRegs[index];
+                if (readRegister)
+                  temp = readRegister(index); // resolved live at serialization time
+                else
+                  temp = holdingRegs[index];
                 frame[address] = temp >> 8; // split the register into 2 bytes
                 address++;
                 frame[address] = temp & 0xFF;
@@ -113,7 +132,10 @@ uint16_t modbus_update(uint16_t *holdingRegs)
               uint16_t regStatus = ((frame[4] << 8) | frame[5]);
               unsigned char responseFrameSize = 8;
               
-              holdingRegs[startingAddress] = regStatus;
+              if (writeRegister)
+                writeRegister(startingAddress, regStatus);
+              else
+                holdingRegs[startingAddress] = regStatus;
               
               crc16 = calculateCRC(responseFrameSize - 2);
               frame[responseFrameSize - 2] = crc16 >> 8; // split crc into 2 bytes
@@ -137,7 +159,10 @@ uint16_t modbus_update(uint16_t *holdingRegs)
                 
                 for (index = startingAddress; index < maxData; index++)
                 {
-                  holdingRegs[index] = ((frame[address] << 8) | frame[address + 1]);
+                  if (writeRegister)
+                    writeRegister(index, ((frame[address] << 8) | frame[address + 1]));
+                  else
+                    holdingRegs[index] = ((frame[address] << 8) | frame[address + 1]);
                   address += 2;
                 } 
                 
@@ -193,12 +218,12 @@ void modbus_configure(long baud, uint16_t format, unsigned char _slaveID, unsign
   slaveID = _slaveID;
   // Serial.begin(baud);
   Serial1.begin(baud,format);
+  Serial1.addMemoryForRead(rxMemory, sizeof(rxMemory)); // 64 bytes of the core hold a quarter of a frame
   
   if (_TxEnablePin > 1) 
   { // pin 0 & pin 1 are reserved for RX/TX. To disable set txenpin < 2
     TxEnablePin = _TxEnablePin; 
-    pinMode(TxEnablePin, OUTPUT);
-    digitalWrite(TxEnablePin, LOW);
+    Serial1.transmitterEnable(TxEnablePin); // driven by the UART until the last stop bit is sent
   }
   
   // Modbus states that a baud rate higher than 19200 must use a fixed 750 us 
@@ -236,6 +261,14 @@ void modbus_configure(long baud, uint16_t format, unsigned char _slaveID, unsign
   errorCount = 0; // initialize errorCount
 }   
 
+void modbus_attachRegisterMap(uint16_t (*_readRegister)(uint16_t address), void (*_writeRegister)(uint16_t address, uint16_t value),
+                              void (*_readFrame)(uint16_t startingAddress, uint16_t count))
+{
+  readRegister = _readRegister;
+  writeRegister = _writeRegister;
+  readFrame = _readFrame;
+}
+
 uint16_t calculateCRC(byte bufferSize) 
 {
   uint16_t temp, temp2, flag;
@@ -260,17 +293,8 @@ uint16_t calculateCRC(byte bufferSize)
 
 void sendPacket(unsigned char bufferSize)
 {
-  if (TxEnablePin > 1)
-    digitalWrite(TxEnablePin, HIGH);
-    
+  // queued to the UART, TxEnablePin is released by Serial1 after the
+  // last byte, the master provides the frame delay before its next request
   for (unsigned char i = 0; i < bufferSize; i++)
     Serial1.write(frame[i]);
-    
-  Serial1.flush();
-  
-  // allow a frame delay to indicate end of transmission
-  delayMicroseconds(T3_5); 
-  
-  if (TxEnablePin > 1)
-    digitalWrite(TxEnablePin, LOW);
 }
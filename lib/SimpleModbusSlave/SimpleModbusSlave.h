@@ -71,6 +71,9 @@
  master without using a USB to Serial converter the internal buffer is set
  the same as the Arduino Serial ring buffer which is 128 bytes.
  
+ Modified: the frame buffer is the maximum RTU frame of 256 bytes (125 registers
+ read, 123 written), the serial ring buffer is emptied by every modbus_update().
+ 
  The functions included here have been derived from the 
  Modbus Specifications and Implementation Guides
  
@@ -85,6 +88,15 @@
 // void modbus_configure(long baud, unsigned char _slaveID, unsigned char _TxEnablePin, uint16_t _holdingRegsSize, unsigned char _lowLatency)
 void modbus_configure(long baud, uint16_t format, byte _slaveID, byte _TxEnablePin, uint16_t _holdingRegsSize, unsigned char _lowLatency);
 uint16_t modbus_update(uint16_t *holdingRegs);
+
+// Optional register map. When attached, function 3/4 responses resolve every
+// address through readRegister() at the moment the frame is serialized and
+// function 6/16 requests hand each value to writeRegister() instead of the array.
+// readFrame(), if given, is called once per function 3/4 request before the first
+// register is read, so a block can be snapshot for the whole frame.
+// Pass NULL to fall back to the plain holdingRegs[] array.
+void modbus_attachRegisterMap(uint16_t (*_readRegister)(uint16_t address), void (*_writeRegister)(uint16_t address, uint16_t value),
+                              void (*_readFrame)(uint16_t startingAddress, uint16_t count) = NULL);
  
 
 #endif
@@ -6,6 +6,7 @@
 #include <LedDisplay.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
 
 //for EEPROM
 #include <EEPROM.h>
@@ -19,9 +20,6 @@
 // for SPI
 #include <SPI.h>
 
-// for filters
-#include <Bounce2.h>
-
 //for ModBus
 #include <SimpleModbusSlave.h>
 
@@ -61,15 +59,23 @@
 #define DEFAULT_FILTER_POSITION 6 // range 0 - 9999 ms (or nr of mirrors) for moving average
 #define DEFAULT_FILTER_ON 0       // range 0 - 9999 ms
 #define DEFAULT_FILTER_OFF 0      // range 0 - 9999 ms
+#define DEFAULT_FILTER_UNIT 0     // FILTER_ON and FILTER_OFF in ms = 0, us = 1
+
+#define DEFAULT_OUTPUT_DELAY 300 // range 50 - 900 us, analog outputs latched this long after scan start
+#define DEFAULT_POSITION_PREDICT 0 // off = 0, on = 1 (position + velocity * pipeline latency)
+
+#define DEFAULT_RECIPE_SET1 1 // recipe slot of parameter set 1, range 1 - RECIPE_COUNT
+#define DEFAULT_RECIPE_SET2 2 // recipe slot of parameter set 2
 
 // EEPROM Addresses (all values are WORD for easy Modbus transfers)
+// fixed layout of older firmware, address / 2 is the key of the WORD in the config journal
 
 // EEPROM Addresses for signature code and version of firmware
 #define EE_ADDR_MODEL_TYPE 0x00          // WORD
 #define EE_ADDR_MODEL_SERIAL_NUMBER 0x02 // WORD
 #define EE_ADDR_FW_VERSION 0x04          // WORD
 
-// EEPROM Addresses for config
+// EEPROM Addresses for config, parameter set WORDs of journal schema 1 moved to recipes (see config_migrate())
 #define EE_ADDR_modbus_ID 0x06     // WORD
 #define EE_ADDR_modbus_Speed 0x08  // WORD  // baudrate/100 to fit 115200 to WORD
 #define EE_ADDR_modbus_Format 0x10 // WORD
@@ -93,13 +99,39 @@
 // EEPROM Addresses for diagnosis
 #define EE_ADDR_max_temperature 0x38 // WORD
 #define EE_ADDR_total_runtime 0x40   // WORD
+// 0x42 unused (was eeprom_commits, the count of commit passes is kept in RAM)
+// 0x44 unused (was commit_state, power loss is handled by the journal commit marker)
+#define EE_ADDR_output_delay 0x46    // WORD  // range 50 - 900 us
+#define EE_ADDR_position_predict 0x48 // WORD  // off = 0, on = 1
+#define EE_ADDR_filter_unit 0x4A      // WORD  // ms = 0, us = 1
+#define EE_ADDR_recipe_set1 0x4C      // WORD  // recipe slot of parameter set 1
+#define EE_ADDR_recipe_set2 0x4E      // WORD  // recipe slot of parameter set 2
+#define EE_ADDR_recipe_edit 0x50      // WORD  // recipe slot of the RECIPE_* registers
+#define EE_ADDR_recipe 0x52           // WORD * RECIPE_WORDS per slot, recipe_t fields
+
+// write-behind cache for EEPROM config words
+#define EE_CACHE_SIZE (EE_ADDR_recipe + RECIPE_COUNT * RECIPE_WORDS * 2) // bytes of the layout covered by the cache and the journal
+
+// config journal: WORD records appended round-robin over the EEPROM above the fixed layout,
+// each commit closed by a marker record (wear leveling, atomic multi-WORD commits)
+#define JOURNAL_START 0x100                                // first byte, 0x00 - 0xFF keeps the fixed layout for migration
+#define JOURNAL_RECORDS ((E2END + 1 - JOURNAL_START) / 8) // 8 byte records
+#define JOURNAL_KEYS (EE_CACHE_SIZE / 2)                   // one key per WORD address
+#define JOURNAL_KEY_COMMIT 0xFE                            // key of the commit marker
+#define JOURNAL_MAX_COMMIT (JOURNAL_KEYS + 1)              // all WORDs + marker
+#define JOURNAL_RESERVE 16                                 // free records kept ahead of the head after a commit
+#define JOURNAL_SPARE 64                                   // fewer free records: commits carry the oldest WORDs along
+#define JOURNAL_CARRY 2                                    // oldest WORDs carried per record of a commit below JOURNAL_SPARE
+#define JOURNAL_SCHEMA 2                                   // bump with a new case in config_migrate() when WORD meanings change
 
 // Define pins
 // filters
 
-#define FILTER_PIN 24 // not connected, for internal use of Bounce2 library filter - SIGNAL PRESENT filter ON/OFF
-
-Bounce filterOnOff = Bounce();
+// SIGNAL PRESENT on/off delay filter, evaluated once per scan in signalFilter()
+volatile boolean signalDetected = false;  // edge detected in the last scan (selects threshold hysteresis)
+volatile boolean signalPresent = false;   // filtered SIGNAL PRESENT, drives LED_SIGNAL and OUT_SIGNAL_NEG
+boolean signalPending = false;            // signalDetected differs from signalPresent
+unsigned long signalChangeTime = 0;       // ADC start of the first scan with the new state
 float sma = 0;
 
 // Modbus - RS485
@@ -108,7 +140,11 @@ float sma = 0;
 #define TXEN 2 // Serial1: RX1=0 TX1=1 TXEN=2
 
 // SPI
-#define SPI_CS 10 // LATCH on AD420
+#define SPI_CS 10 // LATCH on AD420, driven by hardware SPI0_PCS0
+
+// SPI0 CTAR0 for AD420: 16 bit frames, CPOL=0, CPHA=0, SCK = F_BUS / 5 * 2 / 6 = 3.2 MHz (AD420 max 3.3 MHz)
+#define DAC_SPI_CTAR (SPI_CTAR_FMSZ(15) | SPI_CTAR_PBR(2) | SPI_CTAR_BR(2) | SPI_CTAR_DBR | SPI_CTAR_CSSCK(1) | SPI_CTAR_ASC(1) | SPI_CTAR_DT(1))
+#define DAC_REFRESH_SCANS 1000 // rewrite unchanged DAC values at least every 1000 scans
 
 // Define pins for the LED display.
 // You can change these, just re-wire your board:
@@ -124,6 +160,35 @@ float sma = 0;
 LedDisplay myDisplay = LedDisplay(dataPin, registerSelectPin, clockPin, enablePin, resetPin, displayLength);
 int brightness = 10; // screen brightness
 
+// display frame buffer, changed characters are written by checkDisplay() one per loop()
+char displayFrame[displayLength]; // text to show
+char displayShown[displayLength]; // text on the display, 0 = unknown
+int displayPos = 0;               // next character checked by checkDisplay()
+
+// display formats: literal text, %%, %s and %d with optional width 1 - 9, see displayFormat()
+constexpr bool displayFormatValid(const char *format)
+{
+  while (*format)
+  {
+    if (*format++ != '%')
+      continue;
+    if (*format >= '1' && *format <= '9')
+      format++;
+    if (*format != 'd' && *format != 's' && *format != '%')
+      return false;
+    format++;
+  }
+  return true;
+}
+
+// format rejected at compile time if not supported, arguments checked by -Wformat
+#define displayPrint(format, ...)                                                     \
+  do                                                                                  \
+  {                                                                                   \
+    static_assert(displayFormatValid(format), "unsupported display format " format); \
+    displayPrintf(format, ##__VA_ARGS__);                                             \
+  } while (0)
+
 // LEDs and I/O
 
 #define LED_POWER 19
@@ -166,6 +231,17 @@ int brightness = 10; // screen brightness
 #define TIMEOUT_MENU 1200000 // *500us = 10 mins
 #define TIMEOUT_LASER 1200000
 #define TIMEOUT_TEST 600000 // 5 min
+#define TIMEOUT_EEPROM_COMMIT 4000 // *500us = 2 s quiet period before pending EEPROM changes are committed
+#define TIMEOUT_MESSAGE 1000       // *500us = 500 ms transient message (SAVED!!!, BAD PIN!, ...)
+
+// motor start, see checkMOTOR()
+#define MOTOR_SPEED_START 20 // % of full speed, MOTOR_CLK toggled every 50000 / speed us
+#define MOTOR_RAMP_STEP 100  // ms, longest step of 1 % - the old fixed ramp
+#define MOTOR_RAMP_MIN 20    // ms, shortest step when the HALL period follows the clock
+#define MOTOR_LOCK_TIME 2000 // ms at full speed without HALL lock before the motor alarm is shown
+#define MOTOR_RAMP 0
+#define MOTOR_LOCKING 1
+#define MOTOR_RUN 2
 
 // display menu
 #define MENU_MAIN 1
@@ -175,28 +251,10 @@ int brightness = 10; // screen brightness
 
 #define MENU_SETUP 2
 #define MENU_SENSOR 21
-#define MENU_GAIN1 211
-#define MENU_THRE1 212
-#define MENU_GAIN2 213
-#define MENU_THRE2 214
-#define MENU_SET 215
-
 #define MENU_MODBUS 22
-#define MENU_MODBUS_ID 221
-#define MENU_MODBUS_SPEED 222
-#define MENU_MODBUS_FORMAT 223
-
 #define MENU_FILTERS 23
-#define MENU_FILTER_POSITION 231
-#define MENU_FILTER_ON 232
-#define MENU_FILTER_OFF 233
-
 #define MENU_ANALOG 24
-#define MENU_WINDOW_BEGIN 241
-#define MENU_WINDOW_END 242
-#define MENU_POSITION_MODE 243
-#define MENU_ANALOG_OUT_MODE 244
-#define MENU_POSITION_OFFSET 245
+#define MENU_PARAM 26 // edit of params[menuParam], see setParamMenu()
 
 #define MENU_INFO 25
 #define MENU_RESET 251
@@ -208,6 +266,8 @@ volatile int refreshMenuTimeout = 0;
 volatile int laserTimeout = 0;
 volatile int testTimeout = 0;
 volatile int menuTimeout = 0;
+volatile int eepromCommitTimeout = 0;
+volatile int messageTimeout = 0; // transient message shown, menus paused
 volatile boolean blinkMenu = false;
 volatile boolean alarmChecked = false;
 volatile boolean extTest = false;
@@ -230,53 +290,184 @@ DMAChannel adc0_dma;
 //extern void adc0_dma_isr(void);
 
 volatile int adc_data[ANALOG_BUFFER_SIZE]; // ADC_0 9-bit resolution for differential - sign + 8 bit
-volatile int value_buffer[25];
+volatile int value_buffer[25]; // AN_VALUES of the latest scan of the selected facet, updateResults()
+uint16_t anValues[25];          // AN_VALUES served to the master, taken from value_buffer[] when a read starts
 //volatile int value_peak[ANALOG_BUFFER_SIZE];
 volatile int adc0Value = 0;         //analog value
 volatile int analogBufferIndex = 0; //analog buffer pointer
 volatile int delayOffset = 0;
 // sensor variables
-volatile int thre256 = 75, thre = 30, thre1 = 30, thre2 = 50;
-volatile int hmdThresholdHyst = 13;
-volatile int pga = 16, pga1 = 16, pga2 = 32;
+volatile int thre = 30; // of the recipe in use, for display
+const int hmdThresholdHyst = 13;
+volatile int pga = 16;
+
+volatile int positionOffset, analogOutMode;
 
-volatile int windowBegin, windowEnd, positionOffset, positionMode, analogOutMode;
-volatile int filterPosition, filterOn, filterOff;
+// recipe: measuring setup of one product, RECIPE_COUNT slots stored in EEPROM,
+// parameter set 1 and 2 (SET / SET_IN) each use one slot
+#define RECIPE_COUNT 8
+#define RECIPE_WORDS 8 // fields of recipe_t, one EEPROM WORD each
+struct recipe_t
+{
+  int pga;
+  int thre;
+  int windowBegin;
+  int windowEnd;
+  int positionMode;
+  int filterPosition;
+  int filterOn;
+  int filterOff;
+};
+static_assert(sizeof(recipe_t) == RECIPE_WORDS * sizeof(int), "recipe_t fields must be int");
+
+// EEPROM WORD of a recipe_t field in slot 1
+#define EE_ADDR_RECIPE_FIELD(field) (EE_ADDR_recipe + offsetof(recipe_t, field) / sizeof(int) * 2)
+
+volatile recipe_t recipes[RECIPE_COUNT];
+volatile int recipeSet1 = DEFAULT_RECIPE_SET1; // slot of parameter set 1, read by callback_delay() every scan
+volatile int recipeSet2 = DEFAULT_RECIPE_SET2; // slot of parameter set 2
+volatile int recipeEdit = 1;                   // slot of the RECIPE_* registers
+volatile int filterUnit = DEFAULT_FILTER_UNIT;
+volatile int outputDelay = DEFAULT_OUTPUT_DELAY;
+volatile int positionPredict = DEFAULT_POSITION_PREDICT;
+volatile long positionVelocity = 0; // position units per scan * 256, estimated in predictPosition()
+
+// runtime config of the scan ISRs, built in config_build() whenever a setting changes
+// and never modified afterwards, adopted by callback_delay() at the next scan
+// all recipe slots are expanded, so switching a parameter set to another slot needs no rebuild
+struct scanRecipe_t
+{
+  recipe_t r; // settings
+
+  // derived values, index [0] = SIGNAL PRESENT off, [1] = on (with hysteresis)
+  int thre256;         // threshold in ADC counts
+  int hmdThreshold[2]; // threshold crossing
+  int winBegin[2];     // measuring window in samples
+  int winEnd[2];
+  int positionBegin; // measuring window in position units (0 - 1000)
+  int positionEnd;
+  uint32_t positionRecip; // 2^RECIP_SHIFT / (positionEnd - positionBegin), rounded up
+  uint32_t filterOnUs;    // SIGNAL PRESENT on delay
+  uint32_t filterOffUs;   // SIGNAL PRESENT off delay
+  long predictLead;       // pipeline latency from ADC start to analog output in scans * 256
+  int predictSettle;      // scans after SIGNAL PRESENT until the moving average settled
+};
+
+struct scanConfig_t
+{
+  // settings
+  int set; // 0 = selected by SET_IN in callback_delay(), 1 = set 1, 2 = set 2
+  int analogOutMode;
+  int filterUnit;
+  int outputDelay;
+  int positionPredict;
+
+  scanRecipe_t recipe[RECIPE_COUNT];
+};
+
+// fixed point reciprocal replaces map() division, exact for all window spans 100 - 900
+#define RECIP_SHIFT 36
 
-int menu_windowBegin, menu_windowEnd, menu_positionOffset, menu_positionMode, menu_analogOutMode;
-int menu_filterPosition, menu_filterOn, menu_filterOff;
-const char *menu_positionModeDisp[] = {" HMD", "RISE", "FALL", "PEAK"};
-const char *menu_analogOutModeDisp[] = {"1I2P", "1P2I", "1I2I", "1P2P"};
+scanConfig_t scanConfigBuf[2];
+const scanConfig_t *volatile scanConfig = NULL;        // active, used by the scan ISRs only
+const scanConfig_t *volatile scanConfigPending = NULL; // built, waiting for the next scan boundary
 
-int set = DEFAULT_SET;
+volatile int set = DEFAULT_SET;
 const char *menu_setDisp[] = {"REL ", "REL1", "REL2", "MAN1", "MAN2"};
 int setDispIndex = 0;
-int menu_pga;
-int menu_thre;
-int menu_set;
 
 // MODBUS
 
-int modbusID = 1;
-int menu_modbusID = 1;
+volatile int modbusID = 1;
+volatile int modbusSpeed = DEFAULT_MODBUS_SPEED;
+volatile int modbusFormat = DEFAULT_MODBUS_FORMAT;
 
-const uint16_t modbusSpeedArray[] = {12, 48, 96, 192, 384, 576, 1152}; // baudrate/100
-int actualSpeed = 3;                                                   // array index
-uint32_t modbusSpeed = modbusSpeedArray[actualSpeed] * 100;            // default 19200
-uint32_t menu_modbusSpeed = modbusSpeedArray[actualSpeed] * 100;
-
-const unsigned int modbusFormatArray[] = {SERIAL_8N1, SERIAL_8E1, SERIAL_8O1, SERIAL_8N2};
-int actualFormat = 1;
-unsigned int modbusFormat = modbusFormatArray[actualFormat];
-unsigned int menu_modbusFormat = modbusFormatArray[actualFormat];
-const char *menu_modbusFormatDisp[] = {"8N1", "8E1", "8O1", "8N2"};
-
-volatile boolean dataSent = false;
+boolean modbusRestart = false;     // ID, speed or format changed via ModBus
 int sendNextLn = 0;
 uint16_t io_state = 0;
 unsigned long exectime = 0;
+unsigned long loopStartTime = 0;
+unsigned long loopTime = 0; // us, duration of the last loop()
+unsigned long loopTimeMax = 0;
 unsigned long pulsetime = 0;
 
+// CPU time accounting from the DWT cycle counter, see cpu_enter() and checkCPU()
+enum
+{
+  CPU_TIMER,   // timer500us_isr()
+  CPU_MOTOR,   // motor_isr(), motorClock_isr()
+  CPU_SCAN,    // callback_delay() without updateResults()
+  CPU_RESULTS, // updateResults()
+  CPU_OUTPUT,  // callback_output()
+  CPU_DMA,     // adc0_dma_isr()
+  CPU_PINS,    // buttons, SET_IN and TEST_IN interrupts
+  CPU_INPUTS,  // checkSET(), checkTEST()
+  CPU_ALARM,   // checkMOTOR(), checkALARM(), checkSTATUS()
+  CPU_MODBUS,  // checkModbus()
+  CPU_EEPROM,  // checkEEPROM()
+  CPU_DISPLAY, // displayMenu(), checkDisplay()
+  CPU_UART,    // uart0_status_isr(), ModBus bytes of Serial1, see serial1_isr()
+  CPU_COUNT
+};
+
+// cycles are charged to the running handler, without the interrupts nested in it
+struct cpuMark_t
+{
+  uint32_t start; // ARM_DWT_CYCCNT at entry
+  uint32_t busy;  // cpuBusyCycles at entry
+};
+volatile uint32_t cpuCycles[CPU_COUNT]; // cycles of the running second
+volatile uint32_t cpuBusyCycles = 0;    // all cycles charged so far, wraps
+uint32_t cpuWindowStart = 0;            // ARM_DWT_CYCCNT of the running second
+uint16_t cpuUsage[CPU_COUNT];           // 0.1 % of the last second
+uint16_t cpuIdle = 1000;
+
+inline cpuMark_t cpu_enter()
+{
+  cpuMark_t m;
+  __disable_irq(); // both from the same instant, an interrupt in between would be charged twice or lost
+  m.busy = cpuBusyCycles;
+  m.start = ARM_DWT_CYCCNT;
+  __enable_irq();
+  return m;
+}
+
+inline void cpu_leave(int id, cpuMark_t m)
+{
+  __disable_irq();
+  uint32_t t = ARM_DWT_CYCCNT - m.start;
+  cpuCycles[id] += t - (cpuBusyCycles - m.busy);
+  cpuBusyCycles = m.busy + t;
+  __enable_irq();
+}
+
+// loop() only: cpu_leave() and the mark of the next task in one critical section
+inline cpuMark_t cpu_next(int id, cpuMark_t m)
+{
+  cpuMark_t next;
+  __disable_irq();
+  next.start = ARM_DWT_CYCCNT;
+  uint32_t t = next.start - m.start;
+  cpuCycles[id] += t - (cpuBusyCycles - m.busy);
+  cpuBusyCycles = m.busy + t;
+  next.busy = cpuBusyCycles;
+  __enable_irq();
+  return next;
+}
+
+// configuration image: MODEL_TYPE, CONFIG_IMAGE_VERSION, CONFIG_IMAGE_WORDS, parameter WORDs,
+// CRC-16 (ModBus polynomial, high byte first) of all WORDs before
+#define CONFIG_IMAGE_VERSION 1                         // bump when the parameter WORDs change
+#define CONFIG_IMAGE_WORDS 72                          // parameter WORDs, see param_imageSlots()
+#define CONFIG_IMAGE_SIZE (3 + CONFIG_IMAGE_WORDS + 1) // fits one FC3 / FC16 frame (max 123 registers)
+
+// scan trace: TRACE_VERSION, MODEL_TYPE, acquisition gain, threshold, window begin, window end, position mode,
+// ADC rate in kHz, samples, recipe slot, facet, ADC start of the scan in us (high, low WORD),
+// raw samples, CRC-16 (ModBus polynomial, high byte first) of all WORDs before
+#define TRACE_VERSION 1
+#define TRACE_HEADER 13
+#define TRACE_SIZE (TRACE_HEADER + ANALOG_BUFFER_SIZE + 1) // read in two FC3 frames
+
 //////////////// registers of your slave ///////////////////
 enum
 {
@@ -292,12 +483,12 @@ enum
   MODBUS_FORMAT, // SERIAL_8N1 = 0, SERIAL_8E1 = 6, SERIAL_8O1 = 7 , SERIAL_8N2 = 4
 
   SET,            // RELAY = 0 (REL1 || REL2), MAN1 = 1, MAN2 = 2
-  GAIN_SET1,      // valid values 1,2,4,8,16,32,64
+  GAIN_SET1,      // valid values 1,2,4,8,16,32,64 (gain and threshold of the recipe of set 1 and 2)
   THRESHOLD_SET1, // min 20, max 80
   GAIN_SET2,      // valid values 1,2,4,8,16,32,64
   THRESHOLD_SET2, // min 20, max 80
 
-  WINDOW_BEGIN,    // min 5, max 50
+  WINDOW_BEGIN,    // min 5, max 50 (window, mode and filters of the recipe of set 1, other slots through RECIPE_EDIT)
   WINDOW_END,      // min 50 max 95
   POSITION_MODE,   // hmd = 0, rising = 1, falling = 2, peak = 3
   ANALOG_OUT_MODE, // an1/an2: "1Int2Pos" = 0, "1Pos2Int" = 1, "1Int2Int" = 2, "1Pos2Pos" = 3
@@ -323,6 +514,42 @@ enum
   EXEC_TIME_TRIGGER, // exectime of each triggering
   OFFSET_DELAY,      // calculated trigger delay
   TOTAL_ERRORS,
+  EEPROM_FLUSH,   // read: pending WORDs, write non zero: commit now
+  EEPROM_COMMITS, // number of EEPROM commit passes since power-up
+  MEAS_SCAN,      // scan number of PEAK_VALUE, POSITION_VALUE, POSITION_VALUE_AVG
+  MEAS_FACET,     // mirror facet of PEAK_VALUE, POSITION_VALUE, POSITION_VALUE_AVG
+  OUTPUT_DELAY,   // range 50 - 900 us, analog outputs latched this long after scan start
+  OUTPUT_LATENCY, // us from ADC start of a scan to its analog output latch
+  OUTPUT_LATE,    // outputs latched later than OUTPUT_DELAY (results calculation too slow)
+  POSITION_PREDICT,  // off = 0, on = 1 (position + velocity * pipeline latency)
+  POSITION_VELOCITY, // signed, position units (0 - 1000) per second
+  FILTER_UNIT,       // FILTER_ON and FILTER_OFF in ms = 0, us = 1
+  SET_LATENCY,       // us from SET_IN change to the first scan with the new parameter set
+  SET_LATENCY_MAX,   // write to reset
+  TEST_LATENCY,      // us from TEST_IN change to the first scan in test mode
+  LOOP_TIME,         // us, duration of the last loop()
+  LOOP_TIME_MAX,     // write to reset
+  FIRST_MEAS_TIME,   // ms from power on to the first valid measurement (motor locked)
+  RECIPE_SET1,       // recipe slot 1 - 8 of parameter set 1, used from the next scan
+  RECIPE_SET2,       // recipe slot 1 - 8 of parameter set 2
+  RECIPE_EDIT,       // recipe slot read and written by the registers below
+  RECIPE_GAIN,       // a whole recipe is written by one FC16 frame starting at RECIPE_EDIT
+  RECIPE_THRESHOLD,
+  RECIPE_WINDOW_BEGIN,
+  RECIPE_WINDOW_END,
+  RECIPE_POSITION_MODE,
+  RECIPE_FILTER_POSITION,
+  RECIPE_FILTER_ON,
+  RECIPE_FILTER_OFF,
+  CONFIG_IMAGE_STATUS, // result of the last image import, see config_importImage()
+  CONFIG_IMAGE,        // configuration image, read from here or written up to CONFIG_IMAGE_LAST in one frame
+  CONFIG_IMAGE_LAST = CONFIG_IMAGE + CONFIG_IMAGE_SIZE - 1,
+  TRACE_CONTROL, // write non zero: capture the next scan, write 0: cancel; read: TRACE_IDLE, TRACE_ARMED, TRACE_READY
+  TRACE,         // scan trace, kept until TRACE_CONTROL is written again
+  TRACE_LAST = TRACE + TRACE_SIZE - 1,
+  CPU_IDLE,  // 0.1 % of the last second outside the handlers below (loop() polling, other interrupts)
+  CPU_USAGE, // 0.1 % of the last second per handler, CPU_TIMER ... CPU_UART
+  CPU_USAGE_LAST = CPU_USAGE + CPU_COUNT - 1,
   // leave this one
   TOTAL_REGS_SIZE
   // total number of registers for function 3 and 16 share the same register array
@@ -330,6 +557,228 @@ enum
 
 uint16_t holdingRegs[TOTAL_REGS_SIZE]; // function 3 and 16 register array
 
+enum
+{
+  IMAGE_OK,
+  IMAGE_WRONG_MODEL,
+  IMAGE_WRONG_VERSION,
+  IMAGE_CRC_ERROR,
+  IMAGE_INVALID_VALUE
+};
+
+uint16_t configImage[CONFIG_IMAGE_SIZE]; // CONFIG_IMAGE registers
+int configImageStatus = IMAGE_OK;
+volatile boolean configImport = false; // image being applied, scans keep the previous config and recipe
+
+enum
+{
+  TRACE_IDLE,
+  TRACE_ARMED,
+  TRACE_READY
+};
+
+uint16_t traceBuf[TRACE_SIZE]; // TRACE registers, written by updateResults() only when TRACE_ARMED
+volatile int traceState = TRACE_IDLE;
+
+// PARAMETERS
+// one descriptor per setting, shared by the menus, ModBus and EEPROM load/repair,
+// values are in register units (as in ModBus and EEPROM), setting = value * scale
+
+#define PARAM_MODBUS 1      // restart communication after change
+#define PARAM_CALIBRATION 2 // kept by factory reset
+#define PARAM_IN_SET1 4     // recipe_t field of the slot of parameter set 1
+#define PARAM_IN_SET2 8     // recipe_t field of the slot of parameter set 2
+#define PARAM_IN_EDIT 16    // recipe_t field of the slot selected by RECIPE_EDIT, stored for every slot
+#define PARAM_IN_RECIPE (PARAM_IN_SET1 | PARAM_IN_SET2 | PARAM_IN_EDIT)
+
+struct paramDesc_t
+{
+  const char *label;             // menu text left of the value, NULL = ModBus only
+  const char *format;            // value format, NULL = text from names[]
+  const char *const *names;      // text per list entry, or per value from min
+  volatile int *value;           // setting, NULL for recipe fields
+  int recipe_t::*field;          // recipe field, in recipes[param_slot()]
+  int scale;                     // setting = value * scale
+  int def;                       // default value
+  int min, max;                  // valid values if list is NULL
+  const int *list;               // valid values
+  int listSize;                  //
+  int step, holdStep, holdStep2; // menu step, button held, held for 20 repeats
+  uint16_t eeAddr;               // EEPROM WORD, recipe fields in slot 1
+  uint16_t reg;                  // ModBus register
+  uint8_t flags;
+};
+
+enum
+{
+  PARAM_GAIN1, // MENU_SENSOR
+  PARAM_THRE1,
+  PARAM_GAIN2,
+  PARAM_THRE2,
+  PARAM_SET,
+  PARAM_RECIPE_SET1,
+  PARAM_RECIPE_SET2,
+  PARAM_MODBUS_ID, // MENU_MODBUS
+  PARAM_MODBUS_SPEED,
+  PARAM_MODBUS_FORMAT,
+  PARAM_FILTER_POSITION, // MENU_FILTERS
+  PARAM_FILTER_ON,
+  PARAM_FILTER_OFF,
+  PARAM_WINDOW_BEGIN, // MENU_ANALOG
+  PARAM_WINDOW_END,
+  PARAM_POSITION_MODE,
+  PARAM_ANALOG_OUT_MODE,
+  PARAM_POSITION_OFFSET,
+  PARAM_OUTPUT_DELAY, // ModBus only
+  PARAM_POSITION_PREDICT,
+  PARAM_FILTER_UNIT,
+  PARAM_RECIPE_EDIT,
+  PARAM_RECIPE_GAIN, // recipe_t fields in order
+  PARAM_RECIPE_THRESHOLD,
+  PARAM_RECIPE_WINDOW_BEGIN,
+  PARAM_RECIPE_WINDOW_END,
+  PARAM_RECIPE_POSITION_MODE,
+  PARAM_RECIPE_FILTER_POSITION,
+  PARAM_RECIPE_FILTER_ON,
+  PARAM_RECIPE_FILTER_OFF,
+  PARAM_COUNT
+};
+
+constexpr int gainList[] = {1, 2, 4, 8, 16, 32, 64};
+constexpr int speedList[] = {3, 6, 12, 24, 48, 96, 144, 192, 288, 384, 576, 1152}; // baudrate/100
+constexpr int formatList[] = {SERIAL_8N1, SERIAL_8E1, SERIAL_8O1, SERIAL_8N2};
+constexpr const char *formatNames[] = {"8N1", "8E1", "8O1", "8N2"};
+constexpr const char *setNames[] = {"REL ", "MAN1", "MAN2"};
+constexpr const char *positionModeNames[] = {" HMD", "RISE", "FALL", "PEAK"};
+constexpr const char *analogOutModeNames[] = {"1I2P", "1P2I", "1I2I", "1P2P"};
+
+constexpr paramDesc_t params[PARAM_COUNT] = {
+    // label, format, names, value, field, scale, default, min, max, list, size, steps, EEPROM, ModBus, flags
+    {"Gain1 ", "%2d", NULL, NULL, &recipe_t::pga, 1, DEFAULT_GAIN_SET1, 1, 64, gainList, 7, 1, 1, 1, EE_ADDR_RECIPE_FIELD(pga), GAIN_SET1, PARAM_IN_SET1},
+    {"Thre1 ", "%2d", NULL, NULL, &recipe_t::thre, 1, DEFAULT_THRESHOLD_SET1, 20, 80, NULL, 0, 5, 5, 5, EE_ADDR_RECIPE_FIELD(thre), THRESHOLD_SET1, PARAM_IN_SET1},
+    {"Gain2 ", "%2d", NULL, NULL, &recipe_t::pga, 1, DEFAULT_GAIN_SET2, 1, 64, gainList, 7, 1, 1, 1, EE_ADDR_RECIPE_FIELD(pga), GAIN_SET2, PARAM_IN_SET2},
+    {"Thre2 ", "%2d", NULL, NULL, &recipe_t::thre, 1, DEFAULT_THRESHOLD_SET2, 20, 80, NULL, 0, 5, 5, 5, EE_ADDR_RECIPE_FIELD(thre), THRESHOLD_SET2, PARAM_IN_SET2},
+    {"Set ", NULL, setNames, &set, NULL, 1, DEFAULT_SET, 0, 2, NULL, 0, 1, 1, 1, EE_ADDR_set, SET, 0},
+    {"Rcp1  ", "%2d", NULL, &recipeSet1, NULL, 1, DEFAULT_RECIPE_SET1, 1, RECIPE_COUNT, NULL, 0, 1, 1, 1, EE_ADDR_recipe_set1, RECIPE_SET1, 0},
+    {"Rcp2  ", "%2d", NULL, &recipeSet2, NULL, 1, DEFAULT_RECIPE_SET2, 1, RECIPE_COUNT, NULL, 0, 1, 1, 1, EE_ADDR_recipe_set2, RECIPE_SET2, 0},
+    {"ID   ", "%3d", NULL, &modbusID, NULL, 1, DEFAULT_MODBUS_ID, 1, 247, NULL, 0, 1, 10, 10, EE_ADDR_modbus_ID, MODBUS_ID, PARAM_MODBUS},
+    {"Sp", "%6d", NULL, &modbusSpeed, NULL, 100, DEFAULT_MODBUS_SPEED / 100, 3, 1152, speedList, 12, 1, 1, 1, EE_ADDR_modbus_Speed, MODBUS_SPEED, PARAM_MODBUS},
+    {"Fmt  ", NULL, formatNames, &modbusFormat, NULL, 1, DEFAULT_MODBUS_FORMAT, 0, 0, formatList, 4, 1, 1, 1, EE_ADDR_modbus_Format, MODBUS_FORMAT, PARAM_MODBUS},
+    {"fPos", "%4d", NULL, NULL, &recipe_t::filterPosition, 1, DEFAULT_FILTER_POSITION, 0, 9999, NULL, 0, 1, 10, 100, EE_ADDR_RECIPE_FIELD(filterPosition), FILTER_POSITION, PARAM_IN_SET1},
+    {"fOn ", "%4d", NULL, NULL, &recipe_t::filterOn, 1, DEFAULT_FILTER_ON, 0, 9999, NULL, 0, 1, 10, 100, EE_ADDR_RECIPE_FIELD(filterOn), FILTER_ON, PARAM_IN_SET1},
+    {"fOff", "%4d", NULL, NULL, &recipe_t::filterOff, 1, DEFAULT_FILTER_OFF, 0, 9999, NULL, 0, 1, 10, 100, EE_ADDR_RECIPE_FIELD(filterOff), FILTER_OFF, PARAM_IN_SET1},
+    {"wBeg", "%3d%%", NULL, NULL, &recipe_t::windowBegin, 1, DEFAULT_WINDOW_BEGIN, 5, 45, NULL, 0, 5, 5, 5, EE_ADDR_RECIPE_FIELD(windowBegin), WINDOW_BEGIN, PARAM_IN_SET1},
+    {"wEnd", "%3d%%", NULL, NULL, &recipe_t::windowEnd, 1, DEFAULT_WINDOW_END, 55, 95, NULL, 0, 5, 5, 5, EE_ADDR_RECIPE_FIELD(windowEnd), WINDOW_END, PARAM_IN_SET1},
+    {"mPos", NULL, positionModeNames, NULL, &recipe_t::positionMode, 1, DEFAULT_POSITION_MODE, 0, 3, NULL, 0, 1, 1, 1, EE_ADDR_RECIPE_FIELD(positionMode), POSITION_MODE, PARAM_IN_SET1},
+    {"AnO ", NULL, analogOutModeNames, &analogOutMode, NULL, 1, DEFAULT_ANALOG_OUT_MODE, 0, 3, NULL, 0, 1, 1, 1, EE_ADDR_analog_out_mode, ANALOG_OUT_MODE, 0},
+    {"Offs", "%4d", NULL, &positionOffset, NULL, 1, DEFAULT_POSITION_OFFSET, 0, 2000, NULL, 0, 1, 10, 10, EE_ADDR_position_offset, POSITION_OFFSET, PARAM_CALIBRATION},
+    {NULL, NULL, NULL, &outputDelay, NULL, 1, DEFAULT_OUTPUT_DELAY, 50, 900, NULL, 0, 0, 0, 0, EE_ADDR_output_delay, OUTPUT_DELAY, 0},
+    {NULL, NULL, NULL, &positionPredict, NULL, 1, DEFAULT_POSITION_PREDICT, 0, 1, NULL, 0, 0, 0, 0, EE_ADDR_position_predict, POSITION_PREDICT, 0},
+    {NULL, NULL, NULL, &filterUnit, NULL, 1, DEFAULT_FILTER_UNIT, 0, 1, NULL, 0, 0, 0, 0, EE_ADDR_filter_unit, FILTER_UNIT, 0},
+    {NULL, NULL, NULL, &recipeEdit, NULL, 1, 1, 1, RECIPE_COUNT, NULL, 0, 0, 0, 0, EE_ADDR_recipe_edit, RECIPE_EDIT, 0},
+    {NULL, NULL, NULL, NULL, &recipe_t::pga, 1, DEFAULT_GAIN_SET1, 1, 64, gainList, 7, 0, 0, 0, EE_ADDR_RECIPE_FIELD(pga), RECIPE_GAIN, PARAM_IN_EDIT},
+    {NULL, NULL, NULL, NULL, &recipe_t::thre, 1, DEFAULT_THRESHOLD_SET1, 20, 80, NULL, 0, 0, 0, 0, EE_ADDR_RECIPE_FIELD(thre), RECIPE_THRESHOLD, PARAM_IN_EDIT},
+    {NULL, NULL, NULL, NULL, &recipe_t::windowBegin, 1, DEFAULT_WINDOW_BEGIN, 5, 45, NULL, 0, 0, 0, 0, EE_ADDR_RECIPE_FIELD(windowBegin), RECIPE_WINDOW_BEGIN, PARAM_IN_EDIT},
+    {NULL, NULL, NULL, NULL, &recipe_t::windowEnd, 1, DEFAULT_WINDOW_END, 55, 95, NULL, 0, 0, 0, 0, EE_ADDR_RECIPE_FIELD(windowEnd), RECIPE_WINDOW_END, PARAM_IN_EDIT},
+    {NULL, NULL, NULL, NULL, &recipe_t::positionMode, 1, DEFAULT_POSITION_MODE, 0, 3, NULL, 0, 0, 0, 0, EE_ADDR_RECIPE_FIELD(positionMode), RECIPE_POSITION_MODE, PARAM_IN_EDIT},
+    {NULL, NULL, NULL, NULL, &recipe_t::filterPosition, 1, DEFAULT_FILTER_POSITION, 0, 9999, NULL, 0, 0, 0, 0, EE_ADDR_RECIPE_FIELD(filterPosition), RECIPE_FILTER_POSITION, PARAM_IN_EDIT},
+    {NULL, NULL, NULL, NULL, &recipe_t::filterOn, 1, DEFAULT_FILTER_ON, 0, 9999, NULL, 0, 0, 0, 0, EE_ADDR_RECIPE_FIELD(filterOn), RECIPE_FILTER_ON, PARAM_IN_EDIT},
+    {NULL, NULL, NULL, NULL, &recipe_t::filterOff, 1, DEFAULT_FILTER_OFF, 0, 9999, NULL, 0, 0, 0, 0, EE_ADDR_RECIPE_FIELD(filterOff), RECIPE_FILTER_OFF, PARAM_IN_EDIT},
+};
+
+constexpr bool params_formatsValid()
+{
+  for (int p = 0; p < PARAM_COUNT; p++)
+  {
+    if (params[p].format && !displayFormatValid(params[p].format))
+      return false;
+  }
+  return true;
+}
+static_assert(params_formatsValid(), "unsupported display format in params[]");
+
+constexpr int params_lastReg()
+{
+  int last = 0;
+  for (int p = 0; p < PARAM_COUNT; p++)
+    last = params[p].reg > last ? params[p].reg : last;
+  return last;
+}
+#define PARAM_REGS (params_lastReg() + 1) // registers up to the last parameter
+
+// params[] index per ModBus register, -1 if not a parameter, see param_find()
+struct paramIndex_t
+{
+  int8_t p[PARAM_REGS];
+};
+
+constexpr paramIndex_t params_index()
+{
+  paramIndex_t index = {};
+  for (int reg = 0; reg < PARAM_REGS; reg++)
+    index.p[reg] = -1;
+  for (int p = 0; p < PARAM_COUNT; p++)
+    index.p[params[p].reg] = p;
+  return index;
+}
+constexpr paramIndex_t paramIndex = params_index();
+
+constexpr bool params_regsUnique()
+{
+  for (int p = 0; p < PARAM_COUNT; p++)
+  {
+    if (paramIndex.p[params[p].reg] != p)
+      return false;
+  }
+  return true;
+}
+static_assert(PARAM_COUNT <= 127, "params[] index does not fit paramIndex_t");
+static_assert(params_regsUnique(), "two params[] share a ModBus register");
+
+// WORDs of a parameter in the configuration image, communication and calibration stay with the unit
+constexpr int param_imageSlots(const paramDesc_t *d)
+{
+  if (d->flags & (PARAM_MODBUS | PARAM_CALIBRATION | PARAM_IN_SET1 | PARAM_IN_SET2))
+    return 0; // not stored or not cloned
+  return (d->flags & PARAM_IN_EDIT) ? RECIPE_COUNT : 1;
+}
+
+constexpr int configImage_words()
+{
+  int n = 0;
+  for (int p = 0; p < PARAM_COUNT; p++)
+    n += param_imageSlots(&params[p]);
+  return n;
+}
+static_assert(configImage_words() == CONFIG_IMAGE_WORDS, "params[] changed, update CONFIG_IMAGE_WORDS and CONFIG_IMAGE_VERSION");
+
+// parameter set 1 and 2 WORDs of journal schema 1 per recipe_t field, see config_migrate()
+constexpr uint16_t schema1Set1[RECIPE_WORDS] = {EE_ADDR_gain_set1, EE_ADDR_threshold_set1, EE_ADDR_window_begin, EE_ADDR_window_end,
+                                                EE_ADDR_position_mode, EE_ADDR_filter_position, EE_ADDR_filter_on, EE_ADDR_filter_off};
+constexpr uint16_t schema1Set2[RECIPE_WORDS] = {EE_ADDR_gain_set2, EE_ADDR_threshold_set2, EE_ADDR_window_begin, EE_ADDR_window_end,
+                                                EE_ADDR_position_mode, EE_ADDR_filter_position, EE_ADDR_filter_on, EE_ADDR_filter_off};
+
+// browse menus below MENU_SETUP, each showing a range of params[]
+struct menuGroup_t
+{
+  int menu;
+  int setupOption; // option of MENU_SETUP leading here
+  int first;       // params[] shown
+  int count;
+};
+
+constexpr menuGroup_t menuGroups[] = {
+    {MENU_SENSOR, 0, PARAM_GAIN1, 7},
+    {MENU_MODBUS, 1, PARAM_MODBUS_ID, 3},
+    {MENU_FILTERS, 2, PARAM_FILTER_POSITION, 3},
+    {MENU_ANALOG, 3, PARAM_WINDOW_BEGIN, 5},
+};
+
+int menuGroup = 0; // menuGroups[] of the edited parameter
+int menuParam = 0; // params[] being edited
+int menuSlot = 0;  // recipe slot of menuParam at entry, saved to it even if RECIPE_SET1/2 changed since
+int menuValue = 0; // edited value, saved on BTN_D
+
 // I/O Status bits for Modbus
 enum
 {
@@ -350,9 +799,16 @@ enum
 
 // Timers
 
-IntervalTimer timer500us; // timer for motor speed and various timeouts
+IntervalTimer timer500us;    // timeouts, fixed 500us
+IntervalTimer timerMotor;    // MOTOR_CLK, period ramped by checkMOTOR()
+boolean timerHalfMs = false; // hourTimeout counts every second tick
 
 int startTimerValue0 = 0;
+volatile int motorState = MOTOR_RAMP;
+int motorSpeed = MOTOR_SPEED_START; // % of full speed
+unsigned long motorStepTime = 0;    // millis() of the last ramp step
+unsigned long motorStepMicros = 0;  // micros() of the last ramp step
+volatile unsigned long firstMeasTime = 0;
 
 volatile int motorPulseIndex = 0;
 volatile long motorTimeOld = 0;
@@ -364,6 +820,49 @@ volatile int peakValueDisp = 0;
 volatile int positionValueDisp = 0;
 volatile int positionValueAvgDisp = 0;
 
+// measurement block published once per scan by updateResults()
+struct measurement_t
+{
+  uint16_t scan;             // scan number
+  uint16_t facet;            // mirror facet the scan belongs to
+  uint16_t peakValue;        // 0 - 100%
+  uint16_t positionValue;    // not averaged position
+  uint16_t positionValueAvg; // 0 - 1000
+};
+
+volatile measurement_t measurementBuf[2]; // double buffer, published one is measurementSeq & 1
+volatile uint32_t measurementSeq = 0;     // sequence lock, incremented after each publish
+measurement_t mbMeasurement;              // snapshot served to ModBus
+uint16_t scanCount = 0;
+volatile int adcFacet = 0;  // facet of the running ADC conversion
+volatile int dataFacet = 0; // facet of the scan in adc_data[]
+
+// SET_IN and TEST_IN, staged by pin interrupts and applied in callback_delay() at the next scan
+volatile int setInput = 0;                  // SET_IN open = set 1 (0), closed = set 2 (1)
+volatile boolean setEdgePending = false;    // SET_IN changed, not yet applied
+volatile unsigned long setEdgeTime = 0;     // micros() of the last SET_IN change
+volatile int adcSet = 0;                    // parameter set of the running ADC conversion
+volatile int adcRecipe = 0;                 // recipe slot of the running ADC conversion
+volatile int dataRecipe = 0;                // recipe slot of the scan in adc_data[]
+volatile int adcPga = 1;                    // PGA gain of the running ADC conversion
+volatile int dataPga = 1;                   // PGA gain the scan in adc_data[] was acquired with
+volatile boolean testInput = false;         // TEST_IN closed
+volatile boolean testEdgePending = false;   // TEST_IN changed, not yet applied
+volatile unsigned long testEdgeTime = 0;    // micros() of the last TEST_IN change
+volatile unsigned long setLatency = 0;      // us from SET_IN change to the first scan with the new set
+volatile unsigned long setLatencyMax = 0;
+volatile unsigned long testLatency = 0;     // us from TEST_IN change to the first scan in test mode
+#define INPUT_APPLY_TIMEOUT 10000           // us, apply inputs from loop() when there are no scans
+
+// analog outputs, calculated in updateResults() and latched in callback_output()
+volatile int dacAN1 = 0;
+volatile int dacAN2 = 0;
+volatile unsigned long dataStartTime = 0; // ADC start of the scan in adc_data[]
+volatile unsigned long dacDataTime = 0;   // ADC start of the scan in dacAN1/dacAN2
+volatile unsigned long scanStartTime = 0; // start of the actual scan (callback_delay)
+volatile uint16_t outputLatency = 0;
+volatile uint16_t outputLate = 0;
+
 // button interrupt
 #define STATE_NORMAL 0
 #define STATE_SHORT 1
@@ -393,55 +892,111 @@ int temp;    // internal ADC Temp channel value
 int max_temperature = 0;
 unsigned int total_runtime = 0;
 
+// EEPROM write-behind cache
+uint16_t eeCacheValue[EE_CACHE_SIZE / 2]; // pending values, one per WORD address
+boolean eeCacheDirty[EE_CACHE_SIZE / 2];  // WORD waiting for commit
+int eeCachePending = 0;                   // number of dirty WORDs
+unsigned int eepromCommits = 0;           // commit passes performed since power-up
+boolean eepromFlush = false;              // commit requested via ModBus
+
+// EEPROM config journal, see eeprom_commit() and journal_replay()
+struct journalRecord_t
+{
+  uint8_t key;    // WORD address / 2, or JOURNAL_KEY_COMMIT
+  uint8_t count;  // WORD: records up to the commit marker, marker: WORDs in the commit
+  uint16_t seq;   // commit sequence number
+  uint16_t value; // WORD value, marker: JOURNAL_SCHEMA
+  uint16_t crc;   // CRC-16 of the fields above
+};
+static_assert(sizeof(journalRecord_t) == 8, "journal record size");
+static_assert(JOURNAL_MAX_COMMIT + JOURNAL_KEYS + JOURNAL_RESERVE / 2 <= JOURNAL_RECORDS, "journal too small for a commit of all WORDs");
+static_assert(JOURNAL_RESERVE * JOURNAL_RESERVE > 2 * JOURNAL_KEYS, "compaction must get past a run of committed WORDs");
+
+int journalHead = 0;                  // slot of the next record
+uint16_t journalSeq = 0;              // sequence number of the next commit
+uint16_t journalValue[JOURNAL_KEYS];  // committed value per WORD
+int16_t journalSlot[JOURNAL_KEYS];    // slot of the committed record, -1 if never written
+uint16_t journalKeySeq[JOURNAL_KEYS]; // commit of the committed record
+
 // Display print wrapper
-void displayPrint(const char *format, ...);
+void displayPrintf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void displayFormat(char *S, int size, const char *format, va_list arg);
+void displayFormatf(char *S, int size, const char *format, ...) __attribute__((format(printf, 3, 4)));
+void checkDisplay(void);
+void displayFlush(void);
+void displayMessage(const char *message);
 void displayMenu(void);
 void showAlarm(void);
 // Main Menu View
 void showMainMenu(void);
 void showLoginMenu(void);
 void showSetupMenu(void);
-void showSensorMenu(void);
-void setGain1Menu(void);
-void setThre1Menu(void);
-void setGain2Menu(void);
-void setThre2Menu(void);
-void setSetMenu(void);
-void showModbusMenu(void);
-void setModbusID(void);
-void setModbusSpeed(void);
-void setModbusFormat(void);
-void showFiltersMenu(void);
-void setFilterPosition(void);
-void setFilterOn(void);
-void setFilterOff(void);
-void showAnalogMenu(void);
-void setWindowBegin(void);
-void setWindowEnd(void);
-void setPositionMode(void);
-void setAnalogOutMode(void);
-void setPositionOffset(void);
+void showParamGroup(int group);
+void setParamMenu(void);
+void param_display(const paramDesc_t *d, int value, boolean showLabel);
+
+// parameters
+int param_find(uint16_t reg);
+boolean param_valid(const paramDesc_t *d, int value);
+int param_index(const paramDesc_t *d, int value);
+int param_slot(const paramDesc_t *d);
+int param_slots(const paramDesc_t *d);
+volatile int *param_ptr(const paramDesc_t *d, int slot);
+uint16_t param_addr(const paramDesc_t *d, int slot);
+int param_get(int p, int slot);
+boolean param_write(int p, int value, int slot);
 void showInfoMenu(void);
 void showResetMenu(void);
 
 // EEPROM
 
-// Write a unsigned int (two bytes) value to eeprom
+// Write a unsigned int (two bytes) value to eeprom (write-behind, see eeprom_commit())
 void eeprom_writeInt(unsigned int address, unsigned int value);
-void eeprom_updateInt(unsigned int address, unsigned int value);
 // read a unsigned int (two bytes) value from eeprom
 unsigned int eeprom_readInt(unsigned int address);
+unsigned int eeprom_readLegacy(unsigned int address);
+void eeprom_commit();
+void checkEEPROM();
+uint16_t crc16_update(uint16_t crc, uint8_t data);
+uint16_t journal_crc(const journalRecord_t *rec);
+boolean journal_read(int slot, journalRecord_t *rec);
+void journal_write(int slot, uint8_t key, uint8_t count, uint16_t value);
+int journal_distance(int slot);
+int journal_oldest(const boolean *skip);
+int journal_free();
+void journal_append(const uint8_t *keys, const uint16_t *values, int count);
+int journal_compact();
+unsigned int journal_replay();
 void EEPROM_init();
+void config_migrate(unsigned int schema);
 void config_loadFromEEPROM();
 void config_writeDefaultsToEEPROM();
 void reset_writeDefaultsToEEPROM();
+void recipe_writeSet2Defaults();
+
+// configuration image
+void config_exportImage();
+int config_importImage();
+uint16_t config_imageCRC();
+
+// scan trace
+void trace_capture(const scanRecipe_t *rcp);
+uint16_t trace_CRC();
 
 // check SET and load proper settings
 void checkSET();
+int recipe_active();
+void config_build();
+boolean config_isCurrent(const scanConfig_t *c);
 void checkTEST();
+void setIn_isr();
+void testIn_isr();
 void checkALARM();
+void checkMOTOR();
+void checkCPU();
 
 // SPI send 2 x 16 bit value
+void dac_begin();
 void updateSPI(int valueAN1, int valueAN2);
 
 // INTERRUPT ROUTINES
@@ -453,21 +1008,37 @@ void checkButtonB();
 void checkButtonC();
 void checkButtonD();
 
+// Serial1 interrupt of the core, counted as CPU_UART
+void serial1_isr(void);
+
 // Timer interrupts
 void timer500us_isr(void);
+void motorClock_isr(void);
 
 // motor (from HALL sensor) interrupt
 void motor_isr(void);
 
 void callback_delay();
+void callback_output();
 void adc0_dma_isr(void);
 void updateResults();
 
 // exponential moving average
 long approxSimpleMovingAverage(int new_value, int period);
+long predictPosition(long positionAvg, const scanConfig_t *cfg, const scanRecipe_t *rcp);
+
+// SIGNAL PRESENT on/off delay
+void signalFilter(unsigned long scanTime, const scanRecipe_t *rcp);
+
+// coherent measurement snapshots
+void measurement_publish(int peakValue, int positionValue, int positionValueAvg);
+void measurement_read(measurement_t *m);
 
 void checkSTATUS();
 void checkModbus();
+uint16_t modbus_readRegister(uint16_t address);
+void modbus_writeRegister(uint16_t address, uint16_t value);
+void modbus_readFrame(uint16_t startingAddress, uint16_t count);
 
 void setup()
 {
@@ -499,6 +1070,11 @@ void setup()
 
   pinMode(TEST_IN, INPUT_PULLUP);
   pinMode(SET_IN, INPUT_PULLUP);
+  setInput = digitalReadFast(SET_IN) ? 0 : 1;
+  testInput = !digitalReadFast(TEST_IN);
+  extTest = testInput;
+  attachInterrupt(digitalPinToInterrupt(SET_IN), setIn_isr, CHANGE);
+  attachInterrupt(digitalPinToInterrupt(TEST_IN), testIn_isr, CHANGE);
 
   pinMode(LASER, OUTPUT);
   pinMode(IR_LED, OUTPUT);
@@ -508,23 +1084,21 @@ void setup()
   // set the brightness of the display:
   myDisplay.setBrightness(brightness);
 
+  // cycle counter for CPU usage, see checkCPU()
+  ARM_DEMCR |= ARM_DEMCR_TRCENA;
+  ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+  cpuWindowStart = ARM_DWT_CYCCNT;
+
   // use wrapper for myDisplay.print
   displayPrint("Starting");
-  delay(500);
+  displayFlush();
 
   EEPROM_init();
 
-  //initialize filters
-  pinMode(FILTER_PIN, OUTPUT);
-  digitalWriteFast(FILTER_PIN, LOW);
-  filterOnOff.attach(FILTER_PIN);
-  filterOnOff.interval(filterOn);
-
   //initialize SPI
 
-  pinMode(SPI_CS, OUTPUT);
-  digitalWrite(SPI_CS, HIGH);
   SPI.begin();
+  dac_begin();
   updateSPI(0, 0);
 
   // enable serial communication
@@ -540,6 +1114,8 @@ void setup()
   //Serial.begin(modbusSpeed);
 
   modbus_configure(modbusSpeed, modbusFormat, modbusID, TXEN, TOTAL_REGS_SIZE, 0);
+  modbus_attachRegisterMap(modbus_readRegister, modbus_writeRegister, modbus_readFrame);
+  attachInterruptVector(IRQ_UART0_STATUS, serial1_isr); // Serial1 interrupt with CPU accounting
 
   //initialize ADC
 
@@ -597,54 +1173,170 @@ void setup()
 
   //NVIC_SET_PRIORITY(IRQ_PORTC, 0);
 
-  //motor slow start
-  timer500us.priority(0);
-
-  for (int speed = 20; speed <= 100; speed++)
-  {
-    timer500us.end();
-    startTimerValue0 = timer500us.begin(timer500us_isr, 50000 / speed); //motor output pulses slowly going to 500us
-    displayPrint("Mot=%3d%%", speed);
-    delay(100);
-  }
+  //motor slow start, ramped by checkMOTOR() while the loop is already running
+  timerMotor.priority(0);
+  startTimerValue0 = timerMotor.begin(motorClock_isr, 50000 / motorSpeed); //motor output pulses slowly going to 500us
+  timer500us.begin(timer500us_isr, 500);
+  motorStepTime = millis();
+  motorStepMicros = micros();
 
   TeensyDelay::begin();
-  TeensyDelay::addDelayChannel(callback_delay, 0); //setup channel 0
+  TeensyDelay::addDelayChannel(callback_delay, 0);  //setup channel 0
+  TeensyDelay::addDelayChannel(callback_output, 1); //setup channel 1 for analog outputs
 
   //clear data buffers
   memset((void *)adc0_buf, 0, sizeof(adc0_buf));
   memset((void *)adc_data, 0, sizeof(adc_data));
+
+  loopStartTime = micros();
 }
 
 void loop()
 {
+  cpuMark_t cpu = cpu_enter();
+
   // check SET
   checkSET();
   // check TEST
   checkTEST();
+  cpu = cpu_next(CPU_INPUTS, cpu);
+
+  // motor ramp until HALL lock
+  checkMOTOR();
   // check ALARMS and WARNINGS
   checkALARM();
 
   // check IO STATUS
   checkSTATUS();
+  cpu = cpu_next(CPU_ALARM, cpu);
 
   // update modbus
   checkModbus();
+  cpu = cpu_next(CPU_MODBUS, cpu);
+
+  // commit pending config changes
+  checkEEPROM();
+  cpu = cpu_next(CPU_EEPROM, cpu);
 
   //show info on LED display
   displayMenu();
+  checkDisplay();
+  cpu_leave(CPU_DISPLAY, cpu);
+
+  // CPU usage of the last second
+  checkCPU();
+
+  unsigned long now = micros();
+  loopTime = now - loopStartTime;
+  if (loopTime > loopTimeMax)
+    loopTimeMax = loopTime;
+  loopStartTime = now;
 }
 
-// Display print wrapper
-void displayPrint(const char *format, ...)
+// Display print wrapper, use displayPrint() for the compile time format check
+void displayPrintf(const char *format, ...)
+{
+  char S[displayLength + 1];
+  va_list arg;
+  va_start(arg, format);
+  displayFormat(S, sizeof(S), format, arg);
+  va_end(arg);
+  for (int i = 0; i < displayLength && S[i]; i++)
+    displayFrame[i] = S[i];
+}
+
+// small vsnprintf() for the display, same output for the formats accepted by
+// displayFormatValid(): text, %%, %s and %d right aligned to width 1 - 9
+void displayFormat(char *S, int size, const char *format, va_list arg)
+{
+  int n = 0;
+
+  while (*format && n < size - 1)
+  {
+    char c = *format++;
+    if (c != '%')
+    {
+      S[n++] = c;
+      continue;
+    }
+
+    int width = 0;
+    if (*format >= '1' && *format <= '9')
+      width = *format++ - '0';
+    c = *format;
+    if (!c)
+      break;
+    format++;
+
+    if (c == '%')
+      S[n++] = '%';
+    else if (c == 's')
+    {
+      const char *s = va_arg(arg, const char *);
+      for (int len = strlen(s); len < width && n < size - 1; len++)
+        S[n++] = ' ';
+      while (*s && n < size - 1)
+        S[n++] = *s++;
+    }
+    else if (c == 'd')
+    {
+      int value = va_arg(arg, int);
+      unsigned int u = value < 0 ? 0U - value : value;
+      char digits[11]; // reversed
+      int len = 0;
+      do
+      {
+        digits[len++] = '0' + u % 10;
+        u /= 10;
+      } while (u);
+      if (value < 0)
+        digits[len++] = '-';
+      for (int i = len; i < width && n < size - 1; i++)
+        S[n++] = ' ';
+      while (len && n < size - 1)
+        S[n++] = digits[--len];
+    }
+  }
+  S[n] = 0;
+}
+
+void displayFormatf(char *S, int size, const char *format, ...)
 {
-  char S[10];
   va_list arg;
   va_start(arg, format);
-  vsnprintf(S, sizeof(S), format, arg);
+  displayFormat(S, size, format, arg);
   va_end(arg);
-  myDisplay.home();
-  myDisplay.print(S);
+}
+
+// write the next changed character to the display, one glyph per call
+void checkDisplay(void)
+{
+  for (int n = 0; n < displayLength; n++)
+  {
+    int i = displayPos;
+    displayPos = (displayPos + 1) % displayLength;
+    if (displayFrame[i] != displayShown[i])
+    {
+      myDisplay.setCursor(i);
+      myDisplay.write((uint8_t)displayFrame[i]);
+      displayShown[i] = displayFrame[i];
+      return;
+    }
+  }
+}
+
+// write all changed characters now
+void displayFlush(void)
+{
+  for (int n = 0; n < displayLength; n++)
+    checkDisplay();
+}
+
+// show message for TIMEOUT_MESSAGE without blocking, menus continue after it
+void displayMessage(const char *message)
+{
+  displayPrint("%s", message);
+  messageTimeout = TIMEOUT_MESSAGE;
 }
 
 //***************************************************************************************
@@ -652,6 +1344,9 @@ void displayPrint(const char *format, ...)
 
 void displayMenu(void)
 {
+  if (messageTimeout) // keys are kept until the message expires
+    return;
+
   if (!refreshMenuTimeout)
   {
 
@@ -746,64 +1441,19 @@ void displayMenu(void)
       showSetupMenu();
       break;
     case MENU_SENSOR:
-      showSensorMenu();
-      break;
-    case MENU_GAIN1:
-      setGain1Menu();
-      break;
-    case MENU_THRE1:
-      setThre1Menu();
-      break;
-    case MENU_GAIN2:
-      setGain2Menu();
-      break;
-    case MENU_THRE2:
-      setThre2Menu();
-      break;
-    case MENU_SET:
-      setSetMenu();
+      showParamGroup(0);
       break;
     case MENU_MODBUS:
-      showModbusMenu();
-      break;
-    case MENU_MODBUS_ID:
-      setModbusID();
-      break;
-    case MENU_MODBUS_SPEED:
-      setModbusSpeed();
-      break;
-    case MENU_MODBUS_FORMAT:
-      setModbusFormat();
+      showParamGroup(1);
       break;
     case MENU_FILTERS:
-      showFiltersMenu();
-      break;
-    case MENU_FILTER_POSITION:
-      setFilterPosition();
-      break;
-    case MENU_FILTER_ON:
-      setFilterOn();
-      break;
-    case MENU_FILTER_OFF:
-      setFilterOff();
+      showParamGroup(2);
       break;
     case MENU_ANALOG:
-      showAnalogMenu();
-      break;
-    case MENU_WINDOW_BEGIN:
-      setWindowBegin();
-      break;
-    case MENU_WINDOW_END:
-      setWindowEnd();
-      break;
-    case MENU_POSITION_MODE:
-      setPositionMode();
+      showParamGroup(3);
       break;
-    case MENU_ANALOG_OUT_MODE:
-      setAnalogOutMode();
-      break;
-    case MENU_POSITION_OFFSET:
-      setPositionOffset();
+    case MENU_PARAM:
+      setParamMenu();
       break;
     case MENU_INFO:
       showInfoMenu();
@@ -868,7 +1518,12 @@ void showMainMenu(void)
 {
 
   if (currentMenuOption == 0)
-    displayPrint("Int %3d%%", peakValueDisp);
+  {
+    if (motorState == MOTOR_RUN)
+      displayPrint("Int %3d%%", peakValueDisp);
+    else
+      displayPrint("Mot=%3d%%", motorSpeed);
+  }
   else if (!menuTimeout)
     menuTimeout = TIMEOUT_MENU;
 
@@ -955,23 +1610,23 @@ void showLoginMenu(void)
     passwd = passwd + 10 * lastKey;
     break;
   case 4:
-    displayPrint("PIN:****");
+    displayMessage("PIN:****");
     passwd = passwd + lastKey;
-    delay(500);
+    nextBtn = 5; // check PIN after the message
+    break;
+  default:
     if (passwd == 2314)
     {
       currentMenu = MENU_SETUP;
       currentMenuOption = 0;
-      displayPrint("PIN  OK!");
-      delay(500);
+      displayMessage("PIN  OK!");
       nextBtn = 0;
       passwd = 0;
       loggedIn = true;
     }
     else
     {
-      displayPrint("BAD PIN!");
-      delay(500);
+      displayMessage("BAD PIN!");
       nextBtn = 0;
       passwd = 0;
       loggedIn = false;
@@ -979,8 +1634,6 @@ void showLoginMenu(void)
       currentMenuOption = 0;
     }
     break;
-  default:
-    break;
   }
 }
 
@@ -1072,36 +1725,33 @@ void showSetupMenu(void)
 
   if (lastKey == BTN_AH)
   {
-    displayPrint("Logout !");
+    displayMessage("Logout !");
     passwd = 0;
     nextBtn = 0;
     loggedIn = false;
-    delay(500);
     currentMenu = MENU_MAIN;
     currentMenuOption = 0;
   }
 }
 
-void showSensorMenu(void)
+// browse menuGroups[group], BTN_D edits the shown parameter
+void showParamGroup(int group)
 {
+  const menuGroup_t *g = &menuGroups[group];
+  int p = g->first + currentMenuOption;
+
   if (!menuTimeout)
     menuTimeout = TIMEOUT_MENU;
 
-  if (currentMenuOption == 0)
-    displayPrint("Gain1 %2d", pga1);
-  if (currentMenuOption == 1)
-    displayPrint("Thre1 %2d", thre1);
-  if (currentMenuOption == 2)
-    displayPrint("Gain2 %2d", pga2);
-  if (currentMenuOption == 3)
-    displayPrint("Thre2 %2d", thre2);
-  if (currentMenuOption == 4)
-    displayPrint("Set %s", menu_setDisp[setDispIndex]);
+  if (p == PARAM_SET)
+    displayPrint("Set %s", menu_setDisp[setDispIndex]); // REL1/REL2 follow SET_IN
+  else
+    param_display(&params[p], param_get(p, param_slot(&params[p])), true);
 
   if (lastKey == BTN_A || lastKey == BTN_AH)
   { // ESC
     currentMenu = MENU_SETUP;
-    currentMenuOption = 0;
+    currentMenuOption = g->setupOption;
   }
 
   if (lastKey == BTN_B || lastKey == BTN_BH)
@@ -1109,1058 +1759,96 @@ void showSensorMenu(void)
     if (currentMenuOption > 0)
       currentMenuOption--;
     else
-      currentMenuOption = 4;
+      currentMenuOption = g->count - 1;
   }
 
   if (lastKey == BTN_C || lastKey == BTN_CH)
   {
-    if (currentMenuOption < 4)
+    if (currentMenuOption < g->count - 1)
       currentMenuOption++;
     else
       currentMenuOption = 0;
   }
 
   if (lastKey == BTN_D || lastKey == BTN_DH)
-  {
-    if (currentMenuOption == 0)
-    {
-      currentMenu = MENU_GAIN1;
-      currentMenuOption = 0;
-      menu_pga = pga1; // local menu variable to avoid changes until saved
-    }
-    if (currentMenuOption == 1)
-    {
-      currentMenu = MENU_THRE1;
-      currentMenuOption = 0;
-      menu_thre = thre1; // local menu variable to avoid changes until saved
-    }
-    if (currentMenuOption == 2)
-    {
-      currentMenu = MENU_GAIN2;
-      currentMenuOption = 0;
-      menu_pga = pga2; // local menu variable to avoid changes until saved
-    }
-    if (currentMenuOption == 3)
-    {
-      currentMenu = MENU_THRE2;
-      currentMenuOption = 0;
-      menu_thre = thre2; // local menu variable to avoid changes until saved
-    }
-    if (currentMenuOption == 4)
-    {
-      currentMenu = MENU_SET;
-      currentMenuOption = 0;
-      menu_set = set; // local menu variable to avoid changes until saved
-    }
+  { // ENTER
+    menuGroup = group;
+    menuParam = p;
+    menuSlot = param_slot(&params[p]);
+    menuValue = param_get(p, menuSlot); // local menu variable to avoid changes until saved
+    currentMenu = MENU_PARAM;
+    currentMenuOption = 0;
   }
 }
 
-void setGain1Menu(void)
+// edit params[menuParam], B/C step through the valid values
+void setParamMenu(void)
 {
+  const paramDesc_t *d = &params[menuParam];
+  int dir = 0;
+
   if (!menuTimeout)
     menuTimeout = TIMEOUT_MENU;
 
-  if (blinkMenu)
-    displayPrint("Gain1 %2d", menu_pga);
-  else
-    displayPrint("      %2d", menu_pga);
+  param_display(d, menuValue, blinkMenu);
 
   if (lastKey == BTN_B || lastKey == BTN_BH)
-  {
-    if (menu_pga > 1)
-      menu_pga = menu_pga / 2;
-    else
-      menu_pga = 64;
-  }
-
+    dir = -1;
   if (lastKey == BTN_C || lastKey == BTN_CH)
+    dir = 1;
+
+  if (dir && d->list)
+  { // next list entry
+    int i = (param_index(d, menuValue) + dir + d->listSize) % d->listSize;
+    menuValue = d->list[i];
+  }
+  else if (dir)
   {
-    if (menu_pga < 64)
-      menu_pga = menu_pga * 2;
+    if (lastKey == BTN_B || lastKey == BTN_C)
+      menuValue += dir * d->step;
+    else if (btnHoldCounter < 20) // hold to change faster
+      menuValue += dir * d->holdStep;
     else
-      menu_pga = 1;
+      menuValue += dir * d->holdStep2;
+
+    if (menuValue < d->min)
+      menuValue = d->max;
+    if (menuValue > d->max)
+      menuValue = d->min;
   }
 
   if (lastKey == BTN_A || lastKey == BTN_AH)
-  { //ESC
-    currentMenu = MENU_SENSOR;
-    currentMenuOption = 0;
+  { // ESC
+    currentMenu = menuGroups[menuGroup].menu;
+    currentMenuOption = menuParam - menuGroups[menuGroup].first;
   }
 
   if (lastKey == BTN_D || lastKey == BTN_DH)
-  { //SAVE
-    pga1 = menu_pga;
-    eeprom_writeInt(EE_ADDR_gain_set1, pga1); //save to EEPROM
-    displayPrint("SAVED!!!");
-    delay(500);
-    currentMenu = MENU_SENSOR;
-    currentMenuOption = 0;
+  { // SAVE
+    param_write(menuParam, menuValue, menuSlot);
+    displayMessage("SAVED!!!");
+    currentMenu = menuGroups[menuGroup].menu;
+    currentMenuOption = menuParam - menuGroups[menuGroup].first;
   }
 }
 
-void setThre1Menu(void)
+// label and value, label replaced by spaces while blinking
+void param_display(const paramDesc_t *d, int value, boolean showLabel)
 {
-  if (!menuTimeout)
-    menuTimeout = TIMEOUT_MENU;
+  const char *blank = "        ";
+  const char *label = showLabel ? d->label : blank + displayLength - strlen(d->label);
+  char S[displayLength + 1];
 
-  if (blinkMenu)
-    displayPrint("Thre1 %2d", menu_thre);
+  if (d->names)
+    displayPrint("%s%s", label, d->names[param_index(d, value)]);
   else
-    displayPrint("      %2d", menu_thre);
-
-  if (lastKey == BTN_B || lastKey == BTN_BH)
-  {
-    if (menu_thre > 20)
-      menu_thre = menu_thre - 5;
-    else
-      menu_thre = 80;
-  }
-
-  if (lastKey == BTN_C || lastKey == BTN_CH)
   {
-    if (menu_thre < 80)
-      menu_thre = menu_thre + 5;
-    else
-      menu_thre = 20;
-  }
-
-  if (lastKey == BTN_A || lastKey == BTN_AH)
-  { //ESC
-    currentMenu = MENU_SENSOR;
-    currentMenuOption = 1;
-  }
-
-  if (lastKey == BTN_D || lastKey == BTN_DH)
-  { // SAVE
-    thre1 = menu_thre;
-    eeprom_writeInt(EE_ADDR_threshold_set1, thre1); //save to EEPROM
-    displayPrint("SAVED!!!");
-    delay(500);
-    currentMenu = MENU_SENSOR;
-    currentMenuOption = 1;
+    displayFormatf(S, sizeof(S), d->format, value * d->scale); // format checked by params_formatsValid()
+    displayPrint("%s%s", label, S);
   }
 }
 
-void setGain2Menu(void)
-{
-  if (!menuTimeout)
-    menuTimeout = TIMEOUT_MENU;
-
-  if (blinkMenu)
-    displayPrint("Gain2 %2d", menu_pga);
-  else
-    displayPrint("      %2d", menu_pga);
-
-  if (lastKey == BTN_B || lastKey == BTN_BH)
-  {
-    if (menu_pga > 1)
-      menu_pga = menu_pga / 2;
-    else
-      menu_pga = 64;
-  }
-  if (lastKey == BTN_C || lastKey == BTN_CH)
-  {
-    if (menu_pga < 64)
-      menu_pga = menu_pga * 2;
-    else
-      menu_pga = 1;
-  }
-
-  if (lastKey == BTN_A || lastKey == BTN_AH)
-  { //ESC
-    currentMenu = MENU_SENSOR;
-    currentMenuOption = 2;
-  }
-
-  if (lastKey == BTN_D || lastKey == BTN_DH)
-  { //SAVE
-    pga2 = menu_pga;
-    eeprom_writeInt(EE_ADDR_gain_set2, pga2); //save to EEPROM
-    displayPrint("SAVED!!!");
-    delay(500);
-    currentMenu = MENU_SENSOR;
-    currentMenuOption = 2;
-  }
-}
-
-void setThre2Menu(void)
-{
-  if (!menuTimeout)
-    menuTimeout = TIMEOUT_MENU;
-
-  if (blinkMenu)
-    displayPrint("Thre2 %2d", menu_thre);
-  else
-    displayPrint("      %2d", menu_thre);
-
-  if (lastKey == BTN_B || lastKey == BTN_BH)
-  {
-    if (menu_thre > 20)
-      menu_thre = menu_thre - 5;
-    else
-      menu_thre = 80;
-  }
-  if (lastKey == BTN_C || lastKey == BTN_CH)
-  {
-    if (menu_thre < 80)
-      menu_thre = menu_thre + 5;
-    else
-      menu_thre = 20;
-  }
-
-  if (lastKey == BTN_A || lastKey == BTN_AH)
-  { //ESC
-    currentMenu = MENU_SENSOR;
-    currentMenuOption = 3;
-  }
-
-  if (lastKey == BTN_D || lastKey == BTN_DH)
-  { // SAVE
-    thre2 = menu_thre;
-    eeprom_writeInt(EE_ADDR_threshold_set2, thre2); //save to EEPROM
-    displayPrint("SAVED!!!");
-    delay(500);
-    currentMenu = MENU_SENSOR;
-    currentMenuOption = 3;
-  }
-}
-
-void setSetMenu(void)
-{
-  if (!menuTimeout)
-    menuTimeout = TIMEOUT_MENU;
-
-  switch (menu_set)
-  { // display correct text
-  case 0:
-    setDispIndex = 0; // REL
-    break;
-  case 1:
-    setDispIndex = 3; // MAN1
-    break;
-  case 2:
-    setDispIndex = 4; // MAN2
-    break;
-  default:
-    break;
-  }
-
-  if (blinkMenu)
-    displayPrint("Set %s", menu_setDisp[setDispIndex]);
-  else
-    displayPrint("    %s", menu_setDisp[setDispIndex]);
-
-  if (lastKey == BTN_B || lastKey == BTN_BH)
-  {
-    if (menu_set > 0)
-      menu_set--;
-    else
-      menu_set = 2;
-  }
-  if (lastKey == BTN_C || lastKey == BTN_CH)
-  { // increment by 1
-    if (menu_set < 2)
-      menu_set++;
-    else
-      menu_set = 0;
-  }
-
-  if (lastKey == BTN_A || lastKey == BTN_AH)
-  { //ESC
-    currentMenu = MENU_SENSOR;
-    currentMenuOption = 4;
-  }
-
-  if (lastKey == BTN_D || lastKey == BTN_DH)
-  { // SAVE
-    set = menu_set;
-    eeprom_writeInt(EE_ADDR_set, set); //save to EEPROM
-    displayPrint("SAVED!!!");
-    delay(500);
-    currentMenu = MENU_SENSOR;
-    currentMenuOption = 4;
-  }
-}
-
-void showModbusMenu(void)
-{
-  if (!menuTimeout)
-    menuTimeout = TIMEOUT_MENU;
-
-  if (currentMenuOption == 0)
-    displayPrint("ID   %3d", modbusID);
-  if (currentMenuOption == 1)
-    displayPrint("Sp%6d", modbusSpeed);
-  if (currentMenuOption == 2)
-  {
-    for (int i = 0; i < 4; i++)
-    { // find actual format in array
-      if (modbusFormatArray[i] == modbusFormat)
-        actualFormat = i;
-    }
-    displayPrint("Fmt  %s", menu_modbusFormatDisp[actualFormat]);
-  }
-
-  if (lastKey == BTN_B || lastKey == BTN_BH)
-  {
-    if (currentMenuOption > 0)
-      currentMenuOption--;
-    else
-      currentMenuOption = 2;
-  }
-
-  if (lastKey == BTN_C || lastKey == BTN_CH)
-  {
-    if (currentMenuOption < 2)
-      currentMenuOption++;
-    else
-      currentMenuOption = 0;
-  }
-
-  if (lastKey == BTN_A || lastKey == BTN_AH)
-  { // ESC
-    currentMenu = MENU_SETUP;
-    currentMenuOption = 1;
-  }
-  if (lastKey == BTN_D || lastKey == BTN_DH)
-  { // ENTER
-
-    if (currentMenuOption == 0)
-    {
-      currentMenu = MENU_MODBUS_ID;
-      menu_modbusID = modbusID;
-    } // read actual ID
-    if (currentMenuOption == 1)
-    {
-      currentMenu = MENU_MODBUS_SPEED;
-      menu_modbusSpeed = modbusSpeed;
-      for (int i = 0; i < 6; i++)
-      { // find actual speed in array
-        if (modbusSpeedArray[i] * 100 == menu_modbusSpeed)
-          actualSpeed = i;
-      }
-    }
-    if (currentMenuOption == 2)
-    {
-      currentMenu = MENU_MODBUS_FORMAT;
-      menu_modbusFormat = modbusFormat;
-    }
-  }
-}
-
-void setModbusID(void)
-{
-  if (!menuTimeout)
-    menuTimeout = TIMEOUT_MENU;
-
-  if (blinkMenu)
-    displayPrint("ID   %3d", menu_modbusID);
-  else
-    displayPrint("     %3d", menu_modbusID);
-
-  if (lastKey == BTN_BH)
-  { // hold to increment by 10
-    menu_modbusID = menu_modbusID - 10;
-  }
-
-  if (lastKey == BTN_CH)
-  { // hold to increment by 10
-    menu_modbusID = menu_modbusID + 10;
-  }
-
-  if (lastKey == BTN_B)
-  { // decrement
-    menu_modbusID--;
-  }
-  if (lastKey == BTN_C)
-  { // increment
-    menu_modbusID++;
-  }
-
-  // check valid Modbus Slave ID range 1..247
-  if (menu_modbusID < 1)
-    menu_modbusID = 247;
-  if (menu_modbusID > 247)
-    menu_modbusID = 1;
-
-  if (lastKey == BTN_A || lastKey == BTN_AH)
-  {
-    currentMenu = MENU_MODBUS;
-    currentMenuOption = 0;
-  }
-
-  if (lastKey == BTN_D || lastKey == BTN_DH)
-  { // SAVE
-    modbusID = menu_modbusID;
-    eeprom_writeInt(EE_ADDR_modbus_ID, modbusID); //save to EEPROM
-
-    // restart communication
-    Serial1.flush();
-    Serial1.end();
-    modbus_configure(modbusSpeed, modbusFormat, modbusID, TXEN, TOTAL_REGS_SIZE, 0);
-
-    displayPrint("SAVED!!!");
-    delay(500);
-    currentMenu = MENU_MODBUS;
-    currentMenuOption = 0;
-  }
-}
-
-void setModbusSpeed(void)
-{
-  if (!menuTimeout)
-    menuTimeout = TIMEOUT_MENU;
-
-  if (blinkMenu)
-    displayPrint("Sp%6d", menu_modbusSpeed);
-  else
-    displayPrint("  %6d", menu_modbusSpeed);
-
-  if (lastKey == BTN_B || lastKey == BTN_BH)
-  {
-    if (actualSpeed > 0)
-      actualSpeed--;
-    else
-      actualSpeed = 6;
-    menu_modbusSpeed = modbusSpeedArray[actualSpeed] * 100;
-  }
-  if (lastKey == BTN_C || lastKey == BTN_CH)
-  { // increment by 1
-    if (actualSpeed < 6)
-      actualSpeed++;
-    else
-      actualSpeed = 0;
-    menu_modbusSpeed = modbusSpeedArray[actualSpeed] * 100;
-  }
-
-  if (lastKey == BTN_A || lastKey == BTN_AH)
-  {
-    currentMenu = MENU_MODBUS;
-    currentMenuOption = 1;
-  }
-
-  if (lastKey == BTN_D || lastKey == BTN_DH)
-  { // SAVE
-    modbusSpeed = menu_modbusSpeed;
-    eeprom_writeInt(EE_ADDR_modbus_Speed, modbusSpeed / 100); //save to EEPROM
-
-    // restart communication
-    Serial1.flush();
-    Serial1.end();
-    modbus_configure(modbusSpeed, modbusFormat, modbusID, TXEN, TOTAL_REGS_SIZE, 0);
-
-    displayPrint("SAVED!!!");
-    delay(500);
-    currentMenu = MENU_MODBUS;
-    currentMenuOption = 1;
-  }
-}
-
-void setModbusFormat(void)
-{
-  if (!menuTimeout)
-    menuTimeout = TIMEOUT_MENU;
-
-  if (blinkMenu)
-    displayPrint("Fmt  %s", menu_modbusFormatDisp[actualFormat]);
-  else
-    displayPrint("     %s", menu_modbusFormatDisp[actualFormat]);
-
-  if (lastKey == BTN_B || lastKey == BTN_BH)
-  { // decrement by 1
-    if (actualFormat > 0)
-      actualFormat--;
-    else
-      actualFormat = 3;
-    menu_modbusFormat = modbusFormatArray[actualFormat];
-  }
-  if (lastKey == BTN_C || lastKey == BTN_CH)
-  { // increment by 1
-    if (actualFormat < 3)
-      actualFormat++;
-    else
-      actualFormat = 0;
-    menu_modbusFormat = modbusFormatArray[actualFormat];
-  }
-
-  if (lastKey == BTN_A || lastKey == BTN_AH)
-  {
-    currentMenu = MENU_MODBUS;
-    currentMenuOption = 0;
-  }
-
-  if (lastKey == BTN_D || lastKey == BTN_DH)
-  { // SAVE
-    modbusFormat = menu_modbusFormat;
-    eeprom_writeInt(EE_ADDR_modbus_Format, modbusFormat); //save to EEPROM
-
-    // restart communication
-    Serial1.flush();
-    Serial1.end();
-    modbus_configure(modbusSpeed, modbusFormat, modbusID, TXEN, TOTAL_REGS_SIZE, 0);
-
-    displayPrint("SAVED!!!");
-    delay(500);
-    currentMenu = MENU_MODBUS;
-    currentMenuOption = 2;
-  }
-}
-
-void showFiltersMenu(void)
-{
-  if (!menuTimeout)
-    menuTimeout = TIMEOUT_MENU;
-
-  if (currentMenuOption == 0)
-    displayPrint("fPos%4d", filterPosition);
-  if (currentMenuOption == 1)
-    displayPrint("fOn %4d", filterOn);
-  if (currentMenuOption == 2)
-    displayPrint("fOff%4d", filterOff);
-
-  if (lastKey == BTN_A || lastKey == BTN_AH)
-  { //ESC
-    currentMenu = MENU_SETUP;
-    currentMenuOption = 2;
-  }
-
-  if (lastKey == BTN_B || lastKey == BTN_BH)
-  {
-    if (currentMenuOption > 0)
-      currentMenuOption--;
-    else
-      currentMenuOption = 2;
-  }
-
-  if (lastKey == BTN_C || lastKey == BTN_CH)
-  {
-    if (currentMenuOption < 2)
-      currentMenuOption++;
-    else
-      currentMenuOption = 0;
-  }
-
-  if (lastKey == BTN_D || lastKey == BTN_DH)
-  {
-    if (currentMenuOption == 0)
-    {
-      currentMenu = MENU_FILTER_POSITION;
-      currentMenuOption = 0;
-      menu_filterPosition = filterPosition;
-    }
-    if (currentMenuOption == 1)
-    {
-      currentMenu = MENU_FILTER_ON;
-      currentMenuOption = 0;
-      menu_filterOn = filterOn;
-    }
-    if (currentMenuOption == 2)
-    {
-      currentMenu = MENU_FILTER_OFF;
-      currentMenuOption = 0;
-      menu_filterOff = filterOff;
-    }
-  }
-}
-
-void setFilterPosition(void)
-{
-  if (!menuTimeout)
-    menuTimeout = TIMEOUT_MENU;
-
-  if (blinkMenu)
-    displayPrint("fPos%4d", menu_filterPosition);
-  else
-    displayPrint("    %4d", menu_filterPosition);
-
-  if (lastKey == BTN_BH)
-  { // decrement by 1,10,100
-    if (btnHoldCounter < 20)
-    {
-      menu_filterPosition = menu_filterPosition - 10;
-    }
-    else
-    {
-      menu_filterPosition = menu_filterPosition - 100;
-    }
-  }
-
-  if (lastKey == BTN_CH)
-  { // increment by 1,10,100
-    if (btnHoldCounter < 20)
-    {
-      menu_filterPosition = menu_filterPosition + 10;
-    }
-    else
-    {
-      menu_filterPosition = menu_filterPosition + 100;
-    }
-  }
-
-  if (lastKey == BTN_B)
-  { // decrement
-    menu_filterPosition--;
-  }
-  if (lastKey == BTN_C)
-  { // increment
-    menu_filterPosition++;
-  }
-
-  //check range in ms
-  if (menu_filterPosition < 0)
-    menu_filterPosition = 9999;
-  if (menu_filterPosition > 9999)
-    menu_filterPosition = 0;
-
-  if (lastKey == BTN_A || lastKey == BTN_AH)
-  {
-    currentMenu = MENU_FILTERS;
-    currentMenuOption = 0;
-  }
-
-  if (lastKey == BTN_D || lastKey == BTN_DH)
-  { // SAVE
-    filterPosition = menu_filterPosition;
-    eeprom_writeInt(EE_ADDR_filter_position, filterPosition); //save to EEPROM
-    displayPrint("SAVED!!!");
-    delay(500);
-    currentMenu = MENU_FILTERS;
-    currentMenuOption = 0;
-  }
-}
-
-void setFilterOn(void)
-{
-  if (!menuTimeout)
-    menuTimeout = TIMEOUT_MENU;
-
-  if (blinkMenu)
-    displayPrint("fOn %4d", menu_filterOn);
-  else
-    displayPrint("    %4d", menu_filterOn);
-
-  if (lastKey == BTN_BH)
-  { // decrement by 1,10,100
-    if (btnHoldCounter < 20)
-    {
-      menu_filterOn = menu_filterOn - 10;
-    }
-    else
-    {
-      menu_filterOn = menu_filterOn - 100;
-    }
-  }
-
-  if (lastKey == BTN_CH)
-  { // increment by 1,10,100
-    if (btnHoldCounter < 20)
-    {
-      menu_filterOn = menu_filterOn + 10;
-    }
-    else
-    {
-      menu_filterOn = menu_filterOn + 100;
-    }
-  }
-
-  if (lastKey == BTN_B)
-  { // decrement
-    menu_filterOn--;
-  }
-  if (lastKey == BTN_C)
-  { // increment
-    menu_filterOn++;
-  }
-
-  //check range in ms
-  if (menu_filterOn < 0)
-    menu_filterOn = 9999;
-  if (menu_filterOn > 9999)
-    menu_filterOn = 0;
-
-  if (lastKey == BTN_A || lastKey == BTN_AH)
-  {
-    currentMenu = MENU_FILTERS;
-    currentMenuOption = 1;
-  }
-
-  if (lastKey == BTN_D || lastKey == BTN_DH)
-  { // SAVE
-    filterOn = menu_filterOn;
-    eeprom_writeInt(EE_ADDR_filter_on, filterOn); //save to EEPROM
-    displayPrint("SAVED!!!");
-    delay(500);
-    currentMenu = MENU_FILTERS;
-    currentMenuOption = 1;
-  }
-}
-
-void setFilterOff(void)
-{
-  if (!menuTimeout)
-    menuTimeout = TIMEOUT_MENU;
-
-  if (blinkMenu)
-    displayPrint("fOff%4d", menu_filterOff);
-  else
-    displayPrint("    %4d", menu_filterOff);
-
-  if (lastKey == BTN_BH)
-  { // decrement by 1,10,100
-    if (btnHoldCounter < 20)
-    {
-      menu_filterOff = menu_filterOff - 10;
-    }
-    else
-    {
-      menu_filterOff = menu_filterOff - 100;
-    }
-  }
-
-  if (lastKey == BTN_CH)
-  { // increment by 1,10,100
-    if (btnHoldCounter < 20)
-    {
-      menu_filterOff = menu_filterOff + 10;
-    }
-    else
-    {
-      menu_filterOff = menu_filterOff + 100;
-    }
-  }
-
-  if (lastKey == BTN_B)
-  { // decrement
-    menu_filterOff--;
-  }
-
-  if (lastKey == BTN_C)
-  { // increment
-    menu_filterOff++;
-  }
-
-  //check range in ms
-  if (menu_filterOff < 0)
-    menu_filterOff = 9999;
-  if (menu_filterOff > 9999)
-    menu_filterOff = 0;
-
-  if (lastKey == BTN_A || lastKey == BTN_AH)
-  {
-    currentMenu = MENU_FILTERS;
-    currentMenuOption = 2;
-  }
-
-  if (lastKey == BTN_D || lastKey == BTN_DH)
-  { // SAVE
-    filterOff = menu_filterOff;
-    eeprom_writeInt(EE_ADDR_filter_off, filterOff); //save to EEPROM
-    displayPrint("SAVED!!!");
-    delay(500);
-    currentMenu = MENU_FILTERS;
-    currentMenuOption = 2;
-  }
-}
-
-void showAnalogMenu(void)
-{
-
-  if (!menuTimeout)
-    menuTimeout = TIMEOUT_MENU;
-
-  if (currentMenuOption == 0)
-    displayPrint("wBeg%3d%%", windowBegin);
-  if (currentMenuOption == 1)
-    displayPrint("wEnd%3d%%", windowEnd);
-  if (currentMenuOption == 2)
-    displayPrint("mPos%s", menu_positionModeDisp[positionMode]);
-  if (currentMenuOption == 3)
-    displayPrint("AnO %s", menu_analogOutModeDisp[analogOutMode]);
-  if (currentMenuOption == 4)
-    displayPrint("Offs%4d", positionOffset);
-
-  if (lastKey == BTN_A || lastKey == BTN_AH)
-  { // ESC
-    currentMenu = MENU_SETUP;
-    currentMenuOption = 3;
-  }
-
-  if (lastKey == BTN_B || lastKey == BTN_BH)
-  {
-    if (currentMenuOption > 0)
-      currentMenuOption--;
-    else
-      currentMenuOption = 4;
-  }
-
-  if (lastKey == BTN_C || lastKey == BTN_CH)
-  {
-    if (currentMenuOption < 4)
-      currentMenuOption++;
-    else
-      currentMenuOption = 0;
-  }
-
-  if (lastKey == BTN_D || lastKey == BTN_DH)
-  {
-    if (currentMenuOption == 0)
-    {
-      currentMenu = MENU_WINDOW_BEGIN;
-      currentMenuOption = 0;
-      menu_windowBegin = windowBegin;
-    }
-    if (currentMenuOption == 1)
-    {
-      currentMenu = MENU_WINDOW_END;
-      currentMenuOption = 0;
-      menu_windowEnd = windowEnd;
-    }
-    if (currentMenuOption == 2)
-    {
-      currentMenu = MENU_POSITION_MODE;
-      currentMenuOption = 0;
-      menu_positionMode = positionMode;
-    }
-    if (currentMenuOption == 3)
-    {
-      currentMenu = MENU_ANALOG_OUT_MODE;
-      currentMenuOption = 0;
-      menu_analogOutMode = analogOutMode;
-    }
-    if (currentMenuOption == 4)
-    {
-      currentMenu = MENU_POSITION_OFFSET;
-      currentMenuOption = 0;
-      menu_positionOffset = positionOffset;
-    }
-  }
-}
-
-void setWindowBegin(void)
-{
-  if (!menuTimeout)
-    menuTimeout = TIMEOUT_MENU;
-
-  if (blinkMenu)
-    displayPrint("wBeg%3d%%", menu_windowBegin);
-  else
-    displayPrint("    %3d%%", menu_windowBegin);
-
-  if (lastKey == BTN_B || lastKey == BTN_BH)
-  { // decrement
-    menu_windowBegin = menu_windowBegin - 5;
-  }
-  if (lastKey == BTN_C || lastKey == BTN_CH)
-  { // increment
-    menu_windowBegin = menu_windowBegin + 5;
-  }
-
-  //check range, min 5, max 45
-  if (menu_windowBegin < 5)
-    menu_windowBegin = 45;
-  if (menu_windowBegin > 45)
-    menu_windowBegin = 5;
-
-  if (lastKey == BTN_A || lastKey == BTN_AH)
-  {
-    currentMenu = MENU_ANALOG;
-    currentMenuOption = 0;
-  }
-
-  if (lastKey == BTN_D || lastKey == BTN_DH)
-  { // SAVE
-    windowBegin = menu_windowBegin;
-    eeprom_writeInt(EE_ADDR_window_begin, windowBegin); //save to EEPROM
-    displayPrint("SAVED!!!");
-    delay(500);
-    currentMenu = MENU_ANALOG;
-    currentMenuOption = 0;
-  }
-}
-
-void setWindowEnd(void)
-{
-  if (!menuTimeout)
-    menuTimeout = TIMEOUT_MENU;
-
-  if (blinkMenu)
-    displayPrint("wEnd%3d%%", menu_windowEnd);
-  else
-    displayPrint("    %3d%%", menu_windowEnd);
-
-  if (lastKey == BTN_B || lastKey == BTN_BH)
-  { // decrement
-    menu_windowEnd = menu_windowEnd - 5;
-  }
-  if (lastKey == BTN_C || lastKey == BTN_CH)
-  { // increment
-    menu_windowEnd = menu_windowEnd + 5;
-  }
-
-  //check range, min 55, max 95
-  if (menu_windowEnd < 55)
-    menu_windowEnd = 95;
-  if (menu_windowEnd > 95)
-    menu_windowEnd = 55;
-
-  if (lastKey == BTN_A || lastKey == BTN_AH)
-  {
-    currentMenu = MENU_ANALOG;
-    currentMenuOption = 1;
-  }
-
-  if (lastKey == BTN_D || lastKey == BTN_DH)
-  { // SAVE
-    windowEnd = menu_windowEnd;
-    eeprom_writeInt(EE_ADDR_window_end, windowEnd); //save to EEPROM
-    displayPrint("SAVED!!!");
-    delay(500);
-    currentMenu = MENU_ANALOG;
-    currentMenuOption = 1;
-  }
-}
-
-void setPositionMode(void)
-{
-  if (!menuTimeout)
-    menuTimeout = TIMEOUT_MENU;
-
-  // positionMode: HMD = 0, RISE = 1, FALL = 2, PEAK = 3
-  if (blinkMenu)
-    displayPrint("mPos%s", menu_positionModeDisp[menu_positionMode]);
-  else
-    displayPrint("    %s", menu_positionModeDisp[menu_positionMode]);
-
-  if (lastKey == BTN_B || lastKey == BTN_BH)
-  {
-    if (menu_positionMode > 0)
-      menu_positionMode--;
-    else
-      menu_positionMode = 3;
-  }
-
-  if (lastKey == BTN_C || lastKey == BTN_CH)
-  { // increment by 1
-    if (menu_positionMode < 3)
-      menu_positionMode++;
-    else
-      menu_positionMode = 0;
-  }
-
-  if (lastKey == BTN_A || lastKey == BTN_AH)
-  {
-    currentMenu = MENU_ANALOG;
-    currentMenuOption = 2;
-  }
-
-  if (lastKey == BTN_D || lastKey == BTN_DH)
-  { // SAVE
-    positionMode = menu_positionMode;
-    eeprom_writeInt(EE_ADDR_position_mode, positionMode); //save to EEPROM
-    displayPrint("SAVED!!!");
-    delay(500);
-    currentMenu = MENU_ANALOG;
-    currentMenuOption = 2;
-  }
-}
-
-void setAnalogOutMode(void)
-{
-  if (!menuTimeout)
-    menuTimeout = TIMEOUT_MENU;
-
-  // positionMode: HMD = 0, RISE = 1, FALL = 2, PEAK = 3
-  if (blinkMenu)
-    displayPrint("AnO %s", menu_analogOutModeDisp[menu_analogOutMode]);
-  else
-    displayPrint("    %s", menu_analogOutModeDisp[menu_analogOutMode]);
-
-  if (lastKey == BTN_B || lastKey == BTN_BH)
-  {
-    if (menu_analogOutMode > 0)
-      menu_analogOutMode--;
-    else
-      menu_analogOutMode = 3;
-  }
-
-  if (lastKey == BTN_C || lastKey == BTN_CH)
-  { // increment by 1
-    if (menu_analogOutMode < 3)
-      menu_analogOutMode++;
-    else
-      menu_analogOutMode = 0;
-  }
-
-  if (lastKey == BTN_A || lastKey == BTN_AH)
-  {
-    currentMenu = MENU_ANALOG;
-    currentMenuOption = 3;
-  }
-
-  if (lastKey == BTN_D || lastKey == BTN_DH)
-  { // SAVE
-    analogOutMode = menu_analogOutMode;
-    eeprom_writeInt(EE_ADDR_analog_out_mode, analogOutMode); //save to EEPROM
-    displayPrint("SAVED!!!");
-    delay(500);
-    currentMenu = MENU_ANALOG;
-    currentMenuOption = 3;
-  }
-}
-
-void setPositionOffset(void)
-{
-  if (!menuTimeout)
-    menuTimeout = TIMEOUT_MENU;
-
-  if (blinkMenu)
-    displayPrint("Offs%4d", menu_positionOffset);
-  else
-    displayPrint("    %4d", menu_positionOffset);
-
-  if (lastKey == BTN_BH)
-  { // decrement
-    menu_positionOffset = menu_positionOffset - 10;
-  }
-  if (lastKey == BTN_CH)
-  { // increment
-    menu_positionOffset = menu_positionOffset + 10;
-  }
-
-  if (lastKey == BTN_B)
-  { // decrement
-    menu_positionOffset--;
-  }
-  if (lastKey == BTN_C)
-  { // increment
-    menu_positionOffset++;
-  }
-
-  //check range, min 0, max 2000
-  if (menu_positionOffset < 0)
-    menu_positionOffset = 2000;
-  if (menu_positionOffset > 2000)
-    menu_positionOffset = 0;
-
-  if (lastKey == BTN_A || lastKey == BTN_AH)
-  {
-    currentMenu = MENU_ANALOG;
-    currentMenuOption = 4;
-  }
-
-  if (lastKey == BTN_D || lastKey == BTN_DH)
-  { // SAVE
-    positionOffset = menu_positionOffset;
-    //adc0_busy = 0;
-    eeprom_writeInt(EE_ADDR_position_offset, positionOffset); //save to EEPROM
-    displayPrint("SAVED!!!");
-    delay(500);
-    currentMenu = MENU_ANALOG;
-    currentMenuOption = 4;
-  }
-}
-
-void showInfoMenu(void)
+void showInfoMenu(void)
 {
   if (!menuTimeout)
     menuTimeout = TIMEOUT_MENU;
@@ -2178,6 +1866,8 @@ void showInfoMenu(void)
   if (currentMenuOption == 5)
     displayPrint("TT%6d", total_runtime);
   if (currentMenuOption == 6)
+    displayPrint("CPU %3d%%", (1000 - cpuIdle + 5) / 10);
+  if (currentMenuOption == 7)
     displayPrint("FacReset");
 
   if (lastKey == BTN_A || lastKey == BTN_AH)
@@ -2191,12 +1881,12 @@ void showInfoMenu(void)
     if (currentMenuOption > 0)
       currentMenuOption--;
     else
-      currentMenuOption = 6;
+      currentMenuOption = 7;
   }
 
   if (lastKey == BTN_C || lastKey == BTN_CH)
   {
-    if (currentMenuOption < 6)
+    if (currentMenuOption < 7)
       currentMenuOption++;
     else
       currentMenuOption = 0;
@@ -2204,7 +1894,7 @@ void showInfoMenu(void)
 
   if (lastKey == BTN_D || lastKey == BTN_DH)
   {
-    if (currentMenuOption == 6)
+    if (currentMenuOption == 7)
     {
       currentMenu = MENU_RESET;
       currentMenuOption = 0;
@@ -2279,8 +1969,7 @@ void showResetMenu(void)
       Serial1.end();
       modbus_configure(modbusSpeed, modbusFormat, modbusID, TXEN, TOTAL_REGS_SIZE, 0);
 
-      displayPrint("RESET!!!");
-      delay(500);
+      displayMessage("RESET!!!");
       currentMenu = MENU_INFO;
       currentMenuOption = 5;
     }
@@ -2291,68 +1980,355 @@ void showResetMenu(void)
 // EEPROM
 
 // Write a unsigned int (two bytes) value to eeprom
+// Values are held in the write-behind cache and committed together by checkEEPROM()
+// after TIMEOUT_EEPROM_COMMIT without further changes, so a burst of changes
+// (e.g. FC16 frame) costs a single journal commit instead of one per WORD.
 void eeprom_writeInt(unsigned int address, unsigned int value)
 {
+  if (address >= EE_CACHE_SIZE)
+    return; // outside the journal keys
 
-  EEPROM.write(address, value % 256);     // LSB
-  EEPROM.write(address + 1, value / 256); // MSB
+  if (eeprom_readInt(address) == (value & 0xFFFF))
+    return; // nothing changed
+
+  if (!eeCacheDirty[address / 2])
+  {
+    eeCacheDirty[address / 2] = true;
+    eeCachePending++;
+  }
+  eeCacheValue[address / 2] = value;
+  eepromCommitTimeout = TIMEOUT_EEPROM_COMMIT; // restart quiet period
 }
 
-void eeprom_updateInt(unsigned int address, unsigned int value)
+// read a unsigned int (two bytes) value, pending or committed, 0xFFFF if never written
+unsigned int eeprom_readInt(unsigned int address)
 {
+  if (address >= EE_CACHE_SIZE)
+    return 0xFFFF;
+
+  if (eeCacheDirty[address / 2])
+    return eeCacheValue[address / 2]; // not committed yet
+
+  if (journalSlot[address / 2] < 0)
+    return 0xFFFF;
 
-  EEPROM.update(address, value % 256);     // LSB
-  EEPROM.update(address + 1, value / 256); // MSB
+  return journalValue[address / 2];
 }
 
-// read a unsigned int (two bytes) value from eeprom
-unsigned int eeprom_readInt(unsigned int address)
+// read a WORD of the fixed layout written by older firmware (migration only)
+unsigned int eeprom_readLegacy(unsigned int address)
 {
-
   return EEPROM.read(address) + EEPROM.read(address + 1) * 256;
 }
 
-void EEPROM_init()
+// write all pending WORDs to the journal as one commit
+// a commit never overwrites a committed record, a commit torn by power loss must leave
+// the previous values intact: the records it writes have to fit the free run ahead of
+// the head, which compaction keeps open by moving the oldest WORDs to the head
+void eeprom_commit()
 {
+  if (!eeCachePending)
+    return;
 
-  if (
-      eeprom_readInt(EE_ADDR_MODEL_TYPE) == MODEL_TYPE &&
-      eeprom_readInt(EE_ADDR_MODEL_SERIAL_NUMBER) == MODEL_SERIAL_NUMBER &&
-      eeprom_readInt(EE_ADDR_FW_VERSION) == FW_VERSION)
+  eepromCommits++;
+
+  // rare: commits of many WORDs (defaults, image import) or a run of old WORDs at the end of
+  // the free run, done once every WORD has been moved
+  for (int moved = 0; journal_free() < eeCachePending + 1 + JOURNAL_RESERVE && moved < JOURNAL_KEYS;)
   {
+    int n = journal_compact();
+    if (!n)
+      break;
+    moved += n;
+  }
 
-    // loads in ram the eeprom config
-    config_loadFromEEPROM();
+  uint8_t keys[JOURNAL_KEYS];
+  uint16_t values[JOURNAL_KEYS];
+  int n = 0;
+  for (int key = 0; key < JOURNAL_KEYS; key++)
+  {
+    if (eeCacheDirty[key])
+    {
+      keys[n] = key;
+      values[n] = eeCacheValue[key];
+      n++;
+    }
   }
-  else
+
+  // incremental compaction: with little room left, a few of the oldest WORDs go along
+  int free = journal_free();
+  if (free < JOURNAL_SPARE)
+  {
+    int carry = min(JOURNAL_CARRY * (n + 1), free - JOURNAL_RESERVE - n - 1); // keep the reserve
+    for (; carry > 0; carry--)
+    {
+      int key = journal_oldest(eeCacheDirty);
+      if (key < 0)
+        break;
+      eeCacheDirty[key] = true; // skipped by journal_oldest() from now on
+      keys[n] = key;
+      values[n] = journalValue[key];
+      n++;
+    }
+  }
+
+  journal_append(keys, values, n);
+  for (int i = 0; i < n; i++)
+    eeCacheDirty[keys[i]] = false;
+  eeCachePending = 0;
+}
+
+// committed WORD with the record nearest ahead of the head, -1 if none
+// (erased WORDs are not kept, skip[] WORDs are written by the commit anyway)
+int journal_oldest(const boolean *skip)
+{
+  int oldest = -1, distance = JOURNAL_RECORDS;
+  for (int key = 0; key < JOURNAL_KEYS; key++)
   {
-    config_writeDefaultsToEEPROM();
-    config_loadFromEEPROM();
+    if (journalSlot[key] >= 0 && journalValue[key] != 0xFFFF && !(skip && skip[key]) &&
+        journal_distance(journalSlot[key]) < distance)
+    {
+      oldest = key;
+      distance = journal_distance(journalSlot[key]);
+    }
   }
+  return oldest;
 }
 
-void config_loadFromEEPROM()
+// records ahead of the head that hold no committed WORD
+int journal_free()
+{
+  int key = journal_oldest(NULL);
+  return key < 0 ? JOURNAL_RECORDS : journal_distance(journalSlot[key]);
+}
+
+// one commit: WORD records first, commit marker last, a commit torn by power loss
+// has no marker and is ignored by journal_replay(), the previous values stay in effect
+void journal_append(const uint8_t *keys, const uint16_t *values, int count)
+{
+  for (int n = 0; n < count; n++)
+    journal_write((journalHead + n) % JOURNAL_RECORDS, keys[n], count - n, values[n]);
+  journal_write((journalHead + count) % JOURNAL_RECORDS, JOURNAL_KEY_COMMIT, count, JOURNAL_SCHEMA);
+
+  for (int n = 0; n < count; n++)
+  {
+    journalSlot[keys[n]] = (journalHead + n) % JOURNAL_RECORDS;
+    journalKeySeq[keys[n]] = journalSeq;
+    journalValue[keys[n]] = values[n];
+  }
+  journalHead = (journalHead + count + 1) % JOURNAL_RECORDS;
+  journalSeq++;
+}
+
+// commit of committed values only: the oldest WORDs, as many as fit the free run
+// returns the number of WORDs moved
+int journal_compact()
+{
+  uint8_t keys[JOURNAL_KEYS];
+  uint16_t values[JOURNAL_KEYS];
+  boolean carried[JOURNAL_KEYS] = {false};
+  int free = journal_free();
+  int n = 0;
+
+  while (n + 1 < free)
+  {
+    int key = journal_oldest(carried);
+    if (key < 0)
+      break;
+    carried[key] = true;
+    keys[n] = key;
+    values[n] = journalValue[key];
+    n++;
+  }
+  if (n)
+    journal_append(keys, values, n);
+  return n;
+}
+
+// commit pending changes after the quiet period or when requested via ModBus
+void checkEEPROM()
+{
+  if (eeCachePending && (!eepromCommitTimeout || eepromFlush))
+    eeprom_commit();
+  eepromFlush = false;
+}
+
+// CRC-16 (ModBus polynomial), start with 0xFFFF
+uint16_t crc16_update(uint16_t crc, uint8_t data)
+{
+  crc ^= data;
+  for (int bit = 0; bit < 8; bit++)
+    crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+  return crc;
+}
+
+// CRC-16 of a journal record without its crc
+uint16_t journal_crc(const journalRecord_t *rec)
+{
+  const uint8_t *data = (const uint8_t *)rec;
+  uint16_t crc = 0xFFFF;
+
+  for (unsigned int i = 0; i < sizeof(journalRecord_t) - sizeof(rec->crc); i++)
+    crc = crc16_update(crc, data[i]);
+  return crc;
+}
+
+// false if the slot is empty or torn
+boolean journal_read(int slot, journalRecord_t *rec)
+{
+  EEPROM.get(JOURNAL_START + slot * sizeof(journalRecord_t), *rec);
+  return rec->crc == journal_crc(rec);
+}
+
+void journal_write(int slot, uint8_t key, uint8_t count, uint16_t value)
+{
+  journalRecord_t rec = {key, count, journalSeq, value, 0};
+  rec.crc = journal_crc(&rec);
+  EEPROM.put(JOURNAL_START + slot * sizeof(journalRecord_t), rec);
+}
+
+// records from the head to a slot in write order
+int journal_distance(int slot)
+{
+  return (slot - journalHead + JOURNAL_RECORDS) % JOURNAL_RECORDS;
+}
+
+// rebuild the committed WORDs in one pass over the journal
+// returns the schema of the newest commit, 0 if the journal is empty
+unsigned int journal_replay()
+{
+  journalRecord_t rec, marker;
+  boolean found = false, any = false;
+  uint16_t newestSeq = 0, lastSeq = 0;
+  unsigned int schema = 0;
+
+  for (int key = 0; key < JOURNAL_KEYS; key++)
+    journalSlot[key] = -1;
+  journalHead = 0;
+
+  for (int slot = 0; slot < JOURNAL_RECORDS; slot++)
+  {
+    if (!journal_read(slot, &rec))
+      continue;
+
+    // sequence numbers of the records in the ring span less than JOURNAL_RECORDS commits
+    if (!any || (int16_t)(rec.seq - lastSeq) > 0)
+      lastSeq = rec.seq;
+    any = true;
+
+    if (rec.key == JOURNAL_KEY_COMMIT)
+    {
+      if (!found || (int16_t)(rec.seq - newestSeq) > 0)
+      {
+        found = true;
+        newestSeq = rec.seq;
+        schema = rec.value;
+        journalHead = (slot + 1) % JOURNAL_RECORDS;
+      }
+      continue;
+    }
+
+    // WORD counts only if the marker of its commit was written
+    if (rec.key >= JOURNAL_KEYS ||
+        !journal_read((slot + rec.count) % JOURNAL_RECORDS, &marker) ||
+        marker.key != JOURNAL_KEY_COMMIT || marker.seq != rec.seq)
+      continue;
+
+    if (journalSlot[rec.key] < 0 || (int16_t)(rec.seq - journalKeySeq[rec.key]) > 0)
+    {
+      journalSlot[rec.key] = slot;
+      journalKeySeq[rec.key] = rec.seq;
+      journalValue[rec.key] = rec.value;
+    }
+  }
+
+  journalSeq = lastSeq + 1; // never reuse the sequence number of a torn commit
+  return schema;
+}
+
+void EEPROM_init()
 {
+  unsigned int schema = journal_replay();
+
+  if (!schema)
+  { // empty journal, take over the settings of older firmware if present
+    if (eeprom_readLegacy(EE_ADDR_MODEL_TYPE) == MODEL_TYPE &&
+        eeprom_readLegacy(EE_ADDR_MODEL_SERIAL_NUMBER) == MODEL_SERIAL_NUMBER)
+      config_migrate(0);
+    else
+      config_writeDefaultsToEEPROM();
+  }
+  else if (schema > JOURNAL_SCHEMA || eeprom_readInt(EE_ADDR_MODEL_TYPE) != MODEL_TYPE)
+    config_writeDefaultsToEEPROM(); // written by newer firmware or another model
+  else
+    config_migrate(schema);
+
   // loads in ram the eeprom config
-  modbusID = eeprom_readInt(EE_ADDR_modbus_ID);
-  modbusSpeed = eeprom_readInt(EE_ADDR_modbus_Speed) * 100; // speed/100 to fit 115200 in WORD
-  modbusFormat = eeprom_readInt(EE_ADDR_modbus_Format);
-
-  set = eeprom_readInt(EE_ADDR_set);
-  pga1 = eeprom_readInt(EE_ADDR_gain_set1);
-  thre1 = eeprom_readInt(EE_ADDR_threshold_set1);
-  pga2 = eeprom_readInt(EE_ADDR_gain_set2);
-  thre2 = eeprom_readInt(EE_ADDR_threshold_set2);
-
-  windowBegin = eeprom_readInt(EE_ADDR_window_begin);
-  windowEnd = eeprom_readInt(EE_ADDR_window_end);
-  positionMode = eeprom_readInt(EE_ADDR_position_mode);
-  analogOutMode = eeprom_readInt(EE_ADDR_analog_out_mode);
-  positionOffset = eeprom_readInt(EE_ADDR_position_offset);
-
-  filterPosition = eeprom_readInt(EE_ADDR_filter_position);
-  filterOn = eeprom_readInt(EE_ADDR_filter_on);
-  filterOff = eeprom_readInt(EE_ADDR_filter_off);
+  config_loadFromEEPROM();
+
+  // settings are kept across firmware versions
+  eeprom_writeInt(EE_ADDR_FW_VERSION, FW_VERSION);
+  eeprom_commit();
+}
+
+// bring WORDs written by older firmware to JOURNAL_SCHEMA, one step per case
+// steps only rewrite changed WORDs, so repeating one after power loss is harmless
+void config_migrate(unsigned int schema)
+{
+  switch (schema)
+  {
+  case 0: // fixed layout, invalid values replaced by defaults
+    eeprom_writeInt(EE_ADDR_MODEL_TYPE, MODEL_TYPE);
+    eeprom_writeInt(EE_ADDR_MODEL_SERIAL_NUMBER, MODEL_SERIAL_NUMBER);
+    for (int p = 0; p < PARAM_COUNT; p++)
+    {
+      if (param_slots(&params[p]) != 1)
+        continue; // recipes, see case 1
+      int value = eeprom_readLegacy(params[p].eeAddr);
+      eeprom_writeInt(params[p].eeAddr, param_valid(&params[p], value) ? value : params[p].def);
+    }
+    for (int f = 0; f < RECIPE_WORDS; f++)
+    {
+      eeprom_writeInt(schema1Set1[f], eeprom_readLegacy(schema1Set1[f]));
+      eeprom_writeInt(schema1Set2[f], eeprom_readLegacy(schema1Set2[f]));
+    }
+    eeprom_writeInt(EE_ADDR_max_temperature, eeprom_readLegacy(EE_ADDR_max_temperature));
+    eeprom_writeInt(EE_ADDR_total_runtime, eeprom_readLegacy(EE_ADDR_total_runtime));
+    // fall through
+  case 1: // parameter set 1 and 2 (window, mode and filters shared) to recipe slots 1 and 2
+    for (int f = 0; f < RECIPE_WORDS; f++)
+    {
+      const paramDesc_t *d = &params[PARAM_RECIPE_GAIN + f];
+      int value = eeprom_readInt(schema1Set1[f]);
+      eeprom_writeInt(param_addr(d, DEFAULT_RECIPE_SET1 - 1), param_valid(d, value) ? value : d->def);
+      value = eeprom_readInt(schema1Set2[f]);
+      eeprom_writeInt(param_addr(d, DEFAULT_RECIPE_SET2 - 1), param_valid(d, value) ? value : d->def);
+    }
+    for (int f = 0; f < RECIPE_WORDS; f++)
+    { // erased, no longer carried forward by eeprom_commit()
+      eeprom_writeInt(schema1Set1[f], 0xFFFF);
+      eeprom_writeInt(schema1Set2[f], 0xFFFF);
+    }
+    // fall through
+  case 2: // current
+    break;
+  }
+}
+
+void config_loadFromEEPROM()
+{
+  // loads in ram the eeprom config, invalid values replaced by defaults
+  for (int p = 0; p < PARAM_COUNT; p++)
+  {
+    const paramDesc_t *d = &params[p];
+    for (int s = 0; s < param_slots(d); s++)
+    {
+      int value = eeprom_readInt(param_addr(d, s));
+      if (!param_valid(d, value)) // e.g. not written by older firmware
+        value = d->def;
+      *param_ptr(d, s) = value * d->scale;
+    }
+  }
 
   max_temperature = eeprom_readInt(EE_ADDR_max_temperature);
   total_runtime = eeprom_readInt(EE_ADDR_total_runtime);
@@ -2361,110 +2337,347 @@ void config_loadFromEEPROM()
 }
 
 void config_writeDefaultsToEEPROM()
-{ // flash is empty or program version changed
+{ // flash is empty or written by another model
   // writes sign codes
   eeprom_writeInt(EE_ADDR_MODEL_TYPE, MODEL_TYPE);
   eeprom_writeInt(EE_ADDR_MODEL_SERIAL_NUMBER, MODEL_SERIAL_NUMBER);
   eeprom_writeInt(EE_ADDR_FW_VERSION, FW_VERSION);
 
-  // save defaults to eeprom
-  eeprom_writeInt(EE_ADDR_modbus_ID, DEFAULT_MODBUS_ID);
-  eeprom_writeInt(EE_ADDR_modbus_Speed, DEFAULT_MODBUS_SPEED / 100); // speed/100 to fit 115200 in WORD
-  eeprom_writeInt(EE_ADDR_modbus_Format, DEFAULT_MODBUS_FORMAT);
-
-  eeprom_writeInt(EE_ADDR_set, DEFAULT_SET);
-  eeprom_writeInt(EE_ADDR_gain_set1, DEFAULT_GAIN_SET1);
-  eeprom_writeInt(EE_ADDR_threshold_set1, DEFAULT_THRESHOLD_SET1);
-  eeprom_writeInt(EE_ADDR_gain_set2, DEFAULT_GAIN_SET2);
-  eeprom_writeInt(EE_ADDR_threshold_set2, DEFAULT_THRESHOLD_SET2);
-
-  eeprom_writeInt(EE_ADDR_window_begin, DEFAULT_WINDOW_BEGIN);
-  eeprom_writeInt(EE_ADDR_window_end, DEFAULT_WINDOW_END);
-  eeprom_writeInt(EE_ADDR_position_mode, DEFAULT_POSITION_MODE);
-  eeprom_writeInt(EE_ADDR_analog_out_mode, DEFAULT_ANALOG_OUT_MODE);
-  eeprom_writeInt(EE_ADDR_position_offset, DEFAULT_POSITION_OFFSET);
-
-  eeprom_writeInt(EE_ADDR_filter_position, DEFAULT_FILTER_POSITION);
-  eeprom_writeInt(EE_ADDR_filter_on, DEFAULT_FILTER_ON);
-  eeprom_writeInt(EE_ADDR_filter_off, DEFAULT_FILTER_OFF);
+  // save defaults to eeprom
+  for (int p = 0; p < PARAM_COUNT; p++)
+  {
+    for (int s = 0; s < param_slots(&params[p]); s++)
+      eeprom_writeInt(param_addr(&params[p], s), params[p].def);
+  }
+  recipe_writeSet2Defaults();
+
+  eeprom_writeInt(EE_ADDR_max_temperature, max_temperature);
+  eeprom_writeInt(EE_ADDR_total_runtime, total_runtime);
+}
+
+void reset_writeDefaultsToEEPROM()
+{ // reset all values (except calibration values) to fact. defaults
+  // writes sign codes
+  // eeprom_writeInt(EE_ADDR_MODEL_TYPE, MODEL_TYPE);
+  // eeprom_writeInt(EE_ADDR_MODEL_SERIAL_NUMBER, MODEL_SERIAL_NUMBER);
+  // eeprom_writeInt(EE_ADDR_FW_VERSION, FW_VERSION);
+
+  // save defaults to eeprom
+  for (int p = 0; p < PARAM_COUNT; p++)
+  {
+    if (params[p].flags & PARAM_CALIBRATION)
+      continue;
+    for (int s = 0; s < param_slots(&params[p]); s++)
+      eeprom_writeInt(param_addr(&params[p], s), params[p].def);
+  }
+  recipe_writeSet2Defaults();
+
+  // eeprom_writeInt(EE_ADDR_max_temperature, max_temperature);
+  // eeprom_writeInt(EE_ADDR_total_runtime, total_runtime);
+}
+
+// recipe of parameter set 2 starts with its own gain and threshold
+void recipe_writeSet2Defaults()
+{
+  eeprom_writeInt(param_addr(&params[PARAM_GAIN2], DEFAULT_RECIPE_SET2 - 1), params[PARAM_GAIN2].def);
+  eeprom_writeInt(param_addr(&params[PARAM_THRE2], DEFAULT_RECIPE_SET2 - 1), params[PARAM_THRE2].def);
+}
+
+// snapshot of the configuration into configImage[]
+void config_exportImage()
+{
+  int n = 0;
+
+  configImage[n++] = MODEL_TYPE;
+  configImage[n++] = CONFIG_IMAGE_VERSION;
+  configImage[n++] = CONFIG_IMAGE_WORDS;
+  for (int p = 0; p < PARAM_COUNT; p++)
+  {
+    for (int s = 0; s < param_imageSlots(&params[p]); s++)
+      configImage[n++] = *param_ptr(&params[p], s) / params[p].scale;
+  }
+  configImage[n] = config_imageCRC();
+}
+
+// apply configImage[] as a whole or not at all, returns IMAGE_OK or the reason of rejection
+int config_importImage()
+{
+  if (configImage[0] != MODEL_TYPE)
+    return IMAGE_WRONG_MODEL;
+  if (configImage[1] != CONFIG_IMAGE_VERSION || configImage[2] != CONFIG_IMAGE_WORDS)
+    return IMAGE_WRONG_VERSION;
+  if (configImage[CONFIG_IMAGE_SIZE - 1] != config_imageCRC())
+    return IMAGE_CRC_ERROR;
+
+  // check all values before anything is changed
+  int n = 3;
+  for (int p = 0; p < PARAM_COUNT; p++)
+  {
+    for (int s = 0; s < param_imageSlots(&params[p]); s++)
+    {
+      if (!param_valid(&params[p], configImage[n++]))
+        return IMAGE_INVALID_VALUE;
+    }
+  }
+
+  // scans keep the previous config and recipe until the new config is built,
+  // then switch to all new values at the same scan boundary
+  configImport = true;
+  n = 3;
+  for (int p = 0; p < PARAM_COUNT; p++)
+  {
+    const paramDesc_t *d = &params[p];
+    for (int s = 0; s < param_imageSlots(d); s++)
+    {
+      int value = configImage[n++];
+      *param_ptr(d, s) = value * d->scale;
+      eeprom_writeInt(param_addr(d, s), value);
+    }
+  }
+  config_build();
+  configImport = false;
+
+  eepromFlush = true; // all WORDs in one journal commit
+  return IMAGE_OK;
+}
+
+uint16_t config_imageCRC()
+{
+  uint16_t crc = 0xFFFF;
+  for (int n = 0; n < CONFIG_IMAGE_SIZE - 1; n++)
+  {
+    crc = crc16_update(crc, configImage[n] >> 8);
+    crc = crc16_update(crc, configImage[n] & 0xFF);
+  }
+  return crc;
+}
+
+// params[] index of a ModBus register, -1 if not a parameter
+int param_find(uint16_t reg)
+{
+  return reg < PARAM_REGS ? paramIndex.p[reg] : -1;
+}
+
+boolean param_valid(const paramDesc_t *d, int value)
+{
+  if (!d->list)
+    return value >= d->min && value <= d->max;
+
+  for (int i = 0; i < d->listSize; i++)
+  {
+    if (d->list[i] == value)
+      return true;
+  }
+  return false;
+}
+
+// position of value in list[] or names[]
+int param_index(const paramDesc_t *d, int value)
+{
+  if (!d->list)
+    return value - d->min;
+
+  for (int i = 0; i < d->listSize; i++)
+  {
+    if (d->list[i] == value)
+      return i;
+  }
+  return 0;
+}
+
+// recipe slot of a recipe_t field, 0 for other parameters
+int param_slot(const paramDesc_t *d)
+{
+  if (d->flags & PARAM_IN_SET1)
+    return recipeSet1 - 1;
+  if (d->flags & PARAM_IN_SET2)
+    return recipeSet2 - 1;
+  if (d->flags & PARAM_IN_EDIT)
+    return recipeEdit - 1;
+  return 0;
+}
+
+// number of stored values, the PARAM_IN_EDIT field stores every recipe slot
+int param_slots(const paramDesc_t *d)
+{
+  if (d->flags & PARAM_IN_EDIT)
+    return RECIPE_COUNT;
+  if (d->flags & PARAM_IN_RECIPE)
+    return 0;
+  return 1;
+}
+
+// setting of a slot
+volatile int *param_ptr(const paramDesc_t *d, int slot)
+{
+  if (d->field)
+    return &(recipes[slot].*d->field);
+  return d->value;
+}
+
+uint16_t param_addr(const paramDesc_t *d, int slot)
+{
+  return d->eeAddr + slot * RECIPE_WORDS * 2;
+}
+
+// value in register units
+int param_get(int p, int slot)
+{
+  return *param_ptr(&params[p], slot) / params[p].scale;
+}
+
+// set parameter from menu or ModBus, false if not valid
+boolean param_write(int p, int value, int slot)
+{
+  const paramDesc_t *d = &params[p];
+
+  if (!param_valid(d, value))
+    return false;
+
+  if (value != param_get(p, slot))
+  {
+    *param_ptr(d, slot) = value * d->scale;
+    eeprom_writeInt(param_addr(d, slot), value);
+    if (d->flags & PARAM_MODBUS)
+      modbusRestart = true; // restarted in checkModbus()
+  }
+  return true;
+}
+
+// check SET and load proper settings
+void checkSET()
+{
+  // parameter set and its recipe switched by callback_delay(), here only for display
+  if (set)
+    setDispIndex = set + 2; // MAN1, MAN2
+  else
+    setDispIndex = setInput + 1; // REL1, REL2
+
+  pga = recipes[recipe_active()].pga;
+  thre = recipes[recipe_active()].thre;
+
+  if (!config_isCurrent(scanConfigPending ? scanConfigPending : scanConfig))
+    config_build();
+}
+
+// recipe slot of the parameter set in use
+int recipe_active()
+{
+  int s = set ? set - 1 : setInput;
+  return (s ? recipeSet2 : recipeSet1) - 1;
+}
 
-  eeprom_writeInt(EE_ADDR_max_temperature, max_temperature);
-  eeprom_writeInt(EE_ADDR_total_runtime, total_runtime);
+// check if config was built from actual settings
+boolean config_isCurrent(const scanConfig_t *c)
+{
+  if (!c ||
+      c->set != set ||
+      c->analogOutMode != analogOutMode ||
+      c->filterUnit != filterUnit ||
+      c->outputDelay != outputDelay ||
+      c->positionPredict != positionPredict)
+    return false;
+
+  for (int r = 0; r < RECIPE_COUNT; r++)
+  {
+    if (memcmp(&c->recipe[r].r, (const void *)&recipes[r], sizeof(recipe_t)))
+      return false;
+  }
+  return true;
 }
 
-void reset_writeDefaultsToEEPROM()
-{ // reset all values (except calibration values) to fact. defaults
-  // writes sign codes
-  // eeprom_writeInt(EE_ADDR_MODEL_TYPE, MODEL_TYPE);
-  // eeprom_writeInt(EE_ADDR_MODEL_SERIAL_NUMBER, MODEL_SERIAL_NUMBER);
-  // eeprom_writeInt(EE_ADDR_FW_VERSION, FW_VERSION);
+// build new scan config from actual settings, swapped in callback_delay() at the next scan
+void config_build()
+{
+  scanConfig_t *c;
+
+  __disable_irq();
+  scanConfigPending = NULL;                                                    // ISR keeps the active config
+  c = (scanConfig == &scanConfigBuf[0]) ? &scanConfigBuf[1] : &scanConfigBuf[0]; // buffer not used by ISR
+  __enable_irq();
+
+  c->set = set;
+  c->analogOutMode = analogOutMode;
+  c->filterUnit = filterUnit;
+  c->outputDelay = outputDelay;
+  c->positionPredict = positionPredict;
+
+  for (int r = 0; r < RECIPE_COUNT; r++)
+  {
+    scanRecipe_t *rcp = &c->recipe[r];
+    memcpy(&rcp->r, (const void *)&recipes[r], sizeof(recipe_t));
+
+    rcp->thre256 = rcp->r.thre * 256 / 100 - 1;
+    rcp->hmdThreshold[0] = rcp->thre256 + hmdThresholdHyst;
+    rcp->hmdThreshold[1] = rcp->thre256 - hmdThresholdHyst;
+    rcp->winBegin[0] = rcp->r.windowBegin * 2; // 200 samples for 0 - 100%
+    rcp->winEnd[0] = rcp->r.windowEnd * 2;
+    rcp->winBegin[1] = rcp->r.windowBegin * 2 - 5;
+    rcp->winEnd[1] = rcp->r.windowEnd * 2 + 5;
+    rcp->positionBegin = rcp->r.windowBegin * 10;
+    rcp->positionEnd = rcp->r.windowEnd * 10;
+
+    int span = rcp->positionEnd - rcp->positionBegin;
+    if (span < 100) // windowBegin max 45, windowEnd min 55
+      span = 100;
+    rcp->positionRecip = ((1ULL << RECIP_SHIFT) + span - 1) / span;
+
+    rcp->filterOnUs = rcp->r.filterOn * (filterUnit ? 1UL : 1000UL);
+    rcp->filterOffUs = rcp->r.filterOff * (filterUnit ? 1UL : 1000UL);
+
+    // latency of a moving edge: results of the previous scan (1 scan = 1000 us), output latched
+    // outputDelay later and the moving average lagging (period - 1) scans behind a ramp,
+    // whole scans kept out of the us product, it overflows 32 bit from filterPosition 8389
+    int filterPosition = rcp->r.filterPosition;
+    rcp->predictLead = (filterPosition > 1 ? filterPosition - 1 : 0) * 256 + (1000 + outputDelay) * 256 / 1000;
+    rcp->predictSettle = filterPosition + 4;
+  }
+
+  if (!scanConfig)
+    scanConfig = c; // first build in setup()
+  else
+    scanConfigPending = c;
+}
 
-  // save defaults to eeprom
-  eeprom_writeInt(EE_ADDR_modbus_ID, DEFAULT_MODBUS_ID);
-  eeprom_writeInt(EE_ADDR_modbus_Speed, DEFAULT_MODBUS_SPEED / 100); // speed/100 to fit 115200 in WORD
-  eeprom_writeInt(EE_ADDR_modbus_Format, DEFAULT_MODBUS_FORMAT);
-
-  eeprom_writeInt(EE_ADDR_set, DEFAULT_SET);
-  eeprom_writeInt(EE_ADDR_gain_set1, DEFAULT_GAIN_SET1);
-  eeprom_writeInt(EE_ADDR_threshold_set1, DEFAULT_THRESHOLD_SET1);
-  eeprom_writeInt(EE_ADDR_gain_set2, DEFAULT_GAIN_SET2);
-  eeprom_writeInt(EE_ADDR_threshold_set2, DEFAULT_THRESHOLD_SET2);
-
-  eeprom_writeInt(EE_ADDR_window_begin, DEFAULT_WINDOW_BEGIN);
-  eeprom_writeInt(EE_ADDR_window_end, DEFAULT_WINDOW_END);
-  eeprom_writeInt(EE_ADDR_position_mode, DEFAULT_POSITION_MODE);
-  eeprom_writeInt(EE_ADDR_analog_out_mode, DEFAULT_ANALOG_OUT_MODE);
-  // eeprom_writeInt(EE_ADDR_position_offset, DEFAULT_POSITION_OFFSET);
-
-  eeprom_writeInt(EE_ADDR_filter_position, DEFAULT_FILTER_POSITION);
-  eeprom_writeInt(EE_ADDR_filter_on, DEFAULT_FILTER_ON);
-  eeprom_writeInt(EE_ADDR_filter_off, DEFAULT_FILTER_OFF);
+// SET_IN changed, new parameter set is used from the next scan
+void setIn_isr()
+{
+  cpuMark_t cpu = cpu_enter();
+  int s = digitalReadFast(SET_IN) ? 0 : 1;
+  if (s != setInput)
+  {
+    setInput = s;
+    setEdgeTime = micros();
+    setEdgePending = true;
+  }
 
-  // eeprom_writeInt(EE_ADDR_max_temperature, max_temperature);
-  // eeprom_writeInt(EE_ADDR_total_runtime, total_runtime);
+  cpu_leave(CPU_PINS, cpu);
 }
 
-// check SET and load proper settings
-void checkSET()
+// TEST_IN changed, test mode is switched at the next scan
+void testIn_isr()
 {
-  switch (set)
+  cpuMark_t cpu = cpu_enter();
+  boolean t = !digitalReadFast(TEST_IN);
+  if (t != testInput)
   {
-  case 0:
-    if (digitalRead(SET_IN))
-    {
-      pga = pga1;
-      thre = thre1;
-      setDispIndex = 1;
-    }
-    else
-    {
-      pga = pga2;
-      thre = thre2;
-      setDispIndex = 2;
-    }
-    break;
-  case 1:
-    pga = pga1;
-    thre = thre1;
-    setDispIndex = 3;
-    break;
-  case 2:
-    pga = pga2;
-    thre = thre2;
-    setDispIndex = 4;
-    break;
-  default:
-    break;
+    testInput = t;
+    testEdgeTime = micros();
+    testEdgePending = true;
   }
-  thre256 = thre * 256 / 100 - 1;
+
+  cpu_leave(CPU_PINS, cpu);
 }
 
 void checkTEST()
 {
-  if (!digitalRead(TEST_IN))
-    extTest = true;
-  else
-    extTest = false;
+  __disable_irq();
+  if (testEdgePending && micros() - testEdgeTime > INPUT_APPLY_TIMEOUT) // no scans, motor stopped
+  {
+    extTest = testInput;
+    testEdgePending = false;
+  }
+  __enable_irq();
 
   if (extTest || intTest)
   {
@@ -2495,14 +2708,16 @@ void checkALARM()
   { // every hour
     hourTimeout = 3600000;
     total_runtime++;
-    if ((total_runtime % 4) == 1)
-    { // every 4 hours
-      eeprom_writeInt(EE_ADDR_total_runtime, total_runtime);
-    }
+    eeprom_writeInt(EE_ADDR_total_runtime, total_runtime); // a few journal records, spread by wear leveling
   }
 
   //check alarms
-  if ((motorTimeDiff > (6000 + 50)) || (motorTimeDiff < (6000 - 50)))
+  if (motorState != MOTOR_RUN)
+  { // motor starting - not ready, no alarm menu yet
+    digitalWriteFast(LED_ALARM, HIGH);
+    digitalWriteFast(OUT_ALARM_NEG, LOW);
+  }
+  else if ((motorTimeDiff > (6000 + 50)) || (motorTimeDiff < (6000 - 50)))
   { //motor alarm if not 6000us per rot.
     digitalWriteFast(LED_ALARM, HIGH);
     digitalWriteFast(OUT_ALARM_NEG, LOW); //negative output 0V=ALARM
@@ -2554,18 +2769,45 @@ void checkALARM()
 }
 
 //*****************************************************************
+// SPI0 owned by the AD420s - set up once after SPI.begin() (pins SCK/MOSI, clock gate)
+void dac_begin()
+{
+#if F_BUS != 48000000
+#error "DAC_SPI_CTAR is calculated for F_BUS 48 MHz"
+#endif
+  CORE_PIN10_CONFIG = PORT_PCR_MUX(2) | PORT_PCR_DSE | PORT_PCR_SRE; // pin 10 = SPI0_PCS0 as LATCH
+
+  SPI0_MCR = SPI_MCR_MSTR | SPI_MCR_PCSIS(1) | SPI_MCR_HALT; // PCS0 inactive high, halt to change CTAR
+  SPI0_CTAR0 = DAC_SPI_CTAR;
+  SPI0_MCR = SPI_MCR_MSTR | SPI_MCR_PCSIS(1) | SPI_MCR_DIS_RXF | SPI_MCR_CLR_TXF | SPI_MCR_CLR_RXF; // received data not needed
+}
+
 // SPI send 2 x 16 bit value
+// Fire and forget: both words are queued in the SPI0 TX FIFO (4 entries), PCS0 stays low
+// between them and goes high after the second one, which updates the DAC registers on AD420.
+// Nothing is sent when both outputs are unchanged.
 void updateSPI(int valueAN1, int valueAN2)
 {
-  // gain control of the SPI port
-  // and configure settings
-  SPI.beginTransaction(SPISettings(2000000, MSBFIRST, SPI_MODE0)); // max 3.3MBPS, CPOL=0, CPHA=0
-  digitalWrite(SPI_CS, LOW);                                       // take LATCH pin LOW
-  SPI.transfer16(valueAN2);
-  SPI.transfer16(valueAN1);
-  digitalWrite(SPI_CS, HIGH); // update DAC registers on AD420
-  // release control of the SPI port
-  SPI.endTransaction();
+  static int lastAN1 = -1;
+  static int lastAN2 = -1;
+  static int refreshScans = 0;
+
+  if (valueAN1 == lastAN1 && valueAN2 == lastAN2 && refreshScans)
+  {
+    refreshScans--;
+    return;
+  }
+
+  if (((SPI0_SR & SPI_SR_TXCTR) >> 12) > 2)
+    return; // previous words still queued, try again next scan
+
+  SPI0_SR = SPI_SR_TCF | SPI_SR_EOQF;                                                // clear flags
+  SPI0_PUSHR = SPI_PUSHR_CONT | SPI_PUSHR_CTAS(0) | SPI_PUSHR_PCS(1) | (valueAN2 & 0xFFFF); // keep LATCH low
+  SPI0_PUSHR = SPI_PUSHR_CTAS(0) | SPI_PUSHR_PCS(1) | (valueAN1 & 0xFFFF);                  // LATCH high after this word
+
+  lastAN1 = valueAN1;
+  lastAN2 = valueAN2;
+  refreshScans = DAC_REFRESH_SCANS;
 }
 
 // INTERRUPT ROUTINES
@@ -2574,6 +2816,7 @@ void updateSPI(int valueAN1, int valueAN2)
 //*****************************************************************
 void checkButtonA()
 {
+  cpuMark_t cpu = cpu_enter();
   if (digitalReadFast(PIN_BTN_A))
   {
     if (BtnPressedATimeout || resultButtonA == STATE_LONG)
@@ -2584,11 +2827,14 @@ void checkButtonA()
     BtnReleasedA = false;
     BtnPressedATimeout = BTN_HOLD_TIME;
   }
+
+  cpu_leave(CPU_PINS, cpu);
 }
 
 //*****************************************************************
 void checkButtonB()
 {
+  cpuMark_t cpu = cpu_enter();
   if (digitalReadFast(PIN_BTN_B))
   {
     if (BtnPressedBTimeout || resultButtonB == STATE_LONG)
@@ -2599,11 +2845,14 @@ void checkButtonB()
     BtnReleasedB = false;
     BtnPressedBTimeout = BTN_HOLD_TIME;
   }
+
+  cpu_leave(CPU_PINS, cpu);
 }
 
 //*****************************************************************
 void checkButtonC()
 {
+  cpuMark_t cpu = cpu_enter();
   if (digitalReadFast(PIN_BTN_C))
   {
     if (BtnPressedCTimeout || resultButtonC == STATE_LONG)
@@ -2614,11 +2863,14 @@ void checkButtonC()
     BtnReleasedC = false;
     BtnPressedCTimeout = BTN_HOLD_TIME;
   }
+
+  cpu_leave(CPU_PINS, cpu);
 }
 
 //*****************************************************************
 void checkButtonD()
 {
+  cpuMark_t cpu = cpu_enter();
   if (digitalReadFast(PIN_BTN_D))
   {
     if (BtnPressedDTimeout || resultButtonD == STATE_LONG)
@@ -2629,14 +2881,76 @@ void checkButtonD()
     BtnReleasedD = false;
     BtnPressedDTimeout = BTN_HOLD_TIME;
   }
+
+  cpu_leave(CPU_PINS, cpu);
+}
+
+// motor slow start: 1 % per step, the next step as soon as a whole rotation
+// at the current speed matches the clock (600000 / speed us per rotation), at
+// latest after MOTOR_RAMP_STEP. Ends on HALL lock at full speed, or after
+// MOTOR_LOCK_TIME and the motor alarm takes over.
+void checkMOTOR()
+{
+  if (motorState == MOTOR_RUN)
+    return;
+
+  unsigned long now = millis();
+  boolean locked = (motorTimeDiff < (6000 + 50)) && (motorTimeDiff > (6000 - 50));
+
+  if (motorState == MOTOR_LOCKING)
+  {
+    if (locked || now - motorStepTime >= MOTOR_LOCK_TIME)
+      motorState = MOTOR_RUN;
+    return;
+  }
+
+  __disable_irq();
+  long rotation = (long)(motorTimeOld - motorStepMicros); // > 0 - whole rotation measured after the last step
+  long diff = motorTimeDiff;
+  __enable_irq();
+  long expected = 600000L / motorSpeed;
+  boolean following = rotation > 0 && diff > expected - expected / 50 && diff < expected + expected / 50;
+
+  if (now - motorStepTime < MOTOR_RAMP_MIN || (!following && now - motorStepTime < MOTOR_RAMP_STEP))
+    return;
+
+  motorSpeed++;
+  timerMotor.update(50000 / motorSpeed); // new period from the next tick, no restart
+  motorStepTime = now;
+  motorStepMicros = micros();
+  if (motorSpeed >= 100)
+    motorState = MOTOR_LOCKING;
+}
+
+// once per second: cycles of each handler into cpuUsage[], the rest into cpuIdle
+void checkCPU()
+{
+  if (ARM_DWT_CYCCNT - cpuWindowStart < F_CPU)
+    return;
+
+  uint32_t cycles[CPU_COUNT];
+  __disable_irq();
+  uint32_t now = ARM_DWT_CYCCNT;
+  uint32_t window = now - cpuWindowStart;
+  cpuWindowStart = now;
+  memcpy(cycles, (const void *)cpuCycles, sizeof(cycles));
+  memset((void *)cpuCycles, 0, sizeof(cpuCycles));
+  __enable_irq();
+
+  uint32_t busy = 0;
+  for (int i = 0; i < CPU_COUNT; i++)
+  {
+    busy += cycles[i];
+    cpuUsage[i] = (uint64_t)cycles[i] * 1000 / window;
+  }
+  cpuIdle = busy < window ? (uint64_t)(window - busy) * 1000 / window : 0;
 }
 
 //*****************************************************************
 // Timer interrupts
 void timer500us_isr(void)
 { //every 500us
-  //motor pulse
-  digitalWriteFast(MOTOR_CLK, !digitalReadFast(MOTOR_CLK));
+  cpuMark_t cpu = cpu_enter();
 
   //update timeouts
 
@@ -2663,6 +2977,16 @@ void timer500us_isr(void)
     intTest = false;
   }
 
+  if (eepromCommitTimeout)
+  {
+    eepromCommitTimeout--;
+  }
+
+  if (messageTimeout)
+  {
+    messageTimeout--;
+  }
+
   if (menuTimeout)
   {
     menuTimeout--;
@@ -2736,16 +3060,38 @@ void timer500us_isr(void)
     }
   }
 
+  timerHalfMs = !timerHalfMs;
+  if (!timerHalfMs)
+  {
+    hourTimeout--; // every 1ms
+  }
+
+  cpu_leave(CPU_TIMER, cpu);
+}
+
+// motor pulse, every 500us at full speed, slower while ramping
+void motorClock_isr(void)
+{
+  cpuMark_t cpu = cpu_enter();
+  digitalWriteFast(MOTOR_CLK, !digitalReadFast(MOTOR_CLK));
   if (digitalReadFast(MOTOR_CLK))
   {
-    hourTimeout--;        // every 1ms
     pulsetime = micros(); // for position compensation
   }
+  cpu_leave(CPU_MOTOR, cpu);
+}
+
+void serial1_isr(void)
+{
+  cpuMark_t cpu = cpu_enter();
+  uart0_status_isr();
+  cpu_leave(CPU_UART, cpu);
 }
 
 // motor (from HALL sensor) interrupt
 void motor_isr(void)
 {
+  cpuMark_t cpu = cpu_enter();
   motorPulseIndex++;
 
   if (motorPulseIndex > 5)
@@ -2764,19 +3110,54 @@ void motor_isr(void)
       delayOffset = 1000 + delayOffset;
     TeensyDelay::trigger(delayOffset, 0);
   }
+
+  cpu_leave(CPU_MOTOR, cpu);
 }
 
 void callback_delay()
 {
+  cpuMark_t cpu = cpu_enter();
+  if (scanConfigPending && !configImport)
+  { // scan boundary - swap to new config
+    scanConfig = scanConfigPending;
+    scanConfigPending = NULL;
+  }
+
   if (!adc0_busy) // previous ADC conversion ended
   {
     exectime = micros();
+    scanStartTime = exectime;
+    TeensyDelay::trigger(scanConfig->outputDelay, 1); // latch outputs at fixed offset after scan start
     memset((void *)adc0_buf, 0, sizeof(adc0_buf)); // clear DMA buffer
 
     //adc0_busy = 1;
 
+    adcFacet = motorPulseIndex;
+
+    // apply staged SET_IN and TEST_IN, latency bounded by one scan
+    int s = scanConfig->set ? scanConfig->set - 1 : setInput;
+    if (s != adcSet && setEdgePending && !scanConfig->set)
+    {
+      setLatency = exectime - setEdgeTime;
+      if (setLatency > setLatencyMax)
+        setLatencyMax = setLatency;
+    }
+    if (!scanConfig->set)
+      setEdgePending = false;
+    adcSet = s;
+    if (!configImport) // slot of the previous scan until the imported config is swapped in
+      adcRecipe = (s ? recipeSet2 : recipeSet1) - 1; // slot switched via ModBus or menu, no config rebuild
+
+    if (testEdgePending)
+    {
+      extTest = testInput;
+      testLatency = exectime - testEdgeTime;
+      testEdgePending = false;
+    }
+
     // update PGA
-    adc->adc0->enablePGA(pga);
+    adcPga = scanConfig->recipe[adcRecipe].r.pga;
+    adc->adc0->enablePGA(adcPga);
     adc->analogReadDifferential(A10, A11, ADC_0); //start ADC_0 differential
 
     //adc0_dma.enable();
@@ -2796,10 +3177,28 @@ void callback_delay()
     //adc0_dma_isr();
   }
   adc0_busy = true;
+
+  cpu_leave(CPU_SCAN, cpu);
+}
+
+// TeensyDelay channel 1, OUTPUT_DELAY after scan start
+void callback_output()
+{
+  cpuMark_t cpu = cpu_enter();
+  unsigned long now = micros();
+
+  updateSPI(dacAN1, dacAN2);
+
+  outputLatency = now - dacDataTime;
+  if (now - scanStartTime > (unsigned long)scanConfig->outputDelay + 20) // results were not ready in time
+    outputLate++;
+
+  cpu_leave(CPU_OUTPUT, cpu);
 }
 
 void adc0_dma_isr(void)
 {
+  cpuMark_t cpu = cpu_enter();
   adc0_dma.clearInterrupt();
   adc0_dma.clearComplete();
   //Serial.println("DMA interrupt");
@@ -2818,13 +3217,29 @@ void adc0_dma_isr(void)
     else
       adc_data[i] = adc0_buf[i];
   }
+  dataFacet = adcFacet;
+  dataRecipe = adcRecipe;
+  dataPga = adcPga;
+  dataStartTime = exectime;
 
   adc0_busy = false;
   holdingRegs[EXEC_TIME_ADC] = micros() - exectime; // exectime of adc conversions
+
+  cpu_leave(CPU_DMA, cpu);
 }
 
 void updateResults()
 {
+  cpuMark_t cpu = cpu_enter();
+  const scanConfig_t *cfg = scanConfig;                  // same config for the whole scan
+  const scanRecipe_t *rcp = &cfg->recipe[dataRecipe]; // recipe the scan was acquired with
+  const int *setThreshold = rcp->hmdThreshold;
+
+  if (!firstMeasTime) // only scans triggered on HALL lock get here
+    firstMeasTime = millis();
+  if (traceState == TRACE_ARMED)
+    trace_capture(rcp);
+  int hyst = 0;
   int hmdThreshold = 0;
   int winBegin = 0;
   int winEnd = 0;
@@ -2838,19 +3253,11 @@ void updateResults()
 
   for (int i = 0; i < ANALOG_BUFFER_SIZE; i++)
   {
-    // calculate thresholds (with hysteresis) first for speed up calculation
-    if (!digitalReadFast(FILTER_PIN))
-    {
-      hmdThreshold = thre256 + hmdThresholdHyst;
-      winBegin = windowBegin * 2;
-      winEnd = windowEnd * 2;
-    }
-    else
-    {
-      hmdThreshold = thre256 - hmdThresholdHyst;
-      winBegin = windowBegin * 2 - 5;
-      winEnd = windowEnd * 2 + 5;
-    }
+    // thresholds (with hysteresis) precomputed in config_build()
+    hyst = signalDetected ? 1 : 0;
+    hmdThreshold = setThreshold[hyst];
+    winBegin = rcp->winBegin[hyst];
+    winEnd = rcp->winEnd[hyst];
 
     if (i == winBegin)
       peak[i] = adc_data[i]; //check first peak
@@ -2868,39 +3275,39 @@ void updateResults()
       if (peakValue > hmdThreshold) // check threshold crossing with hysteresis
       {
         // HMD mode
-        if ((positionMode == 0) && !peakValueTime)
+        if ((rcp->r.positionMode == 0) && !peakValueTime)
         {
           peakValueTime = i * 5;
-          digitalWriteFast(FILTER_PIN, HIGH); // update internal pin for bounce2 filter
+          signalDetected = true;
         }
 
         // RISING EDGE mode
-        if ((positionMode == 1) && (!risingEdgeTime)) // only first occurence
+        if ((rcp->r.positionMode == 1) && (!risingEdgeTime)) // only first occurence
         {
           if (peak[i - 1] <= hmdThreshold)
           {
             risingEdgeTime = i * 5;
-            digitalWriteFast(FILTER_PIN, HIGH); // update internal pin for bounce2 filter
+            signalDetected = true;
           }
         }
 
         // check for falling edge
-        if (positionMode == 2) // only the first occurence
+        if (rcp->r.positionMode == 2) // only the first occurence
         {
-          if ((adc_data[i] < thre256 - hmdThresholdHyst) && (!fallingEdgeTime)) // added additional hysteresis to avoid flickering
+          if ((adc_data[i] < setThreshold[1]) && (!fallingEdgeTime)) // added additional hysteresis to avoid flickering
           {
             fallingEdgeTime = i * 5;
-            digitalWriteFast(FILTER_PIN, HIGH); // update internal pin for bounce2 filter
+            signalDetected = true;
           }
         }
 
         // check for peak (but signal can be unstable)
-        if (positionMode == 3)
+        if (rcp->r.positionMode == 3)
         {
           if (peak[i - 1] + 5 < peakValue) // check for peak
           {
             peakValueTime = i * 5;
-            digitalWriteFast(FILTER_PIN, HIGH); // update internal pin for bounce2 filter
+            signalDetected = true;
           }
         }
       }
@@ -2908,36 +3315,22 @@ void updateResults()
   }
 
   // check SIGNAL PRESENT
-  if ((peakValue < thre256 - hmdThresholdHyst) || (!peakValueTime && !risingEdgeTime && !fallingEdgeTime))
+  if ((peakValue < setThreshold[1]) || (!peakValueTime && !risingEdgeTime && !fallingEdgeTime))
   {
-    digitalWriteFast(FILTER_PIN, LOW);
+    signalDetected = false;
   }
 
   if (extTest || intTest)
   {
-    digitalWriteFast(FILTER_PIN, HIGH); // update internal pin for bounce2 filter
-  }
-
-  // update SIGNAL PRESENT bounce2 filter
-  filterOnOff.update();
-
-  if (filterOnOff.rose())
-  {
-    filterOnOff.interval(filterOff); // update filter interval
-    digitalWriteFast(LED_SIGNAL, HIGH);
-    digitalWriteFast(OUT_SIGNAL_NEG, LOW);
+    signalDetected = true;
   }
 
-  if (filterOnOff.fell())
-  {
-    filterOnOff.interval(filterOn); //update filter interval
-    digitalWriteFast(LED_SIGNAL, LOW);
-    digitalWriteFast(OUT_SIGNAL_NEG, HIGH);
-  }
+  // update SIGNAL PRESENT on/off delay filter
+  signalFilter(dataStartTime, rcp);
 
-  if (digitalReadFast(LED_SIGNAL)) // update position only when SIGNAL PRESENT
+  if (signalPresent) // update position only when SIGNAL PRESENT
   {
-    switch (positionMode)
+    switch (rcp->r.positionMode)
     { // for display
     case 1:
       positionValueDisp = risingEdgeTime;
@@ -2954,18 +3347,19 @@ void updateResults()
   else
     positionValueDisp = 0;
 
-  positionValueAvg = approxSimpleMovingAverage(positionValueDisp, filterPosition);
+  positionValueAvg = approxSimpleMovingAverage(positionValueDisp, rcp->r.filterPosition);
+  positionValueAvg = predictPosition(positionValueAvg, cfg, rcp);
 
-  // remap and send to SPI
-  positionValue = constrain(positionValueAvg, windowBegin * 10, windowEnd * 10); // only within measuring window
+  // remap and send to SPI, multiply/shift only (scaling precomputed in config_build())
+  positionValue = constrain(positionValueAvg, rcp->positionBegin, rcp->positionEnd) - rcp->positionBegin; // only within measuring window
 
-  positionValueAvgDisp = map(positionValue, windowBegin * 10, windowEnd * 10, 0, 1000); // for display range 0 - 1000
+  positionValueAvgDisp = ((uint64_t)(positionValue * 1000) * rcp->positionRecip) >> RECIP_SHIFT; // for display range 0 - 1000
 
-  positionValue = map(positionValue, windowBegin * 10, windowEnd * 10, 0, 65535); // remap for DAC range
+  positionValue = ((uint64_t)(positionValue * 65535) * rcp->positionRecip) >> RECIP_SHIFT; // remap for DAC range
 
-  peakValueDisp = map(peakValue, 0, 255, 0, 100); // for display 0 - 100%
+  peakValueDisp = (peakValue * 101) >> 8; // same as map(peakValue, 0, 255, 0, 100) for display 0 - 100%
 
-  peakValue = map(peakValue, 0, 255, 0, 65535); // remap for DAC range
+  peakValue = peakValue * 257; // same as map(peakValue, 0, 255, 0, 65535) for DAC range
 
   if (extTest || intTest) // check test mode and set outputs to 50% and 12mA
   {
@@ -2976,41 +3370,168 @@ void updateResults()
     peakValue = 0xBFFF;         // 16mA on intensity analog output
   }
 
-  switch (analogOutMode)
+  measurement_publish(peakValueDisp, positionValueDisp, positionValueAvgDisp);
+
+  switch (cfg->analogOutMode)
   { //an1/an2: "1Int2Pos" = 0, "1Pos2Int" = 1, "1Int2Int" = 2, "1Pos2Pos" = 3
   case 0:
-    updateSPI(peakValue, positionValue); // range is 2x 16bit
+    dacAN1 = peakValue; // range is 2x 16bit
+    dacAN2 = positionValue;
     break;
   case 1:
-    updateSPI(positionValue, peakValue);
+    dacAN1 = positionValue;
+    dacAN2 = peakValue;
     break;
   case 2:
-    updateSPI(peakValue, peakValue);
+    dacAN1 = peakValue;
+    dacAN2 = peakValue;
     break;
   case 3:
-    updateSPI(positionValue, positionValue);
+    dacAN1 = positionValue;
+    dacAN2 = positionValue;
     break;
   }
+  dacDataTime = dataStartTime; // sent to SPI in callback_output()
 
-  //if (dataSent && motorPulseIndex == 0) // prepare data for visualization on PC, only first mirror
-  if (dataSent && motorPulseIndex == (filterPosition % 6)) // possibility to view different mirrors by changing positionFilter
+  //if (motorPulseIndex == 0) // prepare data for visualization on PC, only first mirror
+  if (motorPulseIndex == (rcp->r.filterPosition % 6)) // possibility to view different mirrors by changing positionFilter
   {
     for (byte i = 0; i < (MOTOR_TIME_DIFF - AN_VALUES); i++) // MOTOR_TIME_DIFF = AN_VALUES + 25
     {
       value_buffer[i] = adc_data[i * 8 + 4] << 8 | adc_data[i * 8]; // MSB = value_buffer[i*8+4] , LSB = value_buffer[i*8] ; only 50 of 200
     }
+  }
+
+  cpu_leave(CPU_RESULTS, cpu);
+}
+
+// copy the scan in adc_data[] with the gain it was acquired with and the settings it is processed
+// with (the config may be swapped in between), CRC is added when read
+void trace_capture(const scanRecipe_t *rcp)
+{
+  int n = 0;
+
+  traceBuf[n++] = TRACE_VERSION;
+  traceBuf[n++] = MODEL_TYPE;
+  traceBuf[n++] = dataPga;
+  traceBuf[n++] = rcp->r.thre;
+  traceBuf[n++] = rcp->r.windowBegin;
+  traceBuf[n++] = rcp->r.windowEnd;
+  traceBuf[n++] = rcp->r.positionMode;
+  traceBuf[n++] = freq / 1000;
+  traceBuf[n++] = ANALOG_BUFFER_SIZE;
+  traceBuf[n++] = dataRecipe + 1;
+  traceBuf[n++] = dataFacet;
+  traceBuf[n++] = dataStartTime >> 16;
+  traceBuf[n++] = dataStartTime & 0xFFFF;
+  for (int i = 0; i < ANALOG_BUFFER_SIZE; i++)
+    traceBuf[n++] = adc_data[i];
 
-    dataSent = false;
+  traceState = TRACE_READY;
+}
+
+uint16_t trace_CRC()
+{
+  uint16_t crc = 0xFFFF;
+  for (int n = 0; n < TRACE_SIZE - 1; n++)
+  {
+    crc = crc16_update(crc, traceBuf[n] >> 8);
+    crc = crc16_update(crc, traceBuf[n] & 0xFF);
   }
+  return crc;
+}
+
+// publish results of one scan, called from updateResults() only (single writer)
+void measurement_publish(int peakValue, int positionValue, int positionValueAvg)
+{
+  volatile measurement_t *m = &measurementBuf[(measurementSeq + 1) & 1]; // fill the unpublished buffer
+
+  m->scan = ++scanCount;
+  m->facet = dataFacet;
+  m->peakValue = peakValue;
+  m->positionValue = positionValue;
+  m->positionValueAvg = positionValueAvg;
+
+  measurementSeq++; // publish
+}
+
+// read a consistent set of values of one scan, may be interrupted by updateResults()
+void measurement_read(measurement_t *m)
+{
+  uint32_t seq;
+  do
+  {
+    seq = measurementSeq;
+    memcpy(m, (const void *)&measurementBuf[seq & 1], sizeof(measurement_t));
+  } while (seq != measurementSeq); // new scan published meanwhile, read again
 }
 
 // exponential moving average
+// SIGNAL PRESENT on/off delay, called once per scan with the ADC start time of the scan.
+// SIGNAL PRESENT follows signalDetected on the first scan started at least filterOnUs
+// (filterOffUs) after the first scan with the new state, if every scan in between had
+// the new state too. Latency is the delay rounded up to the next scan (1000 us), with
+// delay 0 the output switches in the same scan.
+void signalFilter(unsigned long scanTime, const scanRecipe_t *rcp)
+{
+  if (signalDetected == signalPresent)
+  {
+    signalPending = false; // back to the filtered state, restart the delay
+    return;
+  }
+
+  if (!signalPending)
+  {
+    signalPending = true;
+    signalChangeTime = scanTime;
+  }
+
+  if (scanTime - signalChangeTime >= (signalDetected ? rcp->filterOnUs : rcp->filterOffUs))
+  {
+    signalPresent = signalDetected;
+    signalPending = false;
+    digitalWriteFast(LED_SIGNAL, signalPresent ? HIGH : LOW);
+    digitalWriteFast(OUT_SIGNAL_NEG, signalPresent ? LOW : HIGH);
+  }
+}
+
+// latency compensation: estimate velocity of the averaged position and, if enabled,
+// return position + velocity * pipeline latency (constrained to window by caller)
+long predictPosition(long positionAvg, const scanConfig_t *cfg, const scanRecipe_t *rcp)
+{
+  static long lastPosition = 0;
+  static int settleScans = 0;
+
+  if (!signalPresent) // no edge, restart estimation
+  {
+    positionVelocity = 0;
+    settleScans = 0;
+    lastPosition = positionAvg;
+    return positionAvg;
+  }
+
+  if (settleScans < rcp->predictSettle) // moving average still rising from 0
+  {
+    settleScans++;
+    lastPosition = positionAvg;
+    return positionAvg;
+  }
+
+  positionVelocity += ((positionAvg - lastPosition) * 256 - positionVelocity) / 4; // smoothed delta per scan
+  lastPosition = positionAvg;
+
+  if (!cfg->positionPredict)
+    return positionAvg;
+
+  return positionAvg + (long)(((int64_t)positionVelocity * rcp->predictLead) >> 16);
+}
+
 long approxSimpleMovingAverage(int new_value, int period)
 {
 
-  if (filterPosition)
+  if (period)
   {                                   // avoid div/0
-    if (!digitalReadFast(LED_SIGNAL)) // clear values
+    if (!signalPresent) // clear values
     {
       sma = 0;
     }
@@ -3045,215 +3566,148 @@ void checkSTATUS()
 
 void checkModbus()
 {
-
-  holdingRegs[MODBUS_ID] = modbusID;
-  holdingRegs[MODBUS_SPEED] = modbusSpeed / 100; // baud rate/100 to fit into word
-  holdingRegs[MODBUS_FORMAT] = modbusFormat;
-
-  holdingRegs[SET] = set;
-  holdingRegs[GAIN_SET1] = pga1;
-  holdingRegs[THRESHOLD_SET1] = thre1;
-  holdingRegs[GAIN_SET2] = pga2;
-  holdingRegs[THRESHOLD_SET2] = thre2;
-
-  holdingRegs[WINDOW_BEGIN] = windowBegin;
-  holdingRegs[WINDOW_END] = windowEnd;
-  holdingRegs[POSITION_MODE] = positionMode;
-  holdingRegs[ANALOG_OUT_MODE] = analogOutMode;
-  holdingRegs[POSITION_OFFSET] = positionOffset;
-
-  holdingRegs[FILTER_POSITION] = filterPosition;
-  holdingRegs[FILTER_ON] = filterOn;
-  holdingRegs[FILTER_OFF] = filterOff;
-
-  holdingRegs[ACT_TEMPERATURE] = celsius;
-  holdingRegs[MAX_TEMPERATURE] = max_temperature;
-  holdingRegs[TOTAL_RUNTIME] = total_runtime;
-  holdingRegs[IO_STATE] = io_state;
-
-  holdingRegs[MOTOR_TIME_DIFF] = motorTimeDiff;
-  holdingRegs[OFFSET_DELAY] = delayOffset;
-
-  // updated in updateResults()
-  holdingRegs[PEAK_VALUE] = peakValueDisp;
-  holdingRegs[POSITION_VALUE] = positionValueDisp;
-  holdingRegs[POSITION_VALUE_AVG] = positionValueAvgDisp;
-
-  if (!dataSent)
-  {
-    for (byte i = 0; i < (MOTOR_TIME_DIFF - AN_VALUES); i++) // MOTOR_TIME_DIFF = AN_VALUES + 25
-    {
-      holdingRegs[i + AN_VALUES] = value_buffer[i]; // values stored properly in updateResults() to save memory
-    }
-
-    dataSent = true;
-  }
+  // registers are resolved live in modbus_readRegister() / modbus_writeRegister(),
+  // nothing is copied here unless a master is actually polling
+  if (Serial1.available())
+    measurement_read(&mbMeasurement); // all measurement registers of one request come from one scan
 
   holdingRegs[TOTAL_ERRORS] = modbus_update(holdingRegs);
 
-  // check changes made via ModBus - if values are valid, save them in EEPROM
-
-  if ((holdingRegs[MODBUS_ID] != modbusID) || (holdingRegs[MODBUS_SPEED] * 100 != modbusSpeed) || (holdingRegs[MODBUS_FORMAT] != modbusFormat))
-  {
-    if (holdingRegs[MODBUS_ID] != modbusID && holdingRegs[MODBUS_ID] > 0 && holdingRegs[MODBUS_ID] < 248)
-    {
-      modbusID = holdingRegs[MODBUS_ID];
-      eeprom_writeInt(EE_ADDR_modbus_ID, modbusID);
-    }
-
-    if (holdingRegs[MODBUS_SPEED] * 100 != modbusSpeed)
-    {
-      switch (holdingRegs[MODBUS_SPEED] * 100)
-      {
-      case 300:
-      case 600:
-      case 1200:
-      case 2400:
-      case 4800:
-      case 9600:
-      case 14400:
-      case 19200:
-      case 28800:
-      case 38400:
-      case 57600:
-      case 115200:
-        modbusSpeed = holdingRegs[MODBUS_SPEED] * 100;
-        eeprom_writeInt(EE_ADDR_modbus_Speed, modbusSpeed / 100);
-        break;
-      default:
-        break;
-      }
-    }
-
-    if (holdingRegs[MODBUS_FORMAT] != modbusFormat)
-    {
-      switch (holdingRegs[MODBUS_FORMAT])
-      {
-      case SERIAL_8N1:
-      case SERIAL_8E1:
-      case SERIAL_8O1:
-      case SERIAL_8N2:
-        modbusFormat = holdingRegs[MODBUS_FORMAT];
-        eeprom_writeInt(EE_ADDR_modbus_Format, modbusFormat);
-        break;
-      default:
-        break;
-      }
-    }
-
-    // restart communication
+  if (modbusRestart)
+  { // ID, speed or format changed via ModBus - restart after the response was sent
+    modbusRestart = false;
     Serial1.flush();
     Serial1.end();
     modbus_configure(modbusSpeed, modbusFormat, modbusID, TXEN, TOTAL_REGS_SIZE, 0);
   }
+}
 
-  if (holdingRegs[SET] != set && holdingRegs[SET] < 3)
-  { // RELAY = 0 (REL1 || REL2), MAN1 = 1, MAN2 = 2
-    set = holdingRegs[SET];
-    eeprom_writeInt(EE_ADDR_set, set);
-  }
-
-  if (holdingRegs[GAIN_SET1] != pga1)
-  {
-    switch (holdingRegs[GAIN_SET1])
-    { // check for valid values
-    case 1:
-    case 2:
-    case 4:
-    case 8:
-    case 16:
-    case 32:
-    case 64:
-      pga1 = holdingRegs[GAIN_SET1];
-      eeprom_writeInt(EE_ADDR_gain_set1, pga1);
-      break;
-    default:
-      break;
-    }
-  }
-
-  if (holdingRegs[THRESHOLD_SET1] != thre1 && holdingRegs[THRESHOLD_SET1] >= 20 && holdingRegs[THRESHOLD_SET1] <= 80)
-  {
-    thre1 = holdingRegs[THRESHOLD_SET1];
-    eeprom_writeInt(EE_ADDR_threshold_set1, thre1);
-  }
-
-  if (holdingRegs[GAIN_SET2] != pga2)
-  {
-    switch (holdingRegs[GAIN_SET2])
-    {
-    case 1:
-    case 2:
-    case 4:
-    case 8:
-    case 16:
-    case 32:
-    case 64:
-      pga2 = holdingRegs[GAIN_SET2];
-      eeprom_writeInt(EE_ADDR_gain_set2, pga2);
-      break;
-    default:
-      break;
-    }
-  }
-
-  if (holdingRegs[THRESHOLD_SET2] != thre2 && holdingRegs[THRESHOLD_SET2] >= 20 && holdingRegs[THRESHOLD_SET2] <= 80)
-  {
-    thre2 = holdingRegs[THRESHOLD_SET2];
-    eeprom_writeInt(EE_ADDR_threshold_set2, thre2);
-  }
+// function 3/4 register getter, called while the response frame is serialized
+uint16_t modbus_readRegister(uint16_t address)
+{
+  int p = param_find(address);
+  if (p >= 0)
+    return param_get(p, param_slot(&params[p]));
+
+  switch (address)
+  {
+  case ACT_TEMPERATURE:
+    return celsius;
+  case MAX_TEMPERATURE:
+    return max_temperature;
+  case TOTAL_RUNTIME:
+    return total_runtime;
+  case IO_STATE:
+    return io_state;
+
+  // published by updateResults(), snapshot taken in checkModbus()
+  case PEAK_VALUE:
+    return mbMeasurement.peakValue;
+  case POSITION_VALUE:
+    return mbMeasurement.positionValue;
+  case POSITION_VALUE_AVG:
+    return mbMeasurement.positionValueAvg;
+  case MEAS_SCAN:
+    return mbMeasurement.scan;
+  case MEAS_FACET:
+    return mbMeasurement.facet;
+
+  case OUTPUT_LATENCY:
+    return outputLatency;
+  case OUTPUT_LATE:
+    return outputLate;
+  case SET_LATENCY:
+    return min(setLatency, 65535UL);
+  case SET_LATENCY_MAX:
+    return min(setLatencyMax, 65535UL);
+  case TEST_LATENCY:
+    return min(testLatency, 65535UL);
+  case LOOP_TIME:
+    return min(loopTime, 65535UL);
+  case LOOP_TIME_MAX:
+    return min(loopTimeMax, 65535UL);
+  case FIRST_MEAS_TIME:
+    return min(firstMeasTime, 65535UL);
+  case POSITION_VELOCITY:
+  {
+    long velocity = positionVelocity * 1000 / 256; // 1000 scans per second
+    return (int16_t)constrain(velocity, -32768L, 32767L);
+  }
+
+  case MOTOR_TIME_DIFF:
+    return motorTimeDiff;
+  case OFFSET_DELAY:
+    return delayOffset;
+
+  case EEPROM_FLUSH:
+    return eeCachePending;
+  case EEPROM_COMMITS:
+    return eepromCommits;
+
+  case CONFIG_IMAGE_STATUS:
+    return configImageStatus;
+  case TRACE_CONTROL:
+    return traceState;
+  case CPU_IDLE:
+    return cpuIdle;
 
-  if (holdingRegs[WINDOW_BEGIN] != windowBegin && holdingRegs[WINDOW_BEGIN] >= 5 && holdingRegs[WINDOW_BEGIN] <= 45)
-  {
-    windowBegin = holdingRegs[WINDOW_BEGIN];
-    eeprom_writeInt(EE_ADDR_window_begin, windowBegin);
+  default:
+    break;
   }
 
-  if (holdingRegs[WINDOW_END] != windowEnd && holdingRegs[WINDOW_END] >= 55 && holdingRegs[WINDOW_END] <= 95)
-  {
-    windowEnd = holdingRegs[WINDOW_END];
-    eeprom_writeInt(EE_ADDR_window_end, windowEnd);
-  }
+  if (address >= CPU_USAGE && address <= CPU_USAGE_LAST)
+    return cpuUsage[address - CPU_USAGE];
 
-  if (holdingRegs[POSITION_MODE] != positionMode && holdingRegs[POSITION_MODE] < 4)
+  if (address >= TRACE && address <= TRACE_LAST)
   {
-    positionMode = holdingRegs[POSITION_MODE];
-    eeprom_writeInt(EE_ADDR_position_mode, positionMode);
+    if (traceState != TRACE_READY)
+      return 0;
+    if (address == TRACE_LAST) // not computed in updateResults(), too long for the scan
+      return trace_CRC();
+    return traceBuf[address - TRACE];
   }
 
-  if (holdingRegs[ANALOG_OUT_MODE] != analogOutMode && holdingRegs[ANALOG_OUT_MODE] < 4)
+  if (address >= CONFIG_IMAGE && address <= CONFIG_IMAGE_LAST)
   {
-    analogOutMode = holdingRegs[ANALOG_OUT_MODE];
-    eeprom_writeInt(EE_ADDR_analog_out_mode, analogOutMode);
+    if (address == CONFIG_IMAGE) // reading the block from its start takes a new snapshot
+      config_exportImage();
+    return configImage[address - CONFIG_IMAGE];
   }
 
-  if (holdingRegs[POSITION_OFFSET] != positionOffset && holdingRegs[POSITION_OFFSET] >= 0 && holdingRegs[POSITION_OFFSET] <= 2000)
-  {
-    positionOffset = holdingRegs[POSITION_OFFSET];
-    eeprom_writeInt(EE_ADDR_position_offset, positionOffset);
-  }
+  if (address >= AN_VALUES && address < MOTOR_TIME_DIFF)
+    return anValues[address - AN_VALUES]; // one scan for the whole frame, see modbus_readFrame()
 
-  if (holdingRegs[FILTER_POSITION] != filterPosition && holdingRegs[FILTER_POSITION] < 10000)
-  {
-    filterPosition = holdingRegs[FILTER_POSITION];
-    eeprom_writeInt(EE_ADDR_filter_position, filterPosition);
-  }
+  // constants and values written directly to holdingRegs[] (exec times, errors)
+  return holdingRegs[address];
+}
 
-  if (holdingRegs[FILTER_ON] != filterOn && holdingRegs[FILTER_ON] < 10000)
+// function 3/4 request, before its first register: any read touching AN_VALUES takes the
+// latest scan, whatever part of the block it reads
+void modbus_readFrame(uint16_t startingAddress, uint16_t count)
+{
+  if (startingAddress < MOTOR_TIME_DIFF && startingAddress + count > AN_VALUES)
   {
-    filterOn = holdingRegs[FILTER_ON];
-    eeprom_writeInt(EE_ADDR_filter_on, filterOn);
+    __disable_irq(); // updateResults() must not overwrite it halfway, 25 words
+    for (int i = 0; i < MOTOR_TIME_DIFF - AN_VALUES; i++)
+      anValues[i] = value_buffer[i];
+    __enable_irq();
   }
+}
 
-  if (holdingRegs[FILTER_OFF] != filterOff && holdingRegs[FILTER_OFF] < 10000)
-  {
-    filterOff = holdingRegs[FILTER_OFF];
-    eeprom_writeInt(EE_ADDR_filter_off, filterOff);
+// function 6/16 register setter - if values are valid, save them in EEPROM
+void modbus_writeRegister(uint16_t address, uint16_t value)
+{
+  int p = param_find(address);
+  if (p >= 0)
+  { // same validation as in the menus
+    param_write(p, value, param_slot(&params[p]));
+    return;
   }
 
-  if (holdingRegs[IO_STATE] != io_state)
+  switch (address)
   {
-    if (holdingRegs[IO_STATE] & (1 << IO_LASER))
+  case IO_STATE:
+    if (value & (1 << IO_LASER))
     { // check if IO_LASER bit is set
       laserTimeout = TIMEOUT_LASER;
       digitalWrite(LASER, HIGH);
@@ -3264,7 +3718,7 @@ void checkModbus()
       laserTimeout = 0;
     }
 
-    if (holdingRegs[IO_STATE] & (1 << IO_IR_LED))
+    if (value & (1 << IO_IR_LED))
     { // check if IO_IR_LED bit is set
       digitalWrite(IR_LED, HIGH);
       testTimeout = TIMEOUT_TEST;
@@ -3275,6 +3729,33 @@ void checkModbus()
       digitalWrite(IR_LED, LOW);
       intTest = false;
     }
+    break;
+
+  case SET_LATENCY_MAX:
+    setLatencyMax = 0;
+    break;
+
+  case LOOP_TIME_MAX:
+    loopTimeMax = 0;
+    break;
+
+  case EEPROM_FLUSH:
+    if (value)
+      eepromFlush = true; // committed in checkEEPROM()
+    break;
+
+  case TRACE_CONTROL:
+    traceState = value ? TRACE_ARMED : TRACE_IDLE;
+    break;
+
+  default:
+    if (address >= CONFIG_IMAGE && address <= CONFIG_IMAGE_LAST)
+    {
+      configImage[address - CONFIG_IMAGE] = value;
+      if (address == CONFIG_IMAGE_LAST) // CRC written last, image complete
+        configImageStatus = config_importImage();
+    }
+    break; // read only registers
   }
 }
 
@@ -0,0 +1,86 @@
+// firmware built on the host against test/shims, one translation unit per test folder
+// helpers drive it the way the interrupts and the ModBus master do on the board
+#pragma once
+
+#include "../../src/main.cpp"
+
+// one scan of a mirror facet: callback_delay() starts the ADC and processes the previous
+// scan, the DMA interrupt delivers samples[] after ANALOG_BUFFER_SIZE conversions and the
+// outputs are latched OUTPUT_DELAY after the start, next scan 1000 us later
+inline void scan_run(const int *samples)
+{
+  unsigned long start = shimMicros;
+  unsigned long dmaTime = start + ANALOG_BUFFER_SIZE * 1000000UL / freq;
+  unsigned long outputTime = start + scanConfig->outputDelay;
+
+  motorPulseIndex = (motorPulseIndex + 1) % 6;
+  callback_delay();
+
+  for (int pass = 0; pass < 2; pass++)
+  {
+    if ((pass == 0) == (outputTime < dmaTime))
+    {
+      shimMicros = outputTime;
+      callback_output();
+    }
+    else
+    {
+      shimMicros = dmaTime;
+      for (int i = 0; i < ANALOG_BUFFER_SIZE; i++)
+        adc0_buf[i] = samples[i];
+      adc0_dma_isr();
+    }
+  }
+  shimMicros = start + 1000;
+}
+
+// ModBus RTU frame with CRC (low byte first)
+inline std::vector<uint8_t> modbus_frame(std::vector<uint8_t> pdu)
+{
+  uint16_t crc = 0xFFFF;
+  for (uint8_t b : pdu)
+    crc = crc16_update(crc, b);
+  pdu.push_back(crc & 0xFF);
+  pdu.push_back(crc >> 8);
+  return pdu;
+}
+
+extern uint16_t T1_5; // inter character time out of SimpleModbusSlave
+
+// send a request to the slave and return its response, empty if none
+inline std::vector<uint8_t> modbus_request(const std::vector<uint8_t> &request)
+{
+  Serial1.tx.clear();
+  for (uint8_t b : request)
+    Serial1.receive(b);
+  checkModbus(); // bytes received
+  shimMicros += T1_5;
+  checkModbus(); // frame complete, response
+  return Serial1.tx;
+}
+
+// function 3, returns the register values, empty on an exception
+inline std::vector<uint16_t> modbus_read(uint16_t address, uint16_t count)
+{
+  std::vector<uint8_t> r = modbus_request(modbus_frame({(uint8_t)modbusID, 3, (uint8_t)(address >> 8), (uint8_t)address, (uint8_t)(count >> 8), (uint8_t)count}));
+  std::vector<uint16_t> values;
+  if (r.size() != 5u + count * 2 || r[1] != 3)
+    return values;
+  for (int i = 0; i < count; i++)
+    values.push_back(r[3 + i * 2] << 8 | r[4 + i * 2]);
+  return values;
+}
+
+// function 16, true if acknowledged
+inline bool modbus_write(uint16_t address, const std::vector<uint16_t> &values)
+{
+  std::vector<uint8_t> pdu = {(uint8_t)modbusID, 16, (uint8_t)(address >> 8), (uint8_t)address,
+                              (uint8_t)(values.size() >> 8), (uint8_t)values.size(), (uint8_t)(values.size() * 2)};
+  for (uint16_t v : values)
+  {
+    pdu.push_back(v >> 8);
+    pdu.push_back(v & 0xFF);
+  }
+  std::vector<uint8_t> r = modbus_request(modbus_frame(pdu));
+  return r.size() == 8 && r[1] == 16;
+}
@@ -0,0 +1,83 @@
+// synthetic scans of a hot object for the host tests: 200 samples of the photodiode
+// signal with edges at known positions, so the processing chain can be judged on data
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+struct scanGenerator_t
+{
+  // object, in samples (0 - 200, 5 position units each)
+  double edge = 100;      // rising edge, middle of the ramp
+  double width = 60;      // rising to falling edge
+  double slope = 4;       // samples of each edge ramp
+  double velocity = 0;    // edge movement per scan
+  double facetSpread = 0; // +- edge offset of the six mirror facets (facet tolerance)
+
+  // signal, in ADC counts
+  int background = 10;
+  int intensity = 180;   // plateau, clipped at 255 like the 8 bit ADC
+  double noise = 3;      // photodiode noise, standard deviation
+  double dropout = 0;    // probability of a scale or steam dropout per scan
+  double dropoutDepth = 0.8; // intensity lost in a dropout
+  int dropoutScans = 1;  // scans per dropout
+
+  // state
+  uint32_t seed = 1;
+  int scan = 0;
+  int dropoutLeft = 0;
+
+  // rising and falling edge of the last generated scan
+  double risingEdge = 0;
+  double fallingEdge = 0;
+  bool droppedOut = false;
+};
+
+inline double scanGenerator_uniform(scanGenerator_t *g)
+{
+  g->seed = g->seed * 1664525 + 1013904223;
+  return ((g->seed >> 8) + 0.5) / 16777216.0;
+}
+
+// normal distribution, Box-Muller
+inline double scanGenerator_normal(scanGenerator_t *g)
+{
+  double u = scanGenerator_uniform(g);
+  double v = scanGenerator_uniform(g);
+  return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+// level of a ramp of the given length centered at position, 0 before and 1 after
+inline double scanGenerator_ramp(double x, double position, double length)
+{
+  if (length <= 0)
+    return x >= position ? 1 : 0;
+  double t = (x - position) / length + 0.5;
+  return t < 0 ? 0 : (t > 1 ? 1 : t);
+}
+
+// next scan into samples[], the object moves and the facets repeat every 6 scans
+inline void scanGenerator_next(scanGenerator_t *g, int *samples, int count)
+{
+  static const double facetOffset[6] = {0, 0.6, -0.4, 1, -1, 0.3}; // of facetSpread
+
+  double offset = g->facetSpread * facetOffset[g->scan % 6];
+  g->risingEdge = g->edge + g->velocity * g->scan + offset;
+  g->fallingEdge = g->risingEdge + g->width;
+
+  if (!g->dropoutLeft && g->dropout > 0 && scanGenerator_uniform(g) < g->dropout)
+    g->dropoutLeft = g->dropoutScans;
+  g->droppedOut = g->dropoutLeft > 0;
+  if (g->dropoutLeft)
+    g->dropoutLeft--;
+  double level = g->intensity * (g->droppedOut ? 1 - g->dropoutDepth : 1);
+
+  for (int i = 0; i < count; i++)
+  {
+    double object = scanGenerator_ramp(i, g->risingEdge, g->slope) - scanGenerator_ramp(i, g->fallingEdge, g->slope);
+    double v = g->background + (level - g->background) * object + g->noise * scanGenerator_normal(g);
+    int s = (int)lround(v);
+    samples[i] = s < 0 ? 0 : (s > 255 ? 255 : s);
+  }
+  g->scan++;
+}
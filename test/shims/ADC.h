@@ -0,0 +1,72 @@
+// host stand-in for the ADC library (env:native)
+#pragma once
+
+#include <Arduino.h>
+
+#define ADC_0 0
+#define ADC_1 1
+
+enum class ADC_CONVERSION_SPEED
+{
+  VERY_LOW_SPEED,
+  LOW_SPEED,
+  MED_SPEED,
+  HIGH_SPEED,
+  VERY_HIGH_SPEED
+};
+
+enum class ADC_SAMPLING_SPEED
+{
+  VERY_LOW_SPEED,
+  LOW_SPEED,
+  MED_SPEED,
+  HIGH_SPEED,
+  VERY_HIGH_SPEED
+};
+
+enum class ADC_INTERNAL_SOURCE
+{
+  TEMP_SENSOR = 38
+};
+
+// called by startPDB(), the test fills adc0_buf[] and runs the DMA interrupt
+inline void (*shimAdcStart)() = NULL;
+
+class ADC_Module
+{
+public:
+  int pga = 1;
+  int value = 892; // readSingle(), 892 = 25 deg C on the temperature channel
+  unsigned int pdbFrequency = 0;
+  bool pdbRunning = false;
+  bool dma = false;
+
+  void setAveraging(int) {}
+  void setResolution(int) {}
+  void setConversionSpeed(ADC_CONVERSION_SPEED) {}
+  void setSamplingSpeed(ADC_SAMPLING_SPEED) {}
+  void enablePGA(int gain) { pga = gain; }
+  int readSingle() { return value; }
+  void enableDMA() { dma = true; }
+  void disableDMA() { dma = false; }
+  void startPDB(unsigned int frequency)
+  {
+    pdbFrequency = frequency;
+    pdbRunning = true;
+    if (shimAdcStart)
+      shimAdcStart();
+  }
+  void stopPDB() { pdbRunning = false; }
+};
+
+class ADC
+{
+public:
+  ADC_Module *adc0 = new ADC_Module();
+  ADC_Module *adc1 = new ADC_Module();
+
+  int analogRead(ADC_INTERNAL_SOURCE, int) { return adc1->value; }
+  int analogRead(int, int) { return 0; }
+  int analogReadDifferential(int, int, int) { return 0; }
+  bool startContinuous(int, int) { return true; }
+};
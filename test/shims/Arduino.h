@@ -0,0 +1,230 @@
+// host stand-in for the Teensy 3.2 core, only what src/ and lib/ use (env:native)
+// time is virtual (shimMicros), pins and registers are plain variables
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <deque>
+#include <vector>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define FALLING 2
+#define RISING 3
+#define CHANGE 4
+#define MSBFIRST 1
+#define DMAMEM
+
+#define F_CPU 96000000
+#define F_BUS 48000000
+
+#define A10 34
+#define A11 35
+
+#define SERIAL_8N1 0x00
+#define SERIAL_8E1 0x06
+#define SERIAL_8O1 0x07
+#define SERIAL_8N2 0x04
+
+#define IRQ_UART0_STATUS 31
+#define IRQ_PDB 39
+#define IRQ_PORTC 60
+#define IRQ_PORTD 61
+#define NVIC_SET_PRIORITY(irq, priority)
+#define NVIC_DISABLE_IRQ(irq)
+#define NVIC_ENABLE_IRQ(irq)
+
+#define DMAMUX_SOURCE_ADC0 40
+
+// registers written by the firmware, kept for inspection
+inline volatile uint16_t ADC0_RA; // result register, read by the DMA as 16 bit
+inline volatile uint32_t PDB0_CH0C1;
+inline volatile uint32_t SPI0_PUSHR;
+inline volatile uint32_t SPI0_SR;
+inline volatile uint32_t SPI0_MCR;
+inline volatile uint32_t SPI0_CTAR0;
+inline volatile uint32_t CORE_PIN10_CONFIG;
+inline volatile uint32_t ARM_DEMCR;
+inline volatile uint32_t ARM_DWT_CTRL;
+inline volatile uint32_t ARM_DWT_CYCCNT; // advanced by the test when cycles matter
+
+#define SPI_PUSHR_CONT ((uint32_t)1 << 31)
+#define SPI_PUSHR_CTAS(n) ((uint32_t)(n) << 28)
+#define SPI_PUSHR_PCS(n) ((uint32_t)(n) << 16)
+#define SPI_SR_TCF ((uint32_t)1 << 31)
+#define SPI_SR_EOQF ((uint32_t)1 << 28)
+#define SPI_SR_TXCTR 0x0000F000
+#define SPI_MCR_MSTR ((uint32_t)1 << 31)
+#define SPI_MCR_PCSIS(n) ((uint32_t)(n) << 16)
+#define SPI_MCR_DIS_RXF ((uint32_t)1 << 12)
+#define SPI_MCR_CLR_TXF ((uint32_t)1 << 11)
+#define SPI_MCR_CLR_RXF ((uint32_t)1 << 10)
+#define SPI_MCR_HALT ((uint32_t)1)
+#define SPI_CTAR_DBR ((uint32_t)1 << 31)
+#define SPI_CTAR_FMSZ(n) ((uint32_t)(n) << 27)
+#define SPI_CTAR_PBR(n) ((uint32_t)(n) << 16)
+#define SPI_CTAR_CSSCK(n) ((uint32_t)(n) << 12)
+#define SPI_CTAR_ASC(n) ((uint32_t)(n) << 8)
+#define SPI_CTAR_DT(n) ((uint32_t)(n) << 4)
+#define SPI_CTAR_BR(n) ((uint32_t)(n))
+#define PORT_PCR_MUX(n) ((uint32_t)(n) << 8)
+#define PORT_PCR_DSE ((uint32_t)1 << 6)
+#define PORT_PCR_SRE ((uint32_t)1 << 2)
+#define ARM_DEMCR_TRCENA ((uint32_t)1 << 24)
+#define ARM_DWT_CTRL_CYCCNTENA 1
+
+// virtual time, only the test advances it
+inline unsigned long shimMicros = 0;
+
+inline unsigned long micros() { return shimMicros; }
+inline unsigned long millis() { return shimMicros / 1000; }
+inline void delay(unsigned long ms) { shimMicros += ms * 1000; }
+inline void delayMicroseconds(unsigned int us) { shimMicros += us; }
+
+// interrupts are not preempted on the host, the flag only shows the critical sections
+inline int shimIrqDisabled = 0;
+inline void __disable_irq() { shimIrqDisabled++; }
+inline void __enable_irq() { shimIrqDisabled--; }
+
+// pins
+#define SHIM_PINS 64
+inline int shimPin[SHIM_PINS];
+inline void (*shimPinIsr[SHIM_PINS])();
+inline int shimPinEdge[SHIM_PINS];
+
+#define digitalPinToInterrupt(pin) (pin)
+
+inline void pinMode(int pin, int mode)
+{
+  if (mode == INPUT_PULLUP)
+    shimPin[pin] = HIGH;
+}
+inline void digitalWrite(int pin, int value) { shimPin[pin] = value ? HIGH : LOW; }
+inline int digitalRead(int pin) { return shimPin[pin]; }
+inline void digitalWriteFast(int pin, int value) { digitalWrite(pin, value); }
+inline int digitalReadFast(int pin) { return digitalRead(pin); }
+
+inline void attachInterrupt(int pin, void (*isr)(), int edge)
+{
+  shimPinIsr[pin] = isr;
+  shimPinEdge[pin] = edge;
+}
+inline void detachInterrupt(int pin) { shimPinIsr[pin] = NULL; }
+
+// handlers installed over the core ones, by IRQ number
+inline void (*shimVector[64])();
+inline void attachInterruptVector(int irq, void (*isr)()) { shimVector[irq] = isr; }
+
+// drive an input pin, the attached interrupt runs at once like on the board
+inline void shim_pinInput(int pin, int value)
+{
+  int old = shimPin[pin];
+  shimPin[pin] = value ? HIGH : LOW;
+  if (!shimPinIsr[pin] || old == shimPin[pin])
+    return;
+  if (shimPinEdge[pin] == CHANGE || (shimPinEdge[pin] == RISING && value) || (shimPinEdge[pin] == FALLING && !value))
+    shimPinIsr[pin]();
+}
+
+// math
+template <class T>
+T min(T a, T b) { return a < b ? a : b; }
+template <class T>
+T max(T a, T b) { return a > b ? a : b; }
+template <class T, class L, class H>
+T constrain(T x, L low, H high) { return x < low ? low : (x > high ? high : x); }
+inline long map(long x, long inMin, long inMax, long outMin, long outMax)
+{
+  return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+
+// UART: the test queues received bytes in rx, transmitted bytes collect in tx
+class HardwareSerial
+{
+public:
+  std::deque<uint8_t> rx;
+  std::vector<uint8_t> tx;
+  long baud = 0;
+  uint16_t format = 0;
+  int txenPin = -1;
+  size_t rxSize = 64; // receive ring of the Teensy 3 core, more with addMemoryForRead()
+
+  void begin(long b, uint16_t f = 0)
+  {
+    baud = b;
+    format = f;
+  }
+  void end() { baud = 0; }
+  void flush() {}
+  int available() { return rx.size(); }
+  int read()
+  {
+    if (rx.empty())
+      return -1;
+    int c = rx.front();
+    rx.pop_front();
+    return c;
+  }
+  size_t write(uint8_t c)
+  {
+    tx.push_back(c);
+    return 1;
+  }
+  void transmitterEnable(uint8_t pin) { txenPin = pin; }
+  void addMemoryForRead(void *buffer, size_t length) { rxSize = 64 + length; }
+  // byte from the line, lost when the receive ring is full
+  void receive(uint8_t c)
+  {
+    if (rx.size() < rxSize)
+      rx.push_back(c);
+  }
+  operator bool() { return true; }
+};
+
+inline HardwareSerial Serial;
+inline HardwareSerial Serial1;
+inline uint32_t shimUartCycles = 0; // ARM_DWT_CYCCNT advanced by each uart0_status_isr()
+inline void uart0_status_isr() { ARM_DWT_CYCCNT += shimUartCycles; }
+
+// periodic interrupt, the test calls callback every period
+class IntervalTimer;
+inline std::vector<IntervalTimer *> shimTimers; // started timers, in begin() order
+
+class IntervalTimer
+{
+public:
+  void (*callback)() = NULL;
+  float period = 0; // us
+  int prio = 128;
+
+  bool begin(void (*isr)(), float us)
+  {
+    callback = isr;
+    period = us;
+    for (IntervalTimer *t : shimTimers)
+    {
+      if (t == this)
+        return true;
+    }
+    shimTimers.push_back(this);
+    return true;
+  }
+  void end() { callback = NULL; }
+  void priority(int p) { prio = p; }
+  void update(float us) { period = us; }
+};
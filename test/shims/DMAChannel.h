@@ -0,0 +1,28 @@
+// host stand-in for the DMAChannel class of the Teensy core (env:native)
+#pragma once
+
+#include <Arduino.h>
+
+class DMAChannel
+{
+public:
+  void (*isr)() = NULL;
+  volatile int16_t *buffer = NULL;
+  unsigned int bufferSize = 0; // bytes
+  bool enabled = false;
+
+  void source(volatile uint16_t &) {}
+  void destinationBuffer(volatile int16_t *p, unsigned int size)
+  {
+    buffer = p;
+    bufferSize = size;
+  }
+  void triggerAtHardwareEvent(int) {}
+  void interruptAtCompletion() {}
+  void disableOnCompletion() {}
+  void attachInterrupt(void (*f)()) { isr = f; }
+  void enable() { enabled = true; }
+  void disable() { enabled = false; }
+  void clearInterrupt() {}
+  void clearComplete() {}
+};
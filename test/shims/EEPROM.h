@@ -0,0 +1,59 @@
+// host stand-in for the Teensy 3.2 EEPROM (env:native)
+// erased cells read 0xFF, every byte actually changed is counted, and power can be
+// cut after a number of byte writes to test what survives a torn commit
+#pragma once
+
+#include <Arduino.h>
+
+#define E2END 0x7FF
+
+// thrown by the write that finds no power left
+struct shimPowerLoss
+{
+};
+
+class EEPROMClass
+{
+public:
+  uint8_t data[E2END + 1];
+  unsigned long writes = 0; // bytes written
+  long powerBudget = -1;    // bytes written before power is lost, -1 = never
+
+  EEPROMClass() { erase(); }
+  void erase() { memset(data, 0xFF, sizeof(data)); }
+
+  uint8_t read(int address) { return data[address]; }
+  void write(int address, uint8_t value)
+  {
+    if (powerBudget == 0)
+      throw shimPowerLoss();
+    if (powerBudget > 0)
+      powerBudget--;
+    data[address] = value;
+    writes++;
+  }
+  void update(int address, uint8_t value)
+  {
+    if (data[address] != value)
+      write(address, value);
+  }
+  int length() { return E2END + 1; }
+
+  // like the Teensy core, put() only writes the bytes that change
+  template <class T>
+  T &get(int address, T &t)
+  {
+    memcpy(&t, data + address, sizeof(T));
+    return t;
+  }
+  template <class T>
+  const T &put(int address, const T &t)
+  {
+    const uint8_t *p = (const uint8_t *)&t;
+    for (unsigned int i = 0; i < sizeof(T); i++)
+      update(address + i, p[i]);
+    return t;
+  }
+};
+
+inline EEPROMClass EEPROM;
@@ -0,0 +1,33 @@
+// host stand-in for the LedDisplay library (env:native)
+// keeps the shown text and counts the bits the real library shifts out: every
+// character written reloads the whole dot register, 5 columns of 8 bits per character
+#pragma once
+
+#include <Arduino.h>
+
+class LedDisplay
+{
+public:
+  char text[33];
+  int length;
+  int cursor = 0;
+  int brightness = 0;
+  unsigned long bits = 0; // bits shifted to the dot registers
+
+  LedDisplay(int, int, int, int, int, int displayLength) : length(displayLength) { memset(text, ' ', sizeof(text)); }
+
+  void begin() {}
+  void setBrightness(int b) { brightness = b; }
+  void home() { cursor = 0; }
+  void setCursor(int position) { cursor = position; }
+  int getCursor() { return cursor; }
+  void clear() { memset(text, ' ', length); }
+  size_t write(uint8_t c)
+  {
+    if (cursor < length)
+      text[cursor] = c;
+    cursor++;
+    bits += length * 5 * 8; // loadDotRegister()
+    return 1;
+  }
+};
@@ -0,0 +1,23 @@
+// host stand-in for the SPI library (env:native), the firmware drives SPI0 registers directly
+#pragma once
+
+#include <Arduino.h>
+
+#define SPI_MODE0 0x00
+
+class SPISettings
+{
+public:
+  SPISettings(uint32_t, uint8_t, uint8_t) {}
+};
+
+class SPIClass
+{
+public:
+  void begin() {}
+  void beginTransaction(SPISettings) {}
+  void endTransaction() {}
+  uint16_t transfer16(uint16_t) { return 0; }
+};
+
+inline SPIClass SPI;
@@ -0,0 +1,38 @@
+// host stand-in for lib/TeensyDelay (env:native), triggers are recorded and
+// the test runs the channel callback when the delay has passed
+#pragma once
+
+#include <Arduino.h>
+
+#define SHIM_DELAY_CHANNELS 4
+
+namespace TeensyDelay
+{
+inline void (*callbacks[SHIM_DELAY_CHANNELS])();
+inline float delays[SHIM_DELAY_CHANNELS]; // us of the last trigger
+inline bool pending[SHIM_DELAY_CHANNELS];
+inline void (*onTrigger)(int channel, float delay) = NULL; // optional hook
+
+inline void begin() {}
+
+inline unsigned addDelayChannel(void (*callback)(void), const int nr = -1)
+{
+  callbacks[nr] = callback;
+  return nr;
+}
+
+inline void trigger(const float delay, const int channel = 0)
+{
+  delays[channel] = delay;
+  pending[channel] = true;
+  if (onTrigger)
+    onTrigger(channel, delay);
+}
+
+// run the callback of a triggered channel
+inline void fire(int channel)
+{
+  pending[channel] = false;
+  callbacks[channel]();
+}
+} // namespace TeensyDelay
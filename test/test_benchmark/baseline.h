@@ -0,0 +1,18 @@
+// normalized cost per kernel, slowest of several BENCH_RECORD=1 runs with the native env
+// (g++ 12 -Os, x86-64)
+constexpr benchBaseline_t benchBaseline[] = {
+    {"updateResults HMD", 0.5175},
+    {"updateResults RISE", 0.5345},
+    {"updateResults FALL", 0.5942},
+    {"updateResults PEAK", 0.6704},
+    {"calculateCRC 253 bytes", 1.9372},
+    {"approxSimpleMovingAverage", 0.0096},
+    {"displayPrint x2", 0.0519},
+    {"FC3 measurement 28 regs", 1.2541},
+    {"FC3 settings 24 regs", 1.1261},
+    {"scaling map()", 0.0147},
+    {"scaling reciprocal", 0.0076},
+    {"FC3 AN_VALUES 25 regs", 1.1664},
+    {"checkModbus idle", 0.0079},
+    {"register mirror 50 regs", 0.2630},
+};
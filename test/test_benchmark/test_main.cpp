@@ -0,0 +1,311 @@
+// host microbenchmarks of the firmware hot paths, pio test -e native -f test_benchmark
+// time per call is normalized to a fixed calibration loop timed right after each batch and
+// compared with the stored baseline; wall clock depends on host, compiler and load, so the
+// table is informational in the normal test run
+// BENCH_CHECK=1 fails the test when a kernel is slower than BENCH_THRESHOLD x its baseline,
+// on request on a quiet host; BENCH_RECORD=1 prints a new baseline.h
+#include <unity.h>
+#include <firmware.h>
+#include <chrono>
+#include <algorithm>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define BENCH_THRESHOLD 1.3 // normalized cost / baseline
+#define BENCH_BATCHES 51    // median of the batches counts
+
+struct benchBaseline_t
+{
+  const char *name;
+  double cost; // time per call / time of the calibration loop
+};
+
+#include "baseline.h"
+
+struct bench_t
+{
+  const char *name;
+  void (*prepare)();
+  void (*run)();
+  int calls; // per batch
+};
+
+uint16_t calculateCRC(byte bufferSize); // SimpleModbusSlave
+extern unsigned char frame[];
+
+static volatile uint32_t benchSink;
+static int scanSamples[ANALOG_BUFFER_SIZE];
+
+// fixed integer work the kernels are measured in
+static void calibration()
+{
+  uint32_t x = benchSink;
+  for (int i = 0; i < 1000; i++)
+    x = x * 1664525 + 1013904223;
+  benchSink = x;
+}
+
+// hot object pulse: rising edge at sample 80, falling at 140, photodiode noise
+static void scan_prepare(int positionMode)
+{
+  uint32_t noise = 12345;
+  for (int i = 0; i < ANALOG_BUFFER_SIZE; i++)
+  {
+    noise = noise * 1664525 + 1013904223;
+    int v = (i >= 80 && i < 140) ? 180 : 10;
+    scanSamples[i] = v + (int)(noise >> 29);
+    adc_data[i] = scanSamples[i];
+  }
+  for (int slot = 0; slot < RECIPE_COUNT; slot++)
+    recipes[slot].positionMode = positionMode;
+  config_build();
+  scanConfig = scanConfigPending ? scanConfigPending : scanConfig;
+  scanConfigPending = NULL;
+  dataRecipe = recipe_active();
+}
+
+static void hmd_prepare() { scan_prepare(0); }
+static void rise_prepare() { scan_prepare(1); }
+static void fall_prepare() { scan_prepare(2); }
+static void peak_prepare() { scan_prepare(3); }
+
+static void results_run()
+{
+  dataStartTime += 1000;
+  updateResults();
+}
+
+static void crc_prepare()
+{
+  for (int i = 0; i < 253; i++)
+    frame[i] = i * 7;
+}
+
+static void crc_run() { benchSink = calculateCRC(253); }
+
+static void sma_run()
+{
+  signalPresent = true;
+  benchSink = approxSimpleMovingAverage(benchSink & 1023, 6);
+}
+
+static void display_run()
+{
+  displayPrint("Int %3d%%", (int)(benchSink & 127));
+  displayPrint("mPos%s", positionModeNames[benchSink & 3]);
+}
+
+// FC3 of the measurement and AN_VALUES block, 28 registers
+static void measurement_run()
+{
+  benchSink = modbus_read(PEAK_VALUE, 28).size();
+}
+
+// FC3 of the settings block, parameters resolved through params[]
+static void settings_run()
+{
+  benchSink = modbus_read(ENUM_SIZE, PEAK_VALUE - ENUM_SIZE).size();
+}
+
+// output scaling of one scan: averaged position to display and DAC range, peak to display and DAC
+static void scaling_prepare() { scan_prepare(1); }
+
+static void scaling_map_run()
+{
+  const scanRecipe_t *rcp = &scanConfig->recipe[dataRecipe];
+  int x = benchSink % 1000;
+  int peak = benchSink & 255;
+  int position = constrain(x, rcp->positionBegin, rcp->positionEnd);
+  benchSink += map(position, rcp->positionBegin, rcp->positionEnd, 0, 1000) + map(position, rcp->positionBegin, rcp->positionEnd, 0, 65535) +
+               map(peak, 0, 255, 0, 100) + map(peak, 0, 255, 0, 65535) + 1;
+}
+
+// same with the reciprocal of config_build(), as updateResults() does it
+static void scaling_recip_run()
+{
+  const scanRecipe_t *rcp = &scanConfig->recipe[dataRecipe];
+  int x = benchSink % 1000;
+  int peak = benchSink & 255;
+  int position = constrain(x, rcp->positionBegin, rcp->positionEnd) - rcp->positionBegin;
+  benchSink += (((uint64_t)(position * 1000) * rcp->positionRecip) >> RECIP_SHIFT) + (((uint64_t)(position * 65535) * rcp->positionRecip) >> RECIP_SHIFT) +
+               ((peak * 101) >> 8) + peak * 257 + 1;
+}
+
+// FC3 of the AN_VALUES block alone, snapshot taken by modbus_readFrame()
+static void an_values_run()
+{
+  benchSink = modbus_read(AN_VALUES, MOTOR_TIME_DIFF - AN_VALUES).size();
+}
+
+// loop() pass without a request, registers are resolved only when a frame is serialized
+static void modbus_idle_run()
+{
+  checkModbus();
+  benchSink = holdingRegs[TOTAL_ERRORS];
+}
+
+// what every loop() pass paid before the register map: all settings and measurement
+// registers mirrored into the array
+static void mirror_run()
+{
+  static uint16_t mirror[MOTOR_TIME_DIFF];
+  for (int a = MODBUS_ID; a < MOTOR_TIME_DIFF; a++)
+    mirror[a] = modbus_readRegister(a);
+  benchSink = mirror[benchSink % MOTOR_TIME_DIFF];
+}
+
+static void none() {}
+
+static const bench_t benches[] = {
+    {"updateResults HMD", hmd_prepare, results_run, 200},
+    {"updateResults RISE", rise_prepare, results_run, 200},
+    {"updateResults FALL", fall_prepare, results_run, 200},
+    {"updateResults PEAK", peak_prepare, results_run, 200},
+    {"calculateCRC 253 bytes", crc_prepare, crc_run, 200},
+    {"approxSimpleMovingAverage", none, sma_run, 10000},
+    {"displayPrint x2", none, display_run, 2000},
+    {"FC3 measurement 28 regs", none, measurement_run, 200},
+    {"FC3 settings 24 regs", none, settings_run, 100},
+    {"scaling map()", scaling_prepare, scaling_map_run, 10000},
+    {"scaling reciprocal", scaling_prepare, scaling_recip_run, 10000},
+    {"FC3 AN_VALUES 25 regs", none, an_values_run, 200},
+    {"checkModbus idle", none, modbus_idle_run, 10000},
+    {"register mirror 50 regs", none, mirror_run, 1000},
+};
+
+// instructions retired, -1 if the host has no performance counters
+static int perfFd = -2;
+
+static long long instructions()
+{
+#ifdef __linux__
+  if (perfFd == -2)
+  {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    perfFd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+  long long count;
+  if (perfFd >= 0 && read(perfFd, &count, sizeof(count)) == sizeof(count))
+    return count;
+#endif
+  return -1;
+}
+
+struct benchResult_t
+{
+  double ns;           // per call, fastest batch
+  double instructions; // per call, -1 if not available
+  double cost;         // median of time per call / time of the calibration loop after it
+};
+
+static double batch_ns(void (*run)(), int calls)
+{
+  auto t0 = std::chrono::steady_clock::now();
+  for (int n = 0; n < calls; n++)
+    run();
+  auto t1 = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(t1 - t0).count() / calls;
+}
+
+static benchResult_t measure(void (*run)(), int calls)
+{
+  benchResult_t r = {1e30, -1, 0};
+  double ratio[BENCH_BATCHES];
+  for (int b = 0; b < BENCH_BATCHES; b++)
+  {
+    long long i0 = instructions();
+    double ns = batch_ns(run, calls);
+    long long i1 = instructions();
+    ratio[b] = ns / batch_ns(calibration, 20); // same clock and cache state, load hits both
+
+    if (ns < r.ns)
+      r.ns = ns;
+    if (i0 >= 0 && i1 >= 0)
+      r.instructions = (double)(i1 - i0) / calls;
+  }
+  std::nth_element(ratio, ratio + BENCH_BATCHES / 2, ratio + BENCH_BATCHES);
+  r.cost = ratio[BENCH_BATCHES / 2];
+  return r;
+}
+
+static const benchBaseline_t *baseline_find(const char *name)
+{
+  for (const benchBaseline_t &b : benchBaseline)
+  {
+    if (!strcmp(b.name, name))
+      return &b;
+  }
+  return NULL;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_benchmarks(void)
+{
+  bool record = getenv("BENCH_RECORD");
+  bool check = getenv("BENCH_CHECK");
+  int regressions = 0;
+  char line[160];
+
+  printf("calibration loop %.1f ns\n", batch_ns(calibration, 20));
+  printf("%-28s %10s %10s %8s %8s\n", "kernel", "ns/op", "instr/op", "cost", "baseline");
+  if (record)
+    printf("--- baseline.h\nconstexpr benchBaseline_t benchBaseline[] = {\n");
+
+  for (const bench_t &b : benches)
+  {
+    const benchBaseline_t *base = baseline_find(b.name);
+    benchResult_t r = {0, -1, 1e30};
+    for (int retry = 0; retry < 3; retry++) // a slow result is measured again before it counts
+    {
+      b.prepare();
+      benchResult_t m = measure(b.run, b.calls);
+      if (m.cost < r.cost)
+        r = m;
+      if (!check || !base || r.cost <= base->cost * BENCH_THRESHOLD)
+        break;
+    }
+    double cost = r.cost;
+
+    if (record)
+    {
+      printf("    {\"%s\", %.4f},\n", b.name, cost);
+      continue;
+    }
+
+    char instr[16] = "n/a";
+    if (r.instructions >= 0)
+      snprintf(instr, sizeof(instr), "%.0f", r.instructions);
+    printf("%-28s %10.1f %10s %8.4f %8.4f%s\n", b.name, r.ns, instr, cost, base ? base->cost : 0.0,
+           base && cost > base->cost * BENCH_THRESHOLD ? "  SLOWER" : "");
+
+    if (check && base && cost > base->cost * BENCH_THRESHOLD)
+    {
+      snprintf(line, sizeof(line), "%s: %.4f > %.1f x baseline %.4f", b.name, cost, BENCH_THRESHOLD, base->cost);
+      TEST_MESSAGE(line);
+      regressions++;
+    }
+  }
+  if (record)
+    printf("};\n");
+
+  TEST_ASSERT_EQUAL_MESSAGE(0, regressions, "kernels slower than the baseline");
+}
+
+int main(int argc, char **argv)
+{
+  setup();
+  UNITY_BEGIN();
+  RUN_TEST(test_benchmarks);
+  return UNITY_END();
+}
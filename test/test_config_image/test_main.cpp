@@ -0,0 +1,133 @@
+// configuration image: export and import through the CONFIG_IMAGE registers
+#include <unity.h>
+#include <firmware.h>
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_export_header_and_crc(void)
+{
+  std::vector<uint16_t> image = modbus_read(CONFIG_IMAGE, CONFIG_IMAGE_SIZE);
+  TEST_ASSERT_EQUAL(CONFIG_IMAGE_SIZE, image.size());
+  TEST_ASSERT_EQUAL(MODEL_TYPE, image[0]);
+  TEST_ASSERT_EQUAL(CONFIG_IMAGE_VERSION, image[1]);
+  TEST_ASSERT_EQUAL(CONFIG_IMAGE_WORDS, image[2]);
+  TEST_ASSERT_EQUAL(config_imageCRC(), image[CONFIG_IMAGE_SIZE - 1]);
+}
+
+// image of one unit restores all its recipes after they were changed
+void test_round_trip(void)
+{
+  std::vector<uint16_t> image = modbus_read(CONFIG_IMAGE, CONFIG_IMAGE_SIZE);
+
+  for (int slot = 0; slot < RECIPE_COUNT; slot++)
+  {
+    recipes[slot].thre = 80;
+    recipes[slot].positionMode = 3;
+  }
+  outputDelay = 900;
+  TEST_ASSERT_TRUE(modbus_write(CONFIG_IMAGE, image));
+  TEST_ASSERT_EQUAL(IMAGE_OK, modbus_read(CONFIG_IMAGE_STATUS, 1)[0]);
+
+  TEST_ASSERT_EQUAL(DEFAULT_THRESHOLD_SET1, recipes[0].thre);
+  TEST_ASSERT_EQUAL(DEFAULT_THRESHOLD_SET2, recipes[1].thre);
+  TEST_ASSERT_EQUAL(DEFAULT_POSITION_MODE, recipes[7].positionMode);
+  TEST_ASSERT_EQUAL(DEFAULT_OUTPUT_DELAY, outputDelay);
+  TEST_ASSERT_EQUAL(DEFAULT_OUTPUT_DELAY, scanConfigPending->outputDelay); // used from the next scan
+
+  // stored in one journal commit
+  checkEEPROM();
+  TEST_ASSERT_EQUAL(0, eeCachePending);
+  TEST_ASSERT_EQUAL(DEFAULT_OUTPUT_DELAY, eeprom_readInt(EE_ADDR_output_delay));
+}
+
+// image with a valid CRC over the changed WORDs
+std::vector<uint16_t> image_withCRC(std::vector<uint16_t> image)
+{
+  std::copy(image.begin(), image.end(), configImage);
+  image[CONFIG_IMAGE_SIZE - 1] = config_imageCRC();
+  return image;
+}
+
+// rejected image leaves the configuration and the EEPROM as they were
+void assert_rejected(const std::vector<uint16_t> &image, int status)
+{
+  checkEEPROM();
+  std::vector<uint16_t> before = modbus_read(CONFIG_IMAGE, CONFIG_IMAGE_SIZE);
+  int delay = outputDelay;
+
+  TEST_ASSERT_TRUE(modbus_write(CONFIG_IMAGE, image));
+  TEST_ASSERT_EQUAL(status, modbus_read(CONFIG_IMAGE_STATUS, 1)[0]);
+
+  TEST_ASSERT_EQUAL(0, eeCachePending);
+  TEST_ASSERT_FALSE(eepromFlush);
+  TEST_ASSERT_EQUAL(delay, outputDelay);
+  TEST_ASSERT_TRUE(before == modbus_read(CONFIG_IMAGE, CONFIG_IMAGE_SIZE));
+}
+
+void test_version_mismatch(void)
+{
+  std::vector<uint16_t> image = modbus_read(CONFIG_IMAGE, CONFIG_IMAGE_SIZE);
+  recipes[0].thre = 80;
+  outputDelay = 900;
+
+  image[1] = CONFIG_IMAGE_VERSION + 1;
+  assert_rejected(image_withCRC(image), IMAGE_WRONG_VERSION);
+  TEST_ASSERT_EQUAL(80, recipes[0].thre);
+
+  image[1] = CONFIG_IMAGE_VERSION;
+  image[0] = MODEL_TYPE + 1;
+  assert_rejected(image_withCRC(image), IMAGE_WRONG_MODEL);
+}
+
+// image of a firmware with other parameters: same version, different number of WORDs
+void test_word_count_mismatch(void)
+{
+  std::vector<uint16_t> image = modbus_read(CONFIG_IMAGE, CONFIG_IMAGE_SIZE);
+  recipes[0].thre = 75;
+
+  image[2] = CONFIG_IMAGE_WORDS - 1;
+  assert_rejected(image_withCRC(image), IMAGE_WRONG_VERSION);
+  image[2] = CONFIG_IMAGE_WORDS + 1;
+  assert_rejected(image_withCRC(image), IMAGE_WRONG_VERSION);
+  TEST_ASSERT_EQUAL(75, recipes[0].thre);
+}
+
+void test_corrupted_image(void)
+{
+  std::vector<uint16_t> image = modbus_read(CONFIG_IMAGE, CONFIG_IMAGE_SIZE);
+  recipes[0].thre = 70;
+
+  // every parameter WORD with a bit flipped in transfer
+  for (int n = 3; n < CONFIG_IMAGE_SIZE - 1; n++)
+  {
+    std::vector<uint16_t> corrupted = image;
+    corrupted[n] ^= 1 << (n % 16);
+    assert_rejected(corrupted, IMAGE_CRC_ERROR);
+  }
+  std::vector<uint16_t> corrupted = image;
+  corrupted[CONFIG_IMAGE_SIZE - 1] ^= 0x8000;
+  assert_rejected(corrupted, IMAGE_CRC_ERROR);
+
+  // valid CRC, but a value out of range is not applied partially
+  corrupted = image;
+  corrupted[CONFIG_IMAGE_SIZE - 2] = 0xFFFF;
+  assert_rejected(image_withCRC(corrupted), IMAGE_INVALID_VALUE);
+  TEST_ASSERT_EQUAL(70, recipes[0].thre);
+
+  // the intact image still applies
+  TEST_ASSERT_TRUE(modbus_write(CONFIG_IMAGE, image));
+  TEST_ASSERT_EQUAL(IMAGE_OK, modbus_read(CONFIG_IMAGE_STATUS, 1)[0]);
+}
+
+int main(int argc, char **argv)
+{
+  setup();
+  UNITY_BEGIN();
+  RUN_TEST(test_export_header_and_crc);
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_version_mismatch);
+  RUN_TEST(test_word_count_mismatch);
+  RUN_TEST(test_corrupted_image);
+  return UNITY_END();
+}
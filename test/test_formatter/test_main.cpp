@@ -0,0 +1,190 @@
+// displayFormat() and the display frame buffer
+#include <unity.h>
+#include <firmware.h>
+#include <climits>
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_text_and_percent(void)
+{
+  char S[displayLength + 1];
+  displayFormatf(S, sizeof(S), "Starting");
+  TEST_ASSERT_EQUAL_STRING("Starting", S);
+  displayFormatf(S, sizeof(S), "%3d%%", 45);
+  TEST_ASSERT_EQUAL_STRING(" 45%", S);
+}
+
+void test_width_and_sign(void)
+{
+  char S[displayLength + 1];
+  displayFormatf(S, sizeof(S), "Offs%4d", 7);
+  TEST_ASSERT_EQUAL_STRING("Offs   7", S);
+  displayFormatf(S, sizeof(S), "%4d", -12);
+  TEST_ASSERT_EQUAL_STRING(" -12", S);
+  displayFormatf(S, sizeof(S), "%d", 0);
+  TEST_ASSERT_EQUAL_STRING("0", S);
+}
+
+void test_string(void)
+{
+  char S[displayLength + 1];
+  displayFormatf(S, sizeof(S), "mPos%s", "RISE");
+  TEST_ASSERT_EQUAL_STRING("mPosRISE", S);
+  displayFormatf(S, sizeof(S), "%6s", "8N1");
+  TEST_ASSERT_EQUAL_STRING("   8N1", S);
+}
+
+void test_truncated_to_display(void)
+{
+  char S[displayLength + 1];
+  displayFormatf(S, sizeof(S), "Sp%6d", 115200);
+  TEST_ASSERT_EQUAL_STRING("Sp115200", S);
+  displayFormatf(S, sizeof(S), "Sp%6d", 1152000); // one digit too many
+  TEST_ASSERT_EQUAL_STRING("Sp115200", S);
+}
+
+void test_one_changed_glyph_per_call(void)
+{
+  displayPrint("AAAAAAAA");
+  displayFlush();
+  TEST_ASSERT_EQUAL_MEMORY("AAAAAAAA", myDisplay.text, displayLength);
+
+  displayPrint("AAbAAAcA");
+  unsigned long bits = myDisplay.bits;
+  checkDisplay();
+  TEST_ASSERT_EQUAL_MEMORY("AAbAAAAA", myDisplay.text, displayLength);
+  checkDisplay();
+  TEST_ASSERT_EQUAL_MEMORY("AAbAAAcA", myDisplay.text, displayLength);
+  checkDisplay(); // nothing left to write
+  TEST_ASSERT_EQUAL(2 * displayLength * 5 * 8, myDisplay.bits - bits);
+}
+
+// every format the firmware prints, byte for byte the same as snprintf() for all buffer sizes
+static const char *const firmwareFormats[] = {
+    "Temp %2dC", "Set %s", "%s%s", "Thre %2d%%", "TT%6d", "SN %5d", "SHK01-%2d", "Pos %3d%%", "Mot=%3d%%",
+    "MaxT %2dC", "Int %3d%%", "Gain %2dx", "FW %5d", "CPU %3d%%", "%s", "WARNING!", "       Y"};
+
+static void compare(const char *format, ...)
+{
+  for (int size = 1; size <= displayLength + 1; size++)
+  {
+    char expected[16], actual[16];
+    memset(expected, 'x', sizeof(expected));
+    memset(actual, 'x', sizeof(actual));
+    va_list arg, arg2;
+    va_start(arg, format);
+    va_copy(arg2, arg);
+    vsnprintf(expected, size, format, arg);
+    displayFormat(actual, size, format, arg2);
+    va_end(arg2);
+    va_end(arg);
+    char msg[64];
+    snprintf(msg, sizeof(msg), "\"%s\" size %d", format, size);
+    TEST_ASSERT_EQUAL_MEMORY_MESSAGE(expected, actual, sizeof(expected), msg);
+  }
+}
+
+static void compare_values(const char *format)
+{
+  static const char *const texts[] = {"", "8N1", "RISE", " HMD", "1I2P", "Sensor", "12345678", "123456789"};
+  int d = 0, str = 0;
+  for (const char *f = format; *f; f++)
+  {
+    if (*f == '%' && f[1] && f[1] != '%')
+    {
+      f += f[1] >= '1' && f[1] <= '9' ? 2 : 1;
+      d += *f == 'd';
+      str += *f == 's';
+    }
+    else if (*f == '%')
+      f++;
+  }
+  if (d == 1)
+  {
+    static const int extremes[] = {INT_MIN, INT_MIN + 1, -1000000, -99999, -10, -9, -1, 0, 1, 9, 10, 99, 100,
+                                   999, 1000, 65535, 99999, 100000, 123456789, INT_MAX};
+    for (int v : extremes)
+      compare(format, v);
+    for (int v = -1000; v <= 10000; v++)
+      compare(format, v);
+  }
+  else if (str == 1)
+  {
+    for (const char *t : texts)
+      compare(format, t);
+  }
+  else if (str == 2)
+  {
+    for (const char *t : texts)
+      for (const char *u : texts)
+        compare(format, t, u);
+  }
+  else
+    compare(format);
+}
+
+void test_same_as_snprintf(void)
+{
+  for (const char *format : firmwareFormats)
+    compare_values(format);
+  for (const paramDesc_t &p : params)
+  {
+    if (p.format)
+      compare_values(p.format);
+  }
+  static const char *const widths[] = {"%1d", "%2d", "%3d", "%4d", "%5d", "%6d", "%7d", "%8d", "%9d", "%d",
+                                       "%1s", "%4s", "%8s", "%9s", "%%%d%%", "%%"};
+  for (const char *format : widths)
+    compare_values(format);
+}
+
+// intensity screen refreshed with a wandering value: dot register bits per refresh and the
+// most one loop() pass shifts out, against printing all characters every refresh
+void test_display_bits_per_loop(void)
+{
+  const unsigned long glyph = displayLength * 5 * 8;
+  unsigned long total = 0, maxPass = 0, passes = 0;
+  uint32_t noise = 1;
+  int value = 50;
+  displayPrint("Int %3d%%", value);
+  displayFlush();
+
+  const int refreshes = 1000;
+  for (int r = 0; r < refreshes; r++)
+  {
+    noise = noise * 1664525 + 1013904223;
+    value = constrain(value + (int)(noise >> 30) - 1, 0, 100);
+    displayPrint("Int %3d%%", value);
+    for (int n = 0; n < displayLength; n++) // loop() passes until the frame is shown
+    {
+      unsigned long bits = myDisplay.bits;
+      checkDisplay();
+      bits = myDisplay.bits - bits;
+      total += bits;
+      if (bits > maxPass)
+        maxPass = bits;
+      passes += bits > 0;
+    }
+  }
+  char line[160];
+  snprintf(line, sizeof(line), "bits per refresh %.0f (all characters %lu), per loop pass max %lu (%lu), %lu passes with a write",
+           (double)total / refreshes, displayLength * glyph, maxPass, displayLength * glyph, passes);
+  TEST_MESSAGE(line);
+
+  TEST_ASSERT_EQUAL(glyph, maxPass);
+  TEST_ASSERT_TRUE(total * 4 < refreshes * displayLength * glyph);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_text_and_percent);
+  RUN_TEST(test_width_and_sign);
+  RUN_TEST(test_string);
+  RUN_TEST(test_truncated_to_display);
+  RUN_TEST(test_same_as_snprintf);
+  RUN_TEST(test_one_changed_glyph_per_call);
+  RUN_TEST(test_display_bits_per_loop);
+  return UNITY_END();
+}
@@ -0,0 +1,211 @@
+// config journal: commits survive a restart, replay rebuilds the newest values
+#include <unity.h>
+#include <firmware.h>
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// restart: RAM state rebuilt from the EEPROM alone, true if all WORDs read back the same
+static bool restart_keeps_values(void)
+{
+  unsigned int before[JOURNAL_KEYS];
+  for (int key = 0; key < JOURNAL_KEYS; key++)
+    before[key] = eeprom_readInt(key * 2);
+
+  memset(journalValue, 0, sizeof(journalValue));
+  journal_replay();
+
+  for (int key = 0; key < JOURNAL_KEYS; key++)
+  {
+    if (eeprom_readInt(key * 2) != before[key])
+      return false;
+  }
+  return true;
+}
+
+void test_defaults_after_first_start(void)
+{
+  TEST_ASSERT_EQUAL(MODEL_TYPE, eeprom_readInt(EE_ADDR_MODEL_TYPE));
+  TEST_ASSERT_EQUAL(FW_VERSION, eeprom_readInt(EE_ADDR_FW_VERSION));
+  TEST_ASSERT_EQUAL(DEFAULT_GAIN_SET1, eeprom_readInt(param_addr(&params[PARAM_RECIPE_GAIN], 0)));
+  TEST_ASSERT_EQUAL(DEFAULT_GAIN_SET2, eeprom_readInt(param_addr(&params[PARAM_RECIPE_GAIN], 1)));
+  TEST_ASSERT_EQUAL(0, eeCachePending);
+  TEST_ASSERT_TRUE(restart_keeps_values());
+}
+
+void test_pending_until_commit(void)
+{
+  eeprom_writeInt(EE_ADDR_position_offset, 321);
+  TEST_ASSERT_EQUAL(1, eeCachePending);
+  TEST_ASSERT_EQUAL(321, eeprom_readInt(EE_ADDR_position_offset)); // cache
+
+  eeprom_writeInt(EE_ADDR_position_offset, 322); // same WORD, still one record
+  TEST_ASSERT_EQUAL(1, eeCachePending);
+
+  eeprom_commit();
+  TEST_ASSERT_EQUAL(0, eeCachePending);
+  TEST_ASSERT_TRUE(restart_keeps_values());
+  TEST_ASSERT_EQUAL(322, eeprom_readInt(EE_ADDR_position_offset));
+}
+
+void test_unchanged_value_not_written(void)
+{
+  unsigned long writes = EEPROM.writes;
+  eeprom_writeInt(EE_ADDR_position_offset, eeprom_readInt(EE_ADDR_position_offset));
+  checkEEPROM();
+  eeprom_commit();
+  TEST_ASSERT_EQUAL(0, eeCachePending);
+  TEST_ASSERT_EQUAL(writes, EEPROM.writes);
+}
+
+// many commits wrap the ring several times, the replay finds the newest of every WORD
+void test_replay_after_wrap(void)
+{
+  for (int n = 0; n < 5 * JOURNAL_RECORDS; n++)
+  {
+    eeprom_writeInt(EE_ADDR_total_runtime, n);
+    if (n % 7 == 0)
+      eeprom_writeInt(param_addr(&params[PARAM_RECIPE_THRESHOLD], n % RECIPE_COUNT), 20 + n % 61);
+    eeprom_commit();
+  }
+  TEST_ASSERT_TRUE(restart_keeps_values());
+  TEST_ASSERT_EQUAL(5 * JOURNAL_RECORDS - 1, eeprom_readInt(EE_ADDR_total_runtime));
+  TEST_ASSERT_EQUAL(MODEL_TYPE, eeprom_readInt(EE_ADDR_MODEL_TYPE));
+  TEST_ASSERT_EQUAL(322, eeprom_readInt(EE_ADDR_position_offset));
+}
+
+// a record with a broken CRC is skipped, the previous commit of its WORD stays in effect
+void test_corrupted_record_ignored(void)
+{
+  eeprom_writeInt(EE_ADDR_position_offset, 400);
+  eeprom_commit();
+  int slot = journalSlot[EE_ADDR_position_offset / 2];
+  EEPROM.data[JOURNAL_START + slot * sizeof(journalRecord_t) + 4] ^= 0x01; // value bit
+
+  journal_replay();
+  TEST_ASSERT_EQUAL(322, eeprom_readInt(EE_ADDR_position_offset));
+}
+
+static uint32_t rng = 1;
+static int random_below(int n)
+{
+  rng = rng * 1664525 + 1013904223;
+  return (rng >> 8) % n;
+}
+
+// WORDs of the recipe slots, free to change here
+static unsigned int random_address()
+{
+  return EE_ADDR_recipe + random_below(RECIPE_COUNT * RECIPE_WORDS) * 2;
+}
+
+// journal records written by one commit (its WORDs, carried WORDs, markers)
+static int commit_records()
+{
+  int head = journalHead;
+  eeprom_commit();
+  return (journalHead - head + JOURNAL_RECORDS) % JOURNAL_RECORDS;
+}
+
+// setting changes one at a time: the changed WORD, the marker and a few old WORDs moved along,
+// never a burst rewriting the journal
+void test_write_counts(void)
+{
+  const int commits = 2000;
+  int total = 0, most = 0;
+  for (int n = 0; n < commits; n++)
+  {
+    eeprom_writeInt(EE_ADDR_total_runtime, n);
+    int records = commit_records();
+    total += records;
+    most = max(most, records);
+  }
+  char line[96];
+  snprintf(line, sizeof(line), "single WORD commits: %.2f records average, %d most", (double)total / commits, most);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_TRUE(most <= 2 + JOURNAL_CARRY * 2);
+  TEST_ASSERT_TRUE(total < commits * 5);
+  TEST_ASSERT_TRUE(restart_keeps_values());
+}
+
+// power cut after every possible number of bytes of commits of 1 - 8 WORDs and of all
+// recipe WORDs: after the restart every commit is either complete or not there at all
+void test_power_loss(void)
+{
+  unsigned int before[JOURNAL_KEYS], after[JOURNAL_KEYS];
+  int cuts = 0;
+  for (int round = 0; round < 300; round++)
+  {
+    int words = round % 10 == 9 ? RECIPE_COUNT * RECIPE_WORDS : 1 + random_below(8);
+    for (int key = 0; key < JOURNAL_KEYS; key++)
+      before[key] = eeprom_readInt(key * 2);
+    for (int w = 0; w < words; w++)
+    {
+      unsigned int address = words > 8 ? EE_ADDR_recipe + w * 2 : random_address();
+      eeprom_writeInt(address, random_below(10000));
+    }
+    for (int key = 0; key < JOURNAL_KEYS; key++)
+      after[key] = eeprom_readInt(key * 2);
+
+    // bytes the commit writes, then the same commit again from the same state with the power cut
+    EEPROMClass saved = EEPROM;
+    unsigned long writes = EEPROM.writes;
+    eeprom_commit();
+    long bytes = EEPROM.writes - writes;
+    EEPROM = saved;
+    journal_replay();
+    for (int key = 0; key < JOURNAL_KEYS; key++)
+    {
+      if (after[key] != before[key])
+      {
+        eeCacheDirty[key] = true;
+        eeCacheValue[key] = after[key];
+        eeCachePending++;
+      }
+    }
+
+    long budget = random_below(bytes + 1);
+    EEPROM.powerBudget = budget;
+    bool torn = false;
+    try
+    {
+      eeprom_commit();
+    }
+    catch (shimPowerLoss &)
+    {
+      torn = true;
+      cuts++;
+    }
+    EEPROM.powerBudget = -1;
+
+    // restart
+    memset(eeCacheDirty, 0, sizeof(eeCacheDirty));
+    eeCachePending = 0;
+    journal_replay();
+
+    bool old = true, complete = true;
+    for (int key = 0; key < JOURNAL_KEYS; key++)
+    {
+      old = old && eeprom_readInt(key * 2) == before[key];
+      complete = complete && eeprom_readInt(key * 2) == after[key];
+    }
+    char msg[96];
+    snprintf(msg, sizeof(msg), "round %d, %d WORDs, power cut after %ld of %ld bytes", round, words, budget, bytes);
+    TEST_ASSERT_TRUE_MESSAGE(complete || (torn && old), msg);
+  }
+  TEST_ASSERT_TRUE(cuts > 250);
+}
+
+int main(int argc, char **argv)
+{
+  setup();
+  UNITY_BEGIN();
+  RUN_TEST(test_defaults_after_first_start);
+  RUN_TEST(test_pending_until_commit);
+  RUN_TEST(test_unchanged_value_not_written);
+  RUN_TEST(test_replay_after_wrap);
+  RUN_TEST(test_corrupted_record_ignored);
+  RUN_TEST(test_write_counts);
+  RUN_TEST(test_power_loss);
+  return UNITY_END();
+}
@@ -0,0 +1,153 @@
+// SimpleModbusSlave with the register map of the firmware
+#include <unity.h>
+#include <firmware.h>
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_read_identification(void)
+{
+  std::vector<uint16_t> r = modbus_read(ENUM_SIZE, 4);
+  TEST_ASSERT_EQUAL(4, r.size());
+  TEST_ASSERT_EQUAL(TOTAL_REGS_SIZE, r[0]);
+  TEST_ASSERT_EQUAL(MODEL_TYPE, r[1]);
+  TEST_ASSERT_EQUAL(MODEL_SERIAL_NUMBER, r[2]);
+  TEST_ASSERT_EQUAL(FW_VERSION, r[3]);
+}
+
+void test_write_parameter(void)
+{
+  TEST_ASSERT_TRUE(modbus_write(THRESHOLD_SET1, {60}));
+  TEST_ASSERT_EQUAL(60, recipes[recipeSet1 - 1].thre);
+  TEST_ASSERT_EQUAL(60, modbus_read(THRESHOLD_SET1, 1)[0]);
+
+  TEST_ASSERT_TRUE(modbus_write(THRESHOLD_SET1, {99})); // out of range, acknowledged but ignored
+  TEST_ASSERT_EQUAL(60, recipes[recipeSet1 - 1].thre);
+}
+
+void test_recipe_edit_slots(void)
+{
+  for (int slot = 0; slot < RECIPE_COUNT; slot++)
+  {
+    TEST_ASSERT_TRUE(modbus_write(RECIPE_EDIT, {(uint16_t)(slot + 1)}));
+    TEST_ASSERT_TRUE(modbus_write(RECIPE_GAIN, {(uint16_t)gainList[slot % 7]}));
+    TEST_ASSERT_TRUE(modbus_write(RECIPE_FILTER_OFF, {(uint16_t)(100 + slot)}));
+  }
+  for (int slot = 0; slot < RECIPE_COUNT; slot++)
+  {
+    TEST_ASSERT_EQUAL(gainList[slot % 7], recipes[slot].pga);
+    TEST_ASSERT_EQUAL(100 + slot, recipes[slot].filterOff);
+    TEST_ASSERT_TRUE(modbus_write(RECIPE_EDIT, {(uint16_t)(slot + 1)}));
+    TEST_ASSERT_EQUAL(100 + slot, modbus_read(RECIPE_FILTER_OFF, 1)[0]);
+  }
+}
+
+// window, mode and filter registers address the slot of set 1, whatever SET_IN selects
+void test_window_in_set1(void)
+{
+  int other = recipes[recipeSet2 - 1].windowBegin;
+  setInput = 1;
+  TEST_ASSERT_TRUE(modbus_write(WINDOW_BEGIN, {20}));
+  setInput = 0;
+  TEST_ASSERT_EQUAL(20, recipes[recipeSet1 - 1].windowBegin);
+  TEST_ASSERT_EQUAL(other, recipes[recipeSet2 - 1].windowBegin);
+}
+
+// the menu saves to the slot it was entered with, RECIPE_SET1 written meanwhile
+void test_menu_keeps_slot(void)
+{
+  int slot = recipeSet1 - 1;
+  recipes[slot].windowBegin = 10;
+  currentMenuOption = 0;
+  lastKey = BTN_D;
+  showParamGroup(3); // MENU_ANALOG, wBeg
+  TEST_ASSERT_EQUAL(PARAM_WINDOW_BEGIN, menuParam);
+
+  TEST_ASSERT_TRUE(modbus_write(RECIPE_SET1, {(uint16_t)(slot == 2 ? 4 : 3)}));
+  int moved = recipes[recipeSet1 - 1].windowBegin;
+  lastKey = BTN_C;
+  setParamMenu();
+  lastKey = BTN_D;
+  setParamMenu();
+  lastKey = BTN_NONE;
+
+  TEST_ASSERT_EQUAL(15, recipes[slot].windowBegin);
+  TEST_ASSERT_EQUAL(moved, recipes[recipeSet1 - 1].windowBegin);
+  TEST_ASSERT_TRUE(modbus_write(RECIPE_SET1, {(uint16_t)(slot + 1)}));
+}
+
+// largest FC16 request (123 registers, 255 bytes) received in one burst, more than the
+// 64 bytes of the Serial1 ring of the core
+void test_largest_frame(void)
+{
+  TEST_ASSERT_TRUE(modbus_write(TRACE, std::vector<uint16_t>(123, 0))); // read only, ignored
+  TEST_ASSERT_TRUE(modbus_write(THRESHOLD_SET1, {60}));
+}
+
+void test_exceptions(void)
+{
+  std::vector<uint8_t> r = modbus_request(modbus_frame({(uint8_t)modbusID, 3, (uint8_t)(TOTAL_REGS_SIZE >> 8), (uint8_t)TOTAL_REGS_SIZE, 0, 1}));
+  TEST_ASSERT_EQUAL(5, r.size());
+  TEST_ASSERT_EQUAL(0x83, r[1]);
+  TEST_ASSERT_EQUAL(2, r[2]); // ILLEGAL DATA ADDRESS
+
+  r = modbus_request(modbus_frame({(uint8_t)modbusID, 5, 0, 0, 0, 1}));
+  TEST_ASSERT_EQUAL(0x85, r[1]);
+  TEST_ASSERT_EQUAL(1, r[2]); // ILLEGAL FUNCTION
+
+  std::vector<uint8_t> bad = modbus_frame({(uint8_t)modbusID, 3, 0, 0, 0, 1});
+  bad.back() ^= 1;
+  uint16_t errors = holdingRegs[TOTAL_ERRORS];
+  TEST_ASSERT_EQUAL(0, modbus_request(bad).size()); // no response to a corrupted frame
+  TEST_ASSERT_EQUAL(errors + 1, holdingRegs[TOTAL_ERRORS]);
+}
+
+// measurement registers of one request come from the same scan
+void test_measurement_snapshot(void)
+{
+  int samples[ANALOG_BUFFER_SIZE] = {0};
+  for (int i = 120; i < ANALOG_BUFFER_SIZE; i++)
+    samples[i] = 255;
+  for (int n = 0; n < 3; n++)
+    scan_run(samples);
+
+  std::vector<uint16_t> r = modbus_read(PEAK_VALUE, 3);
+  TEST_ASSERT_EQUAL(100, r[0]);
+  TEST_ASSERT_EQUAL(600, r[1]);
+  std::vector<uint16_t> scan = modbus_read(MEAS_SCAN, 2);
+  TEST_ASSERT_EQUAL(scanCount, scan[0]);
+}
+
+// AN_VALUES: a read of any part of the block takes a new scan, the whole frame from the same one
+void test_an_values_recaptured(void)
+{
+  int samples[ANALOG_BUFFER_SIZE] = {0};
+  for (int level = 1; level <= 3; level++)
+  {
+    for (int i = 0; i < ANALOG_BUFFER_SIZE; i++)
+      samples[i] = level * 10 + (i & 4 ? 1 : 0);
+    for (int n = 0; n < 7; n++) // a full rotation, the selected facet comes by
+      scan_run(samples);
+
+    std::vector<uint16_t> r = modbus_read(AN_VALUES + 10, 5); // never the last register of the block
+    TEST_ASSERT_EQUAL(5, r.size());
+    for (uint16_t v : r)
+      TEST_ASSERT_EQUAL_HEX16((level * 10 + 1) << 8 | level * 10, v);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  setup();
+  UNITY_BEGIN();
+  RUN_TEST(test_read_identification);
+  RUN_TEST(test_write_parameter);
+  RUN_TEST(test_recipe_edit_slots);
+  RUN_TEST(test_window_in_set1);
+  RUN_TEST(test_menu_keeps_slot);
+  RUN_TEST(test_largest_frame);
+  RUN_TEST(test_exceptions);
+  RUN_TEST(test_measurement_snapshot);
+  RUN_TEST(test_an_values_recaptured);
+  return UNITY_END();
+}
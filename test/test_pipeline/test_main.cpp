@@ -0,0 +1,271 @@
+// processing chain fed by synthetic scans: updateResults(), signalFilter(), averaging,
+// predictPosition() and DAC mapping, accuracy and jitter per positionMode
+#include <unity.h>
+#include <firmware.h>
+#include <scan_generator.h>
+#include <chrono>
+
+#define WARMUP_SCANS 20
+
+struct pipelineStats_t
+{
+  int scans;
+  int present;        // scans with SIGNAL PRESENT
+  double bias;        // mean error of the output position against the edge when it is latched,
+                      // position units (0 - 1000 = 200 samples)
+  double jitter;      // standard deviation of the output position error
+  double rawJitter;   // standard deviation of the not averaged position
+  double scansPerSec; // host speed, the sensor does 1000
+};
+
+static int activeSlot() { return recipe_active(); }
+
+static void recipe_set(int positionMode, int filterPosition)
+{
+  volatile recipe_t *r = &recipes[activeSlot()];
+  r->positionMode = positionMode;
+  r->filterPosition = filterPosition;
+  r->windowBegin = 20;
+  r->windowEnd = 80;
+  checkSET(); // new config from the next scan
+}
+
+// position in units of the DAC output, 0 - 65535 over the window
+static double dac_position()
+{
+  const scanRecipe_t *rcp = &scanConfig->recipe[dataRecipe];
+  int dac = scanConfig->analogOutMode == 0 ? dacAN2 : dacAN1;
+  return rcp->positionBegin + (double)dac * (rcp->positionEnd - rcp->positionBegin) / 65535;
+}
+
+// the edge a mode measures, in position units
+static double truth(const scanGenerator_t *g, int positionMode)
+{
+  return (positionMode == 2 ? g->fallingEdge : g->risingEdge) * 5;
+}
+
+static pipelineStats_t pipeline_run(scanGenerator_t *g, int positionMode, int scans)
+{
+  int samples[ANALOG_BUFFER_SIZE];
+  double sum = 0, sum2 = 0, rawSum = 0, rawSum2 = 0;
+  double lastTruth = 0;
+  pipelineStats_t s = {scans, 0, 0, 0, 0, 0};
+
+  auto t0 = std::chrono::steady_clock::now();
+  for (int n = 0; n < scans + WARMUP_SCANS; n++)
+  {
+    scanGenerator_next(g, samples, ANALOG_BUFFER_SIZE);
+    double t = truth(g, positionMode);
+    scan_run(samples); // outputs of the previous scan, latched OUTPUT_DELAY after this one started
+    lastTruth += g->velocity * 5 * (1000 + scanConfig->outputDelay) / 1000;
+    if (n >= WARMUP_SCANS && signalPresent)
+    {
+      double e = dac_position() - lastTruth;
+      double raw = positionValueDisp - lastTruth;
+      s.present++;
+      sum += e;
+      sum2 += e * e;
+      rawSum += raw;
+      rawSum2 += raw * raw;
+    }
+    lastTruth = t;
+  }
+  auto t1 = std::chrono::steady_clock::now();
+
+  if (s.present)
+  {
+    s.bias = sum / s.present;
+    s.jitter = sqrt(fmax(0, sum2 / s.present - s.bias * s.bias));
+    double rawBias = rawSum / s.present;
+    s.rawJitter = sqrt(fmax(0, rawSum2 / s.present - rawBias * rawBias));
+  }
+  s.scansPerSec = (scans + WARMUP_SCANS) / std::chrono::duration<double>(t1 - t0).count();
+  return s;
+}
+
+static void report(const char *name, const pipelineStats_t &s)
+{
+  char line[160];
+  snprintf(line, sizeof(line), "%-14s present %5.1f %%  bias %6.2f  jitter %5.2f  raw jitter %5.2f  (units 0-1000)  %.0fx real time",
+           name, 100.0 * s.present / s.scans, s.bias, s.jitter, s.rawJitter, s.scansPerSec / 1000);
+  TEST_MESSAGE(line);
+}
+
+void setUp(void)
+{
+  positionPredict = 0;
+  for (int slot = 0; slot < RECIPE_COUNT; slot++)
+  {
+    recipes[slot].filterOn = 0;
+    recipes[slot].filterOff = 0;
+  }
+  intTest = false;
+  extTest = false;
+}
+
+void tearDown(void) {}
+
+// static edge in the window, averaged over 6 facets
+void test_accuracy_per_mode(void)
+{
+  static const char *names[] = {"HMD", "RISE", "FALL", "PEAK"};
+  static const double maxBias[] = {5, 5, 5, 15};
+  static const double maxJitter[] = {3, 3, 3, 10};
+
+  for (int mode = 0; mode < 4; mode++)
+  {
+    scanGenerator_t g;
+    g.edge = 70;
+    g.width = 40;
+    recipe_set(mode, 6);
+    pipelineStats_t s = pipeline_run(&g, mode, 3000);
+    report(names[mode], s);
+
+    TEST_ASSERT_EQUAL(s.scans, s.present);
+    TEST_ASSERT_FLOAT_WITHIN(maxBias[mode], 0, s.bias);
+    TEST_ASSERT_TRUE(s.jitter <= maxJitter[mode]);
+    TEST_ASSERT_TRUE(s.scansPerSec > 1000); // faster than the sensor
+  }
+}
+
+// the moving average trades jitter for lag
+void test_averaging_reduces_jitter(void)
+{
+  scanGenerator_t g;
+  g.noise = 12;
+  g.slope = 8;
+
+  recipe_set(1, 0);
+  pipelineStats_t raw = pipeline_run(&g, 1, 3000);
+  report("RISE noisy", raw);
+  recipe_set(1, 12);
+  pipelineStats_t avg = pipeline_run(&g, 1, 3000);
+  report("RISE noisy f12", avg);
+
+  TEST_ASSERT_TRUE(avg.jitter < raw.jitter / 2);
+}
+
+// saturated signal: intensity 100 %, edge still found
+void test_saturation(void)
+{
+  scanGenerator_t g;
+  g.intensity = 400;
+  recipe_set(1, 0);
+  pipelineStats_t s = pipeline_run(&g, 1, 200);
+  report("RISE saturated", s);
+
+  TEST_ASSERT_EQUAL(100, peakValueDisp);
+  TEST_ASSERT_EQUAL(255 * 257, dacAN1);
+  TEST_ASSERT_FLOAT_WITHIN(5, 0, s.bias);
+}
+
+// single scan dropouts (scale, steam) are bridged by the SIGNAL PRESENT off delay,
+// the position output drops towards 0 during a bridged dropout (no edge, see jitter)
+void test_dropouts_bridged_by_off_delay(void)
+{
+  scanGenerator_t g;
+  g.dropout = 0.05;
+  g.dropoutDepth = 0.9;
+
+  recipe_set(1, 0);
+  pipelineStats_t s = pipeline_run(&g, 1, 2000);
+  report("dropouts", s);
+  TEST_ASSERT_LESS_THAN(s.scans, s.present); // output follows the dropouts
+
+  recipes[activeSlot()].filterOff = 2; // ms
+  checkSET();
+  s = pipeline_run(&g, 1, 2000);
+  report("dropouts fOff2", s);
+  TEST_ASSERT_EQUAL(s.scans, s.present);
+}
+
+// edge moving 0.5 samples per scan across the facets (2500 units/s): the average lags
+// behind, the predictor compensates the pipeline latency
+void test_moving_edge(void)
+{
+  scanGenerator_t g;
+  g.edge = 45;
+  g.facetSpread = 0.3;
+  recipe_set(1, 6);
+  pipelineStats_t still = pipeline_run(&g, 1, 150);
+  report("still", still);
+
+  g = scanGenerator_t();
+  g.edge = 45;
+  g.facetSpread = 0.3;
+  g.velocity = 0.5;
+  pipelineStats_t lag = pipeline_run(&g, 1, 150);
+  report("moving", lag);
+
+  g = scanGenerator_t();
+  g.edge = 45;
+  g.facetSpread = 0.3;
+  g.velocity = 0.5;
+  positionPredict = 1;
+  recipe_set(1, 6);
+  pipelineStats_t predicted = pipeline_run(&g, 1, 150);
+  report("moving predict", predicted);
+
+  TEST_ASSERT_TRUE(lag.bias < still.bias - 10); // 6 facets average, ~6.3 scans behind
+  TEST_ASSERT_FLOAT_WITHIN(3, still.bias, predicted.bias);
+}
+
+// slower edge behind a longer average, the lead grows with the filter
+static pipelineStats_t slow_run(double velocity, int predict)
+{
+  scanGenerator_t g;
+  g.edge = 40;
+  g.facetSpread = 0.3;
+  g.velocity = velocity;
+  positionPredict = predict;
+  recipe_set(1, 30);
+  pipeline_run(&g, 1, 100); // the average settles in ~3 periods
+  return pipeline_run(&g, 1, 300);
+}
+
+void test_moving_edge_long_filter(void)
+{
+  pipelineStats_t still = slow_run(0, 0);
+  report("still f30", still);
+  pipelineStats_t lag = slow_run(0.1, 0);
+  report("slow f30", lag);
+  pipelineStats_t predicted = slow_run(0.1, 1);
+  report("slow predict f30", predicted);
+
+  TEST_ASSERT_TRUE(lag.bias < still.bias - 10); // 30 facets average, ~30 scans behind
+  TEST_ASSERT_FLOAT_WITHIN(3, still.bias, predicted.bias);
+}
+
+// lead in scans * 256 over the whole filterPosition range, 32 bit on the sensor
+void test_predict_lead_range(void)
+{
+  static const int filters[] = {0, 1, 2, 6, 100, 8388, 8389, 9999};
+  long last = 0;
+  for (int f : filters)
+  {
+    recipe_set(1, f);
+    config_build();
+    const scanRecipe_t *rcp = &scanConfigPending->recipe[activeSlot()];
+    int64_t expected = ((int64_t)(f > 1 ? f - 1 : 0) * 1000 + 1000 + scanConfigPending->outputDelay) * 256 / 1000;
+    TEST_ASSERT_TRUE(expected <= INT32_MAX);
+    TEST_ASSERT_EQUAL_INT64(expected, (int32_t)rcp->predictLead);
+    TEST_ASSERT_TRUE(rcp->predictLead >= last);
+    last = rcp->predictLead;
+  }
+  scanConfig = scanConfigPending;
+  scanConfigPending = NULL;
+}
+
+int main(int argc, char **argv)
+{
+  setup();
+  UNITY_BEGIN();
+  RUN_TEST(test_accuracy_per_mode);
+  RUN_TEST(test_averaging_reduces_jitter);
+  RUN_TEST(test_saturation);
+  RUN_TEST(test_dropouts_bridged_by_off_delay);
+  RUN_TEST(test_moving_edge);
+  RUN_TEST(test_moving_edge_long_filter);
+  RUN_TEST(test_predict_lead_range);
+  return UNITY_END();
+}
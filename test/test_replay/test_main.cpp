@@ -0,0 +1,282 @@
+// recorded scan traces replayed through updateResults(), every change of the detection path
+// must reproduce the outputs in test/golden/scans.csv within the tolerance declared there
+// GOLDEN_RECORD=1 records the corpus again from synthetic scans through the TRACE registers
+#include <unity.h>
+#include <firmware.h>
+#include <scan_generator.h>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// trace file: scans back to back, TRACE_SIZE registers each as read by FC3 (high byte first)
+#define TRACE_BYTES (TRACE_SIZE * 2)
+#define GOLDEN_COLUMNS 4 // facet, peak value, position value, position value averaged
+
+struct traceFile_t
+{
+  const uint8_t *data;
+  size_t size;
+};
+
+static std::string goldenDir;
+
+// test/golden from the project root (pio test) or from the test folder
+static std::string golden_find()
+{
+  const char *env = getenv("GOLDEN_DIR");
+  if (env)
+    return env;
+  struct stat st;
+  if (!stat("test/golden", &st))
+    return "test/golden";
+  if (!stat("../golden", &st))
+    return "../golden";
+  std::string file = __FILE__;
+  return file.substr(0, file.find_last_of('/') + 1) + "../golden";
+}
+
+static bool trace_map(traceFile_t *f, const std::string &path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  fstat(fd, &st);
+  f->size = st.st_size;
+  f->data = (const uint8_t *)mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // the mapping stays
+  return f->data != MAP_FAILED;
+}
+
+static void trace_unmap(traceFile_t *f)
+{
+  munmap((void *)f->data, f->size);
+}
+
+static uint16_t trace_word(const uint8_t *record, int n)
+{
+  return record[n * 2] << 8 | record[n * 2 + 1];
+}
+
+// header and CRC of one record
+static bool trace_valid(const uint8_t *record)
+{
+  uint16_t crc = 0xFFFF;
+  for (int n = 0; n < (TRACE_SIZE - 1) * 2; n++)
+    crc = crc16_update(crc, record[n]);
+  return trace_word(record, 0) == TRACE_VERSION && trace_word(record, 1) == MODEL_TYPE &&
+         trace_word(record, 8) == ANALOG_BUFFER_SIZE && trace_word(record, TRACE_SIZE - 1) == crc;
+}
+
+// process one recorded scan with the settings of its header, filters off so every scan stands alone
+static void trace_replay(const uint8_t *record, measurement_t *m)
+{
+  int slot = trace_word(record, 9) - 1;
+  volatile recipe_t *r = &recipes[slot];
+  r->pga = trace_word(record, 2);
+  r->thre = trace_word(record, 3);
+  r->windowBegin = trace_word(record, 4);
+  r->windowEnd = trace_word(record, 5);
+  r->positionMode = trace_word(record, 6);
+  r->filterPosition = 0;
+  r->filterOn = 0;
+  r->filterOff = 0;
+  if (!config_isCurrent(scanConfigPending ? scanConfigPending : scanConfig))
+    config_build();
+  if (scanConfigPending)
+  {
+    scanConfig = scanConfigPending;
+    scanConfigPending = NULL;
+  }
+
+  dataRecipe = slot;
+  dataPga = trace_word(record, 2);
+  dataFacet = trace_word(record, 10);
+  dataStartTime = (unsigned long)trace_word(record, 11) << 16 | trace_word(record, 12);
+  for (int i = 0; i < ANALOG_BUFFER_SIZE; i++)
+    adc_data[i] = trace_word(record, TRACE_HEADER + i);
+
+  updateResults();
+  measurement_read(m);
+}
+
+// same start for recording and replay, signalDetected holds the hysteresis between scans
+static void replay_reset()
+{
+  signalDetected = false;
+  signalPresent = false;
+  positionPredict = 0;
+  intTest = false;
+  extTest = false;
+  for (int slot = 0; slot < RECIPE_COUNT; slot++)
+  {
+    recipes[slot].filterPosition = 0;
+    recipes[slot].filterOn = 0;
+    recipes[slot].filterOff = 0;
+  }
+  checkSET();
+}
+
+// TRACE registers of the previous scan, armed before it is processed
+static std::vector<uint16_t> trace_read()
+{
+  std::vector<uint16_t> trace = modbus_read(TRACE, TRACE_SIZE / 2);
+  std::vector<uint16_t> rest = modbus_read(TRACE + TRACE_SIZE / 2, TRACE_SIZE - TRACE_SIZE / 2);
+  trace.insert(trace.end(), rest.begin(), rest.end());
+  return trace;
+}
+
+// corpus: every position mode with a clean, noisy, saturated, window edge and missing object
+static void golden_record()
+{
+  FILE *traces = fopen((goldenDir + "/scans.trace").c_str(), "wb");
+  FILE *csv = fopen((goldenDir + "/scans.csv").c_str(), "w");
+  TEST_ASSERT_NOT_NULL(traces);
+  TEST_ASSERT_NOT_NULL(csv);
+  fprintf(csv, "# expected outputs of scans.trace, one line per scan, GOLDEN_RECORD=1 in test_replay\n");
+  fprintf(csv, "# facet,peak,position,position avg\n");
+  fprintf(csv, "tolerance,0,0,0,0\n");
+
+  replay_reset();
+  int samples[ANALOG_BUFFER_SIZE];
+  for (int mode = 0; mode < 4; mode++)
+  {
+    for (int scenario = 0; scenario < 5; scenario++)
+    {
+      scanGenerator_t g;
+      g.seed = mode * 16 + scenario + 1;
+      g.edge = 70;
+      g.width = 40;
+      g.facetSpread = 0.5;
+      if (scenario == 1)
+        g.noise = 12;
+      if (scenario == 2)
+        g.intensity = 400;
+      if (scenario == 3)
+        g.edge = 22;
+      if (scenario == 4)
+        g.intensity = 30;
+
+      recipes[recipe_active()].positionMode = mode;
+      recipes[recipe_active()].pga = 1 << scenario;
+      checkSET();
+      scanGenerator_next(&g, samples, ANALOG_BUFFER_SIZE);
+      scan_run(samples);
+      for (int n = 0; n < 3; n++)
+      {
+        TEST_ASSERT_TRUE(modbus_write(TRACE_CONTROL, {1}));
+        scanGenerator_next(&g, samples, ANALOG_BUFFER_SIZE);
+        scan_run(samples); // processes and captures the previous scan
+        std::vector<uint16_t> trace = trace_read();
+        std::vector<uint16_t> meas = modbus_read(PEAK_VALUE, 3);
+        TEST_ASSERT_EQUAL(TRACE_SIZE, trace.size());
+        for (uint16_t w : trace)
+        {
+          fputc(w >> 8, traces);
+          fputc(w & 0xFF, traces);
+        }
+        fprintf(csv, "%d,%d,%d,%d\n", modbus_read(MEAS_FACET, 1)[0], meas[0], meas[1], meas[2]);
+      }
+    }
+  }
+  fclose(traces);
+  fclose(csv);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// the header carries the gain the scan was acquired with, not the one of the next config
+void test_trace_records_acquisition_gain(void)
+{
+  int samples[ANALOG_BUFFER_SIZE];
+  scanGenerator_t g;
+  replay_reset();
+
+  recipes[recipe_active()].pga = 4;
+  checkSET();
+  scanGenerator_next(&g, samples, ANALOG_BUFFER_SIZE);
+  scan_run(samples); // acquired with gain 4
+  recipes[recipe_active()].pga = 8;
+  checkSET();
+  TEST_ASSERT_TRUE(modbus_write(TRACE_CONTROL, {1}));
+  scanGenerator_next(&g, samples, ANALOG_BUFFER_SIZE);
+  scan_run(samples); // gain 8 from here, the scan with gain 4 is processed and captured
+
+  std::vector<uint16_t> trace = trace_read();
+  TEST_ASSERT_EQUAL(TRACE_SIZE, trace.size());
+  TEST_ASSERT_EQUAL(4, trace[2]);
+  TEST_ASSERT_EQUAL(8, adc->adc0->pga);
+}
+
+void test_corrupted_trace_rejected(void)
+{
+  traceFile_t f;
+  TEST_ASSERT_TRUE(trace_map(&f, goldenDir + "/scans.trace"));
+  uint8_t record[TRACE_BYTES];
+  memcpy(record, f.data, TRACE_BYTES);
+  trace_unmap(&f);
+
+  TEST_ASSERT_TRUE(trace_valid(record));
+  record[TRACE_HEADER * 2 + 101] ^= 0x10; // one sample bit
+  TEST_ASSERT_FALSE(trace_valid(record));
+}
+
+// replay of the corpus reproduces the outputs of the run it was recorded in
+void test_golden_traces(void)
+{
+  traceFile_t f;
+  TEST_ASSERT_TRUE_MESSAGE(trace_map(&f, goldenDir + "/scans.trace"), "test/golden/scans.trace");
+  FILE *csv = fopen((goldenDir + "/scans.csv").c_str(), "r");
+  TEST_ASSERT_NOT_NULL(csv);
+  TEST_ASSERT_EQUAL(0, f.size % TRACE_BYTES);
+
+  char line[128];
+  int tolerance[GOLDEN_COLUMNS] = {0};
+  int scans = 0;
+  replay_reset();
+  while (fgets(line, sizeof(line), csv))
+  {
+    int expected[GOLDEN_COLUMNS];
+    if (line[0] == '#')
+      continue;
+    if (sscanf(line, "tolerance,%d,%d,%d,%d", &tolerance[0], &tolerance[1], &tolerance[2], &tolerance[3]) == GOLDEN_COLUMNS)
+      continue;
+    TEST_ASSERT_EQUAL(GOLDEN_COLUMNS, sscanf(line, "%d,%d,%d,%d", &expected[0], &expected[1], &expected[2], &expected[3]));
+    TEST_ASSERT_TRUE((size_t)(scans + 1) * TRACE_BYTES <= f.size);
+
+    const uint8_t *record = f.data + (size_t)scans * TRACE_BYTES;
+    TEST_ASSERT_TRUE(trace_valid(record));
+    measurement_t m;
+    trace_replay(record, &m);
+    int actual[GOLDEN_COLUMNS] = {m.facet, m.peakValue, m.positionValue, m.positionValueAvg};
+    for (int c = 0; c < GOLDEN_COLUMNS; c++)
+    {
+      char msg[64];
+      snprintf(msg, sizeof(msg), "scan %d column %d", scans, c);
+      TEST_ASSERT_INT_WITHIN_MESSAGE(tolerance[c], expected[c], actual[c], msg);
+    }
+    scans++;
+  }
+  fclose(csv);
+  TEST_ASSERT_EQUAL(f.size / TRACE_BYTES, scans);
+  trace_unmap(&f);
+
+  snprintf(line, sizeof(line), "%d scans replayed", scans);
+  TEST_MESSAGE(line);
+}
+
+int main(int argc, char **argv)
+{
+  setup();
+  goldenDir = golden_find();
+  UNITY_BEGIN();
+  if (getenv("GOLDEN_RECORD"))
+    RUN_TEST(golden_record);
+  RUN_TEST(test_trace_records_acquisition_gain);
+  RUN_TEST(test_corrupted_trace_rejected);
+  RUN_TEST(test_golden_traces);
+  return UNITY_END();
+}
@@ -0,0 +1,86 @@
+// scaling precomputed in config_build() against the map() it replaced
+#include <unity.h>
+#include <firmware.h>
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static const scanRecipe_t *built(int slot)
+{
+  const scanConfig_t *c = scanConfigPending ? scanConfigPending : scanConfig;
+  return &c->recipe[slot];
+}
+
+void test_reciprocal_exact_for_all_windows(void)
+{
+  for (int begin = 5; begin <= 45; begin++)
+  {
+    for (int end = 55; end <= 95; end++)
+    {
+      recipes[0].windowBegin = begin;
+      recipes[0].windowEnd = end;
+      config_build();
+      const scanRecipe_t *rcp = built(0);
+      int span = rcp->positionEnd - rcp->positionBegin;
+
+      for (int x = 0; x <= span; x++)
+      {
+        TEST_ASSERT_EQUAL(map(x, 0, span, 0, 1000), ((uint64_t)(x * 1000) * rcp->positionRecip) >> RECIP_SHIFT);
+        TEST_ASSERT_EQUAL(map(x, 0, span, 0, 65535), ((uint64_t)(x * 65535) * rcp->positionRecip) >> RECIP_SHIFT);
+      }
+    }
+  }
+}
+
+// Teensyduino map() rounds when the input range is the larger one: x * 101 / 256
+void test_peak_scaling(void)
+{
+  for (int peak = 0; peak <= 255; peak++)
+  {
+    TEST_ASSERT_EQUAL(peak * (100 + 1) / (255 + 1), (peak * 101) >> 8);
+    TEST_ASSERT_EQUAL(map(peak, 0, 255, 0, 65535), peak * 257);
+  }
+}
+
+void test_moving_average(void)
+{
+  signalPresent = true;
+  sma = 0;
+  TEST_ASSERT_EQUAL(500, approxSimpleMovingAverage(500, 0)); // no filter
+  TEST_ASSERT_EQUAL(125, approxSimpleMovingAverage(500, 4));
+  TEST_ASSERT_EQUAL(218, approxSimpleMovingAverage(500, 4));
+  signalPresent = false;
+  TEST_ASSERT_EQUAL(0, approxSimpleMovingAverage(500, 4)); // cleared without signal
+}
+
+// rising edge at sample 100 = position 500 in the 20 - 80 % window, 12 mA on the position output
+void test_dac_outputs(void)
+{
+  int samples[ANALOG_BUFFER_SIZE] = {0};
+  for (int i = 100; i < ANALOG_BUFFER_SIZE; i++)
+    samples[i] = 200;
+
+  recipes[0].windowBegin = 20;
+  recipes[0].windowEnd = 80;
+  recipes[0].positionMode = 1;
+  recipes[0].filterPosition = 0;
+  checkSET();
+  for (int n = 0; n < 3; n++)
+    scan_run(samples);
+
+  TEST_ASSERT_TRUE(signalPresent);
+  TEST_ASSERT_EQUAL(500, positionValueDisp);
+  TEST_ASSERT_EQUAL(200 * 257, dacAN1);
+  TEST_ASSERT_EQUAL(map(500 - 200, 0, 600, 0, 65535), dacAN2);
+}
+
+int main(int argc, char **argv)
+{
+  setup();
+  UNITY_BEGIN();
+  RUN_TEST(test_reciprocal_exact_for_all_windows);
+  RUN_TEST(test_peak_scaling);
+  RUN_TEST(test_moving_average);
+  RUN_TEST(test_dac_outputs);
+  return UNITY_END();
+}
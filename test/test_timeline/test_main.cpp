@@ -0,0 +1,598 @@
+// discrete-event simulation of the interrupt timeline: the firmware handlers run in virtual
+// time with the NVIC priorities of the board and configurable execution costs, to measure
+// dropped facets, trigger jitter, output and ModBus latency at different ADC and baud rates
+// handlers change the firmware state when they start, their cost then keeps the CPU busy
+#include <unity.h>
+#include <firmware.h>
+#include <scan_generator.h>
+#include <queue>
+
+#define SIM_TIMERS 4       // IntervalTimers
+#define SIM_WARMUP 20000   // us before the counters start, motor lock
+#define SIM_TIMEOUT 200000 // us, ModBus master gives up
+
+// interrupt sources, same priority in IRQ number order
+enum
+{
+  SRC_PIT,                         // IntervalTimer, priority set by the firmware
+  SRC_HALL = SRC_PIT + SIM_TIMERS, // PORTD, motor_isr()
+  SRC_UART,                        // UART0 status, received bytes
+  SRC_DMA,                         // DMA channel 0, adc0_dma_isr()
+  SRC_SCAN,                        // FTM0 channel 0, callback_delay()
+  SRC_OUTPUT,                      // FTM0 channel 1, callback_output()
+  SRC_LOOP,                        // thread mode, loop()
+  SRC_MASTER,                      // ModBus master sends a request, no CPU time
+  SRC_COUNT
+};
+
+// execution time of the handlers in us, Teensy 3.2 at 96 MHz; estimates, CPU_USAGE
+// of a running sensor gives the measured share of each
+struct timelineCost_t
+{
+  double timer = 2;     // timer500us_isr()
+  double clock = 0.5;   // motorClock_isr()
+  double hall = 1.5;    // motor_isr()
+  double scan = 6;      // callback_delay() without updateResults()
+  double results = 60;  // updateResults()
+  double dma = 6;       // adc0_dma_isr(), copy of the DMA buffer
+  double output = 12;   // callback_output(), SPI to both AD420
+  double uart = 1;      // UART0 interrupt, per byte
+  double loop = 150;    // one pass of loop()
+  double response = 40; // more in the loop() pass that answers a ModBus request
+};
+
+struct timeline_t
+{
+  unsigned int adcRate = 400000; // ADC conversions per second, freq
+  long baud = 19200;
+  double hallPhase = 120;  // us from the MOTOR_CLK rising edge to the HALL edge
+  double hallJitter = 1;   // us, standard deviation
+  int registers = 28;      // read by the master in each request, 0 = no ModBus traffic
+  double pollGap = 2000;   // us from the end of a response to the next request
+  double duration = 1e6;   // us
+  bool ramp = false;       // motor from MOTOR_SPEED_START, ramped by checkMOTOR()
+  timelineCost_t cost;
+};
+
+struct timelineResult_t
+{
+  int facets;              // HALL edges
+  int dropped;             // facets without a scan, ADC still busy or trigger overwritten
+  int lostIrq;             // interrupt requested again before it was served
+  int outputLate;          // OUTPUT_LATE
+  double triggerJitter;    // standard deviation of the scan start after the MOTOR_CLK edge, us
+  double triggerSpan;      // max - min of it
+  double outputLatencyMax; // scan start to output latch, us
+  int requests;
+  int responses;
+  double responseMean; // end of the request to the response, us
+  double responseMax;
+};
+
+struct event_t
+{
+  double time;
+  int src;
+  int data;
+  bool operator>(const event_t &e) const { return time > e.time; }
+};
+
+struct active_t
+{
+  int src;
+  double remaining; // us of CPU time
+};
+
+static const timeline_t *sim;
+static timelineResult_t res;
+static double simNow;
+static std::priority_queue<event_t, std::vector<event_t>, std::greater<event_t>> events;
+static std::vector<active_t> active; // preempted handlers below the running one
+static double pendingSince[SRC_COUNT];
+static std::deque<uint8_t> uartFifo;
+static double ftmDue[2]; // scheduled compare of the TeensyDelay channels, -1 none
+static double clkRise;   // last MOTOR_CLK rising edge
+static double requestEnd;
+static bool awaiting;
+static std::vector<double> triggerOffsets;
+static double responseSum;
+static scanGenerator_t scans;
+
+static int priority(int src)
+{
+  if (src < SRC_PIT + SIM_TIMERS)
+    return shimTimers[src - SRC_PIT]->prio;
+  switch (src)
+  {
+  case SRC_HALL:
+    return 16;
+  case SRC_UART:
+    return 64; // Teensy default of the serial ports
+  case SRC_LOOP:
+    return 256;
+  default:
+    return 128; // Teensy default
+  }
+}
+
+static bool counting() { return simNow >= SIM_WARMUP; }
+
+static void schedule(double time, int src, int data = 0)
+{
+  events.push({time, src, data});
+}
+
+static void onTrigger(int channel, float delay)
+{
+  if (channel == 0 && ftmDue[0] >= 0 && counting()) // compare moved before it fired
+    res.dropped++;
+  ftmDue[channel] = simNow + delay;
+  schedule(ftmDue[channel], channel == 0 ? SRC_SCAN : SRC_OUTPUT);
+}
+
+static void onAdcStart()
+{
+  schedule(simNow + ANALOG_BUFFER_SIZE * 1e6 / freq, SRC_DMA);
+}
+
+static void master_request()
+{
+  std::vector<uint8_t> frame = modbus_frame({(uint8_t)modbusID, 3, PEAK_VALUE >> 8, PEAK_VALUE & 0xFF, 0, (uint8_t)sim->registers});
+  double byteTime = 10 * 1e6 / sim->baud; // 8N1
+  for (size_t i = 0; i < frame.size(); i++)
+    schedule(simNow + (i + 1) * byteTime, SRC_UART, frame[i]);
+  requestEnd = simNow + frame.size() * byteTime;
+  awaiting = true;
+  if (counting())
+    res.requests++;
+}
+
+// request of an interrupt, the NVIC keeps one pending request per source
+static void raise(const event_t &e)
+{
+  if (e.src == SRC_MASTER)
+  {
+    master_request();
+    return;
+  }
+  if (e.src == SRC_SCAN || e.src == SRC_OUTPUT)
+  {
+    int ch = e.src - SRC_SCAN;
+    if (e.time != ftmDue[ch]) // overwritten by a later trigger
+      return;
+    ftmDue[ch] = -1;
+  }
+  if (e.src < SRC_PIT + SIM_TIMERS)
+    schedule(e.time + shimTimers[e.src - SRC_PIT]->period, e.src); // new period from the next tick
+  if (e.src == SRC_UART)
+    uartFifo.push_back(e.data);
+
+  if (pendingSince[e.src] >= 0)
+  {
+    if (e.src != SRC_UART && counting())
+      res.lostIrq++;
+    return;
+  }
+  pendingSince[e.src] = e.time;
+}
+
+// run the handler, returns its cost
+static double dispatch(int src)
+{
+  const timelineCost_t &c = sim->cost;
+  shimMicros = (unsigned long)simNow;
+  ARM_DWT_CYCCNT = (uint32_t)(simNow * (F_CPU / 1000000));
+
+  if (src < SRC_PIT + SIM_TIMERS)
+  {
+    int clk = shimPin[MOTOR_CLK];
+    shimTimers[src - SRC_PIT]->callback();
+    if (!clk && shimPin[MOTOR_CLK]) // the motor follows its clock, one HALL edge per facet
+    {
+      clkRise = simNow;
+      schedule(simNow + sim->hallPhase + sim->hallJitter * scanGenerator_normal(&scans), SRC_HALL);
+    }
+    return shimTimers[src - SRC_PIT] == &timerMotor ? c.clock : c.timer;
+  }
+
+  switch (src)
+  {
+  case SRC_HALL:
+    if (counting())
+      res.facets++;
+    motor_isr();
+    return c.hall;
+  case SRC_SCAN:
+  {
+    boolean busy = adc0_busy;
+    callback_delay();
+    if (busy)
+    {
+      if (counting())
+        res.dropped++;
+      return c.scan;
+    }
+    if (counting())
+      triggerOffsets.push_back(fmod(simNow - clkRise, 1000));
+    return c.scan + c.results;
+  }
+  case SRC_OUTPUT:
+    callback_output();
+    if (counting() && simNow - scanStartTime > res.outputLatencyMax)
+      res.outputLatencyMax = simNow - scanStartTime;
+    return c.output;
+  case SRC_DMA:
+  {
+    int samples[ANALOG_BUFFER_SIZE];
+    scanGenerator_next(&scans, samples, ANALOG_BUFFER_SIZE);
+    for (int i = 0; i < ANALOG_BUFFER_SIZE; i++)
+      adc0_buf[i] = samples[i];
+    adc0_dma_isr();
+    return c.dma;
+  }
+  case SRC_UART:
+  {
+    double cost = c.uart * uartFifo.size();
+    while (!uartFifo.empty())
+    {
+      Serial1.rx.push_back(uartFifo.front());
+      uartFifo.pop_front();
+    }
+    return cost;
+  }
+  default: // SRC_LOOP
+  {
+    size_t sent = Serial1.tx.size();
+    loop();
+    return c.loop + (Serial1.tx.size() > sent ? c.response : 0);
+  }
+  }
+}
+
+// loop() pass done, a response goes out and the master polls again after it
+static void finish(int src)
+{
+  if (src != SRC_LOOP || Serial1.tx.empty())
+    return;
+  double byteTime = 10 * 1e6 / sim->baud;
+  if (awaiting && counting())
+  {
+    double t = simNow - requestEnd;
+    res.responses++;
+    responseSum += t;
+    if (t > res.responseMax)
+      res.responseMax = t;
+  }
+  awaiting = false;
+  schedule(simNow + Serial1.tx.size() * byteTime + sim->pollGap, SRC_MASTER);
+  Serial1.tx.clear();
+}
+
+// highest priority request, -1 if none
+static int pending_highest()
+{
+  int best = -1;
+  for (int s = 0; s < SRC_LOOP; s++)
+  {
+    if (pendingSince[s] >= 0 && (best < 0 || priority(s) < priority(best)))
+      best = s;
+  }
+  return best;
+}
+
+static void motor_atSpeed()
+{
+  motorSpeed = 100;
+  motorState = MOTOR_RUN;
+  timerMotor.update(50000 / motorSpeed);
+}
+
+static void motor_fromStart()
+{
+  motorSpeed = MOTOR_SPEED_START;
+  motorState = MOTOR_RAMP;
+  shimMicros = 0;
+  motorStepTime = millis();
+  motorStepMicros = micros();
+  timerMotor.update(50000 / motorSpeed);
+}
+
+static timelineResult_t timeline_run(const timeline_t &cfg)
+{
+  sim = &cfg;
+  res = timelineResult_t();
+  simNow = 0;
+  events = decltype(events)();
+  active.clear();
+  uartFifo.clear();
+  triggerOffsets.clear();
+  responseSum = 0;
+  awaiting = false;
+  clkRise = 0;
+  scans = scanGenerator_t();
+  for (int s = 0; s < SRC_COUNT; s++)
+    pendingSince[s] = -1;
+  ftmDue[0] = ftmDue[1] = -1;
+
+  // sensor state of a motor at full speed, counters from zero
+  freq = cfg.adcRate;
+  modbusSpeed = cfg.baud;
+  modbus_configure(modbusSpeed, modbusFormat, modbusID, TXEN, TOTAL_REGS_SIZE, 0);
+  Serial1.rx.clear();
+  Serial1.tx.clear();
+  if (cfg.ramp)
+    motor_fromStart();
+  else
+    motor_atSpeed();
+  adc0_busy = false;
+  motorPulseIndex = 0;
+  motorTimeOld = motorTimeNow = motorTimeDiff = 0;
+  outputLate = 0;
+  shimPin[MOTOR_CLK] = LOW;
+
+  TeensyDelay::onTrigger = onTrigger;
+  shimAdcStart = onAdcStart;
+  for (size_t i = 0; i < shimTimers.size() && i < SIM_TIMERS; i++)
+  {
+    if (shimTimers[i]->callback)
+      schedule(shimTimers[i]->period, SRC_PIT + i);
+  }
+  if (cfg.registers)
+    schedule(SIM_WARMUP, SRC_MASTER);
+  uint16_t lateStart = 0;
+  bool lateCounted = false;
+
+  while (simNow < cfg.duration)
+  {
+    if (!lateCounted && counting())
+    {
+      lateStart = outputLate;
+      lateCounted = true;
+    }
+
+    // a request preempts the running handler only with a higher priority
+    int s = pending_highest();
+    int running = active.empty() ? 257 : priority(active.back().src);
+    if (s >= 0 && priority(s) < running)
+    {
+      pendingSince[s] = -1;
+      active.push_back({s, dispatch(s)});
+      continue;
+    }
+    if (active.empty())
+    {
+      active.push_back({SRC_LOOP, dispatch(SRC_LOOP)});
+      continue;
+    }
+
+    double end = simNow + active.back().remaining;
+    if (!events.empty() && events.top().time <= end)
+    {
+      event_t e = events.top();
+      events.pop();
+      active.back().remaining -= e.time - simNow;
+      simNow = e.time;
+      raise(e);
+    }
+    else
+    {
+      simNow = end;
+      int done = active.back().src;
+      active.pop_back();
+      finish(done);
+    }
+
+    if (awaiting && simNow > requestEnd + SIM_TIMEOUT) // no response, poll again
+    {
+      awaiting = false;
+      schedule(simNow + cfg.pollGap, SRC_MASTER);
+    }
+  }
+
+  TeensyDelay::onTrigger = NULL;
+  shimAdcStart = NULL;
+  res.outputLate = (uint16_t)(outputLate - lateStart);
+
+  if (!triggerOffsets.empty())
+  {
+    double sum = 0, sum2 = 0, lo = 1e9, hi = -1e9;
+    for (double o : triggerOffsets)
+    {
+      sum += o;
+      sum2 += o * o;
+      lo = fmin(lo, o);
+      hi = fmax(hi, o);
+    }
+    double mean = sum / triggerOffsets.size();
+    res.triggerJitter = sqrt(fmax(0, sum2 / triggerOffsets.size() - mean * mean));
+    res.triggerSpan = hi - lo;
+  }
+  if (res.responses)
+    res.responseMean = responseSum / res.responses;
+  return res;
+}
+
+static void report(const char *name, const timelineResult_t &r)
+{
+  char line[200];
+  snprintf(line, sizeof(line), "%-16s facets %4d dropped %4d lost irq %3d late %4d  trigger jitter %4.2f span %3.0f us  output %3.0f us  modbus %d/%d mean %5.0f max %5.0f us",
+           name, r.facets, r.dropped, r.lostIrq, r.outputLate, r.triggerJitter, r.triggerSpan, r.outputLatencyMax,
+           r.responses, r.requests, r.responseMean, r.responseMax);
+  TEST_MESSAGE(line);
+}
+
+// SimpleModbusSlave takes the time of a byte when loop() reads it, the frame is complete
+// T1_5 later and answered in the next pass: up to three passes after the last byte
+static double response_bound(const timeline_t &cfg)
+{
+  return T1_5 + 3 * (cfg.cost.loop + cfg.cost.response) + 100; // 100 us of interrupts
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// sensor as shipped: every facet scanned, outputs on time, trigger within the micros() step
+void test_nominal(void)
+{
+  timeline_t cfg;
+  timelineResult_t r = timeline_run(cfg);
+  report("nominal", r);
+
+  TEST_ASSERT_INT_WITHIN(2, (cfg.duration - SIM_WARMUP) / 1000, r.facets);
+  TEST_ASSERT_EQUAL(0, r.dropped);
+  TEST_ASSERT_EQUAL(0, r.lostIrq);
+  TEST_ASSERT_EQUAL(0, r.outputLate);
+  TEST_ASSERT_TRUE(r.triggerSpan <= 20);
+  TEST_ASSERT_TRUE(r.outputLatencyMax <= outputDelay + 20);
+  TEST_ASSERT_INT_WITHIN(1, r.requests, r.responses); // last one may be in flight
+  TEST_ASSERT_TRUE(r.responseMax <= response_bound(cfg));
+}
+
+// a conversion longer than a facet makes callback_delay() skip every second facet
+void test_adc_rate(void)
+{
+  static const unsigned int rates[] = {400000, 250000, 210000, 190000, 150000};
+  char name[32];
+  for (unsigned int rate : rates)
+  {
+    timeline_t cfg;
+    cfg.adcRate = rate;
+    cfg.duration = 300000;
+    timelineResult_t r = timeline_run(cfg);
+    snprintf(name, sizeof(name), "ADC %u kHz", rate / 1000);
+    report(name, r);
+
+    if (ANALOG_BUFFER_SIZE * 1e6 / rate + sim->cost.dma < 1000 - 20)
+      TEST_ASSERT_EQUAL(0, r.dropped);
+    else
+      TEST_ASSERT_TRUE(r.dropped >= r.facets / 3);
+  }
+}
+
+// ModBus response time follows the inter character timeout and the loop() pass
+void test_baud_rate(void)
+{
+  static const long bauds[] = {9600, 19200, 57600, 115200};
+  char name[32];
+  for (long baud : bauds)
+  {
+    timeline_t cfg;
+    cfg.baud = baud;
+    cfg.duration = 500000;
+    timelineResult_t r = timeline_run(cfg);
+    snprintf(name, sizeof(name), "ModBus %ld", baud);
+    report(name, r);
+
+    TEST_ASSERT_TRUE(r.responses > 0);
+    TEST_ASSERT_INT_WITHIN(1, r.requests, r.responses);
+    TEST_ASSERT_EQUAL(0, r.dropped);
+    TEST_ASSERT_TRUE(r.responseMax <= response_bound(cfg));
+  }
+}
+
+// updateResults() longer than OUTPUT_DELAY delays the output latch behind it (same priority)
+void test_slow_results(void)
+{
+  timeline_t cfg;
+  cfg.duration = 300000;
+  cfg.cost.results = outputDelay + 50;
+  timelineResult_t r = timeline_run(cfg);
+  report("results 350 us", r);
+
+  TEST_ASSERT_EQUAL(0, r.dropped);
+  TEST_ASSERT_TRUE(r.outputLate >= r.facets - 2);
+  TEST_ASSERT_TRUE(r.outputLatencyMax >= outputDelay + 50);
+}
+
+// a long loop() pass (display, EEPROM) delays ModBus only, the scans run in interrupts
+void test_slow_loop(void)
+{
+  timeline_t cfg;
+  cfg.duration = 500000;
+  cfg.cost.loop = 3000;
+  timelineResult_t r = timeline_run(cfg);
+  report("loop 3 ms", r);
+
+  TEST_ASSERT_EQUAL(0, r.dropped);
+  TEST_ASSERT_EQUAL(0, r.outputLate);
+  TEST_ASSERT_TRUE(r.responseMax > T1_5 + cfg.cost.loop);
+}
+
+// the timeouts keep their 500 us tick while the motor clock is ramped up
+void test_motor_ramp(void)
+{
+  timeline_t cfg;
+  cfg.ramp = true;
+  cfg.registers = 0;
+  int hour = hourTimeout;
+  timelineResult_t r = timeline_run(cfg);
+  report("motor ramp", r);
+
+  char line[80];
+  snprintf(line, sizeof(line), "motor at %d %% after %.0f ms, hourTimeout -%d", motorSpeed, cfg.duration / 1000, hour - hourTimeout);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_TRUE(motorSpeed > MOTOR_SPEED_START + 10);
+  TEST_ASSERT_INT_WITHIN(2, cfg.duration / 1000, hour - hourTimeout);
+  TEST_ASSERT_EQUAL(500, timer500us.period);
+}
+
+// a nested handler is charged to itself only, not to the handler it interrupted
+void test_cpu_nested(void)
+{
+  memset((void *)cpuCycles, 0, sizeof(cpuCycles));
+  ARM_DWT_CYCCNT = 1000;
+  cpuMark_t outer = cpu_enter();
+  ARM_DWT_CYCCNT += 300;
+  cpuMark_t inner = cpu_enter();
+  ARM_DWT_CYCCNT += 200;
+  cpu_leave(CPU_MOTOR, inner);
+  ARM_DWT_CYCCNT += 100;
+  cpu_leave(CPU_SCAN, outer);
+
+  TEST_ASSERT_EQUAL(200, cpuCycles[CPU_MOTOR]);
+  TEST_ASSERT_EQUAL(400, cpuCycles[CPU_SCAN]);
+  TEST_ASSERT_EQUAL(0, shimIrqDisabled);
+}
+
+// ModBus bytes received during a scan are charged to CPU_UART, not to the scan
+void test_cpu_uart(void)
+{
+  memset((void *)cpuCycles, 0, sizeof(cpuCycles));
+  TEST_ASSERT_TRUE(shimVector[IRQ_UART0_STATUS] == serial1_isr);
+  shimUartCycles = 150;
+  ARM_DWT_CYCCNT = 5000;
+  cpuMark_t scan = cpu_enter();
+  ARM_DWT_CYCCNT += 100;
+  shimVector[IRQ_UART0_STATUS]();
+  ARM_DWT_CYCCNT += 100;
+  cpu_leave(CPU_SCAN, scan);
+  shimUartCycles = 0;
+
+  TEST_ASSERT_EQUAL(150, cpuCycles[CPU_UART]);
+  TEST_ASSERT_EQUAL(200, cpuCycles[CPU_SCAN]);
+
+  // loop() tasks back to back
+  cpuMark_t task = cpu_enter();
+  ARM_DWT_CYCCNT += 30;
+  task = cpu_next(CPU_MODBUS, task);
+  ARM_DWT_CYCCNT += 40;
+  cpu_leave(CPU_EEPROM, task);
+  TEST_ASSERT_EQUAL(30, cpuCycles[CPU_MODBUS]);
+  TEST_ASSERT_EQUAL(40, cpuCycles[CPU_EEPROM]);
+  TEST_ASSERT_EQUAL(0, shimIrqDisabled);
+}
+
+int main(int argc, char **argv)
+{
+  setup();
+  UNITY_BEGIN();
+  RUN_TEST(test_nominal);
+  RUN_TEST(test_adc_rate);
+  RUN_TEST(test_baud_rate);
+  RUN_TEST(test_slow_results);
+  RUN_TEST(test_slow_loop);
+  RUN_TEST(test_motor_ramp);
+  RUN_TEST(test_cpu_nested);
+  RUN_TEST(test_cpu_uart);
+  return UNITY_END();
+}
@@ -0,0 +1,378 @@
+#!/usr/bin/env python3
+"""Cycle regression of the scan path on the teensy31 image, runs the firmware in unicorn.
+
+Loads .pio/build/teensy31/firmware.elf, runs setup(), then replays test/golden/scans.trace
+the way the interrupts run it on the sensor: samples into adc0_buf, adc0_dma_isr(), then
+callback_delay() (config swap, next ADC start and updateResults() of the scan). Every executed
+instruction is timed by m4cycles.CycleModel (Cortex-M4 TRM timing, flash wait states, FMC).
+
+The measurement each scan publishes must match test/golden/scans.csv (as in test_replay),
+otherwise the peripheral model or the replay is wrong and the cycles mean nothing: exit 2.
+
+    ~/.platformio/penv/bin/pip install unicorn pyelftools
+    pio run -e teensy31 -t cycles                # build, replay, compare with baseline.json
+    pio run -e teensy31 -t cycles_record         # store a new baseline after an intended change
+
+or without PlatformIO's target, on a built image:
+
+    python3 tools/emulator/emulate.py [--elf firmware.elf] [--record] [--csv cycles.csv]
+    python3 -m unittest discover tools/emulator  # decoder, peripheral model and replay order
+
+Exit status 1 when a function is slower than threshold x baseline (the model is
+deterministic, the threshold only absorbs intended small changes).
+"""
+
+import argparse
+import json
+import os
+import struct
+import sys
+
+try:
+    from elftools.elf.elffile import ELFFile
+    from unicorn import Uc, UcError, UC_ARCH_ARM, UC_MODE_THUMB, UC_MODE_MCLASS, UC_HOOK_CODE, UC_HOOK_MEM_READ
+    from unicorn import arm_const as arm
+except ImportError:  # the peripheral model and the replay are tested without them
+    ELFFile = None
+
+import m4cycles
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..')
+F_CPU = 96000000
+CYCLES_PER_MS = F_CPU // 1000
+
+FLASH = (0x00000000, 0x40000)
+FLEXRAM = (0x14000000, 0x1000)  # EEPROM emulation, erased
+SRAM = (0x1FFF8000, 0x10000)
+STACK_TOP = 0x20008000
+RETURN = 0x60000000  # calls return here, emulation stops
+PERIPHERALS = (0x40000000, 0x100000)
+BITBAND = (0x42000000, 0x2000000)
+PPB = (0xE0000000, 0x100000)
+
+# trace file, see trace_capture() in src/main.cpp
+TRACE_VERSION = 1
+TRACE_HEADER = 13
+ANALOG_BUFFER_SIZE = 200
+TRACE_SIZE = TRACE_HEADER + ANALOG_BUFFER_SIZE + 1
+RECIPE_FIELDS = ['pga', 'thre', 'windowBegin', 'windowEnd', 'positionMode',
+                 'filterPosition', 'filterOn', 'filterOff']  # recipe_t, int each
+
+# status bits the firmware waits for: address -> (bits set, bits cleared) on every read
+READY = {
+    0x4003B000: (0x80, 0),  # ADC0_SC1A COCO
+    0x4003B020: (0, 0x80),  # ADC0_SC2 ADACT
+    0x4003B024: (0, 0x80),  # ADC0_SC3 CAL done
+    0x400BB000: (0x80, 0),  # ADC1_SC1A COCO
+    0x400BB020: (0, 0x80),
+    0x400BB024: (0, 0x80),
+    0x40036000: (0, 0x01),  # PDB0_SC LDOK
+    0x4006A004: (0xC0, 0),  # UART0_S1 TDRE TC
+    0x4002C02C: (0x8A000000, 0),  # SPI0_SR TCF EOQF TFFF
+    0x40020000: (0x80, 0),  # FTFL_FSTAT CCIF
+    0x40020001: (0x01, 0),  # FTFL_FCNFG EEERDY
+    # GPIOA..E_PDIR: inputs with pull-ups read high, buttons released, SET_IN and TEST_IN open
+    0x400FF010: (0xFFFFFFFF, 0),
+    0x400FF050: (0xFFFFFFFF, 0),
+    0x400FF090: (0xFFFFFFFF, 0),
+    0x400FF0D0: (0xFFFFFFFF, 0),
+    0x400FF110: (0xFFFFFFFF, 0),
+}
+
+FUNCTIONS = ['callback_delay', 'updateResults', 'adc0_dma_isr']
+MEASUREMENT = '<5H'  # measurement_t: scan, facet, peakValue, positionValue, positionValueAvg
+
+
+class Peripherals:
+    """Written values read back, status bits always ready, clocks from the cycle count."""
+
+    def __init__(self, model):
+        self.model = model
+        self.shadow = {}  # last written peripheral bytes
+
+    def read(self, address, size):
+        if address == 0xE0001004:  # DWT_CYCCNT
+            return self.model.cycles & 0xFFFFFFFF
+        if address == 0xE000E018:  # SYST_CVR, 1 ms reload
+            return CYCLES_PER_MS - 1 - self.model.cycles % CYCLES_PER_MS
+        if address == 0x40038004:  # FTM0_CNT, bus clock
+            return (self.model.cycles // 2) & 0xFFFF
+        value = 0
+        for n in range(size):
+            byte = self.shadow.get(address + n, 0)
+            for ready, bits in READY.items():
+                if ready <= address + n < ready + 4:
+                    shift = (address + n - ready) * 8
+                    byte = (byte | (bits[0] >> shift)) & ~(bits[1] >> shift) & 0xFF
+            value |= byte << (8 * n)
+        return value
+
+    def write(self, address, size, value):
+        for n in range(size):
+            self.shadow[address + n] = (value >> (8 * n)) & 0xFF
+
+    def bitband_read(self, offset):
+        """Bit of the alias at BITBAND[0] + offset."""
+        return (self.read(PERIPHERALS[0] + offset // 32, 1) >> (offset // 4 % 8)) & 1
+
+    def bitband_write(self, offset, value):
+        address = PERIPHERALS[0] + offset // 32
+        bit = 1 << (offset // 4 % 8)
+        byte = self.shadow.get(address, 0)
+        self.shadow[address] = (byte | bit) if value & 1 else (byte & ~bit)
+
+
+class Firmware:
+    def __init__(self, path):
+        if ELFFile is None:
+            sys.exit('pip install unicorn pyelftools')
+        self.uc = Uc(UC_ARCH_ARM, UC_MODE_THUMB | UC_MODE_MCLASS)
+        self.model = m4cycles.CycleModel()
+        self.peripherals = Peripherals(self.model)
+        self.regs = [getattr(arm, 'UC_ARM_REG_R%d' % n) for n in range(13)] + [arm.UC_ARM_REG_SP, arm.UC_ARM_REG_LR, arm.UC_ARM_REG_PC]
+        self.nextTick = CYCLES_PER_MS
+        self.calls = []  # (return address, cycles at entry, name) of the timed functions
+        self.inclusive = {}
+        with open(path, 'rb') as f:
+            elf = ELFFile(f)
+            self.symbols = {s.name: s['st_value'] for s in elf.get_section_by_name('.symtab').iter_symbols() if s.name}
+            self._map()
+            for segment in elf.iter_segments():
+                if segment['p_type'] != 'PT_LOAD':
+                    continue
+                data = segment.data()
+                for address in {segment['p_paddr'], segment['p_vaddr']}:
+                    self.uc.mem_write(address, data + bytes(segment['p_memsz'] - len(data)))
+            init = elf.get_section_by_name('.init_array')
+            self.constructors = struct.unpack('<%dI' % (init['sh_size'] // 4), init.data()) if init else ()
+        self.timed = {self.symbol(name) & ~1: name for name in FUNCTIONS}
+        self.delay = self.symbol('delay') & ~1
+
+    def symbol(self, name):
+        """Address of a C or C++ (no arguments, Itanium mangling) symbol."""
+        for s in (name, '_Z%d%sv' % (len(name), name)):
+            if s in self.symbols:
+                return self.symbols[s]
+        mangled = '_Z%d%s' % (len(name), name)
+        for s, address in self.symbols.items():
+            if s.startswith(mangled):
+                return address
+        raise KeyError(name)
+
+    def _map(self):
+        uc = self.uc
+        uc.mem_map(FLASH[0], FLASH[1])
+        uc.mem_map(FLEXRAM[0], FLEXRAM[1])
+        uc.mem_write(FLEXRAM[0], b'\xff' * FLEXRAM[1])
+        uc.mem_map(SRAM[0], SRAM[1])
+        uc.mem_map(RETURN, 0x1000)
+        uc.mmio_map(PERIPHERALS[0], PERIPHERALS[1], self._read, PERIPHERALS[0], self._write, PERIPHERALS[0])
+        uc.mmio_map(BITBAND[0], BITBAND[1], self._bitbandRead, None, self._bitbandWrite, None)
+        uc.mmio_map(PPB[0], PPB[1], self._read, PPB[0], self._write, PPB[0])
+        uc.hook_add(UC_HOOK_CODE, self._code)
+        uc.hook_add(UC_HOOK_MEM_READ, self._dataRead, begin=FLASH[0], end=FLASH[0] + FLASH[1] - 1)
+
+    def _read(self, uc, offset, size, base):
+        return self.peripherals.read(base + offset, size)
+
+    def _write(self, uc, offset, size, value, base):
+        self.peripherals.write(base + offset, size, value)
+
+    def _bitbandRead(self, uc, offset, size, user):
+        return self.peripherals.bitband_read(offset)
+
+    def _bitbandWrite(self, uc, offset, size, value, user):
+        self.peripherals.bitband_write(offset, value)
+
+    def _dataRead(self, uc, access, address, size, value, user):
+        self.model.data_read(address)
+
+    def _code(self, uc, address, size, user):
+        if address == self.delay:  # delay(ms): time passes, no code runs
+            self.model.wait(uc.reg_read(arm.UC_ARM_REG_R0) * CYCLES_PER_MS)
+            self._tick()
+            uc.reg_write(arm.UC_ARM_REG_PC, uc.reg_read(arm.UC_ARM_REG_LR))
+            return
+        if self.calls and address == self.calls[-1][0]:
+            _, start, name = self.calls.pop()
+            self.inclusive[name] = self.model.cycles - start
+        if address in self.timed:
+            self.calls.append((uc.reg_read(arm.UC_ARM_REG_LR) & ~1, self.model.cycles, self.timed[address]))
+        code = bytes(uc.mem_read(address, 4))
+        hw1, hw2 = struct.unpack('<HH', code)
+        self.model.step(address, hw1, hw2, divide=lambda rn, rm: (uc.reg_read(self.regs[rn]), uc.reg_read(self.regs[rm])))
+        self._tick()
+
+    def _tick(self):
+        """systick_isr: millis() counter."""
+        while self.model.cycles >= self.nextTick:
+            self.nextTick += CYCLES_PER_MS
+            counter = self.symbol('systick_millis_count')
+            ms = struct.unpack('<I', self.uc.mem_read(counter, 4))[0]
+            self.uc.mem_write(counter, struct.pack('<I', (ms + 1) & 0xFFFFFFFF))
+
+    def call(self, address, limit=50000000):
+        """Run a function to its return, the cycles it took."""
+        self.uc.reg_write(arm.UC_ARM_REG_SP, STACK_TOP)
+        self.uc.reg_write(arm.UC_ARM_REG_LR, RETURN | 1)
+        start = self.model.cycles
+        self.calls = []
+        try:
+            self.uc.emu_start(address | 1, RETURN, count=limit)
+        except UcError as e:
+            sys.exit('%s at 0x%08x' % (e, self.uc.reg_read(arm.UC_ARM_REG_PC)))
+        pc = self.uc.reg_read(arm.UC_ARM_REG_PC)
+        if pc != RETURN:
+            sys.exit('0x%08x did not return within %d instructions, stuck at 0x%08x (%s)' %
+                     (address, limit, pc, self.nearest(pc)))
+        return self.model.cycles - start
+
+    def nearest(self, pc):
+        best = max((a for a in self.symbols.values() if a & ~1 <= pc), default=0)
+        return next(name for name, a in self.symbols.items() if a == best)
+
+    def write_int(self, name, value, index=0, size=4):
+        fmt = {1: '<b', 2: '<h', 4: '<i'}[size]
+        self.uc.mem_write(self.symbol(name) + index * size, struct.pack(fmt, value))
+
+    def read(self, name, size, offset=0):
+        return bytes(self.uc.mem_read(self.symbol(name) + offset, size))
+
+    def measurement(self):
+        """Last published measurement_t as (facet, peak, position, position avg)."""
+        seq = struct.unpack('<I', self.read('measurementSeq', 4))[0]
+        size = struct.calcsize(MEASUREMENT)
+        return struct.unpack(MEASUREMENT, self.read('measurementBuf', size, (seq & 1) * size))[1:]
+
+
+def traces(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    for n in range(0, len(data) - TRACE_SIZE * 2 + 1, TRACE_SIZE * 2):
+        words = struct.unpack('>%dH' % TRACE_SIZE, data[n:n + TRACE_SIZE * 2])
+        if words[0] != TRACE_VERSION or words[8] != ANALOG_BUFFER_SIZE:
+            sys.exit('%s: scan %d is not a version %d trace' % (path, n // (TRACE_SIZE * 2), TRACE_VERSION))
+        yield words
+
+
+def golden(path):
+    """Tolerance and expected (facet, peak, position, position avg) per scan of scans.csv."""
+    tolerance, rows = (0, 0, 0, 0), []
+    with open(path) as f:
+        for line in f:
+            if line.startswith('#'):
+                continue
+            fields = line.strip().split(',')
+            if fields[0] == 'tolerance':
+                tolerance = tuple(int(v) for v in fields[1:])
+            else:
+                rows.append(tuple(int(v) for v in fields))
+    return tolerance, rows
+
+
+def run(fw, trace):
+    """Per scan cycles of the timed functions and the published measurements.
+
+    Each scan is processed with the settings of its own header, as in test_replay: header into
+    its slot, samples through adc0_dma_isr(), then callback_delay() processes them.
+    """
+    for constructor in fw.constructors:
+        fw.call(constructor)
+    fw.call(fw.symbol('setup'))
+    checkSET = fw.symbol('checkSET')
+    callback_delay = fw.symbol('callback_delay')
+    adc0_dma_isr = fw.symbol('adc0_dma_isr')
+
+    # replay_reset() of test_replay: fixed parameter set 1, no test, no prediction
+    fw.write_int('set', 0)
+    fw.write_int('setInput', 0)
+    fw.write_int('positionPredict', 0)
+    for name in ('signalDetected', 'signalPresent', 'intTest', 'extTest'):
+        fw.write_int(name, 0, size=1)
+
+    rows, outputs = [], []
+    for words in traces(trace):
+        slot = words[9] - 1
+        header = [words[2], words[3], words[4], words[5], words[6], 0, 0, 0]  # filters off
+        for field, value in enumerate(header):
+            fw.write_int('recipes', value, slot * len(RECIPE_FIELDS) + field)
+        fw.write_int('recipeSet1', slot + 1)
+        fw.call(checkSET)
+
+        # the conversion this scan was acquired with
+        fw.write_int('adcFacet', words[10])
+        fw.write_int('adcRecipe', slot)
+        fw.write_int('adcPga', words[2])
+        for i in range(ANALOG_BUFFER_SIZE):
+            fw.write_int('adc0_buf', words[TRACE_HEADER + i], i, size=2)
+        row = {'adc0_dma_isr': fw.call(adc0_dma_isr)}
+
+        fw.inclusive = {}
+        row['callback_delay'] = fw.call(callback_delay)
+        row['updateResults'] = fw.inclusive.get('updateResults', 0)
+        rows.append(row)
+        outputs.append(fw.measurement())
+    return rows, outputs
+
+
+def mismatches(outputs, expected, tolerance):
+    """Scans whose outputs differ from the golden ones, (scan, actual, expected)."""
+    bad = [(n, tuple(a), tuple(e)) for n, (a, e) in enumerate(zip(outputs, expected))
+           if any(abs(x - y) > t for x, y, t in zip(a, e, tolerance))]
+    if len(outputs) != len(expected):
+        bad.append((min(len(outputs), len(expected)), len(outputs), len(expected)))
+    return bad
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--elf', default=os.path.join(ROOT, '.pio/build/teensy31/firmware.elf'))
+    parser.add_argument('--trace', default=os.path.join(ROOT, 'test/golden/scans.trace'))
+    parser.add_argument('--golden', default=os.path.join(ROOT, 'test/golden/scans.csv'))
+    parser.add_argument('--baseline', default=os.path.join(os.path.dirname(os.path.abspath(__file__)), 'baseline.json'))
+    parser.add_argument('--record', action='store_true', help='store the means as the new baseline')
+    parser.add_argument('--csv', help='per scan cycles')
+    args = parser.parse_args()
+
+    fw = Firmware(args.elf)
+    rows, outputs = run(fw, args.trace)
+    tolerance, expected = golden(args.golden)
+    bad = mismatches(outputs, expected, tolerance)
+    for scan, actual, wanted in bad[:10]:
+        print('scan %d: %s, scans.csv %s' % (scan, actual, wanted))
+    if bad:
+        print('%d of %d scans differ from %s, cycles not compared' % (len(bad), len(expected), args.golden))
+        return 2
+    if args.csv:
+        with open(args.csv, 'w') as f:
+            f.write('scan,%s\n' % ','.join(FUNCTIONS))
+            for n, row in enumerate(rows):
+                f.write('%d,%s\n' % (n, ','.join(str(row[name]) for name in FUNCTIONS)))
+
+    means = {name: sum(row[name] for row in rows) / len(rows) for name in FUNCTIONS}
+    worst = {name: max(row[name] for row in rows) for name in FUNCTIONS}
+    if args.record:
+        with open(args.baseline, 'w') as f:
+            json.dump({'threshold': 1.02, 'scans': len(rows), 'mean': means, 'max': worst}, f, indent=2)
+            f.write('\n')
+        print('baseline of %d scans written to %s' % (len(rows), args.baseline))
+        return 0
+
+    if not os.path.exists(args.baseline):
+        sys.exit('no %s, run with --record on the reference build' % args.baseline)
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+    threshold = baseline['threshold']
+    failed = 0
+    print('%-16s %10s %10s %10s %10s' % ('cycles', 'mean', 'baseline', 'max', 'baseline'))
+    for name in FUNCTIONS:
+        slow = means[name] > threshold * baseline['mean'][name] or worst[name] > threshold * baseline['max'][name]
+        failed += slow
+        print('%-16s %10.0f %10.0f %10d %10d%s' % (name, means[name], baseline['mean'][name], worst[name],
+                                                   baseline['max'][name], '  REGRESSION' if slow else ''))
+    print('%d scans, %.1f us per scan at %d MHz' % (len(rows), (means['callback_delay'] + means['adc0_dma_isr']) * 1e6 / F_CPU, F_CPU // 1000000))
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,196 @@
+"""Cortex-M4 instruction timing of the Teensy 3.2 (MK20DX256 at 96 MHz) for emulate.py.
+
+Cycle counts follow the instruction timing table of the Cortex-M4 TRM: P is the pipeline
+refill after a taken branch, N the number of registers of a multiple load/store, a load or
+store right after another one is pipelined. Flash runs at 24 MHz (3 wait states), the flash
+memory controller (FMC) caches 64 bit lines and prefetches the next one, see FlashModel.
+"""
+
+from collections import OrderedDict
+
+PIPELINE_REFILL = 2  # P, 1 - 3 cycles
+FLASH_END = 0x40000  # 256 kB program flash at 0
+FLASH_WAIT = 3  # core clocks per flash access - 1, 96 / 24 MHz
+FLASH_SEQUENTIAL_WAIT = 1  # next line, the prefetch has started it already
+FMC_LINES = 16  # 4 ways x 4 sets of 64 bit lines, modelled fully associative LRU
+
+# instruction kinds
+ALU = 'alu'
+LOAD = 'load'
+STORE = 'store'
+MULTIPLE = 'multiple'  # LDM, STM, PUSH, POP, 1 + N
+BRANCH = 'branch'  # always taken, 1 + P
+COND_BRANCH = 'cond'  # 1, 1 + P when taken
+DIVIDE = 'divide'  # 2 - 12, depends on the operands
+
+
+def size(hw1):
+    """Instruction size in bytes from its first halfword."""
+    return 4 if (hw1 >> 11) in (0b11101, 0b11110, 0b11111) else 2
+
+
+def popcount(x):
+    return bin(x).count('1')
+
+
+def classify(hw1, hw2=0):
+    """(kind, base cycles, loads PC) of the instruction, base without P and wait states."""
+    if size(hw1) == 2:
+        return _classify16(hw1)
+    return _classify32(hw1, hw2)
+
+
+def _classify16(hw1):
+    op = hw1 >> 10
+    if op < 0b010000:  # shift, add, subtract, move, compare
+        return ALU, 1, False
+    if op == 0b010000:  # data processing, MULS
+        return ALU, 1, False
+    if op == 0b010001:  # special data, BX, BLX
+        if (hw1 >> 8) & 3 == 3:
+            return BRANCH, 1, False
+        rd = ((hw1 >> 4) & 8) | (hw1 & 7)
+        if (hw1 >> 8) & 3 in (0, 2) and rd == 15:  # ADD PC, MOV PC
+            return BRANCH, 1, False
+        return ALU, 1, False
+    if op >> 1 == 0b01001:  # LDR literal
+        return LOAD, 2, False
+    if op >> 2 == 0b0101:  # register offset, STR STRH STRB then loads
+        return (LOAD if (hw1 >> 9) & 7 >= 3 else STORE), 2, False
+    if op >> 3 in (0b011, 0b100):  # immediate offset, halfword, SP relative
+        return (LOAD if hw1 & 0x0800 else STORE), 2, False
+    if op >> 2 == 0b1010:  # ADR, ADD SP
+        return ALU, 1, False
+    if op >> 2 == 0b1011:  # miscellaneous
+        if hw1 & 0xFE00 == 0xB400:  # PUSH
+            return MULTIPLE, 1 + popcount(hw1 & 0x1FF), False
+        if hw1 & 0xFE00 == 0xBC00:  # POP
+            pc = bool(hw1 & 0x100)
+            return (BRANCH if pc else MULTIPLE), 1 + popcount(hw1 & 0x1FF), pc
+        if hw1 & 0xF500 == 0xB100:  # CBZ, CBNZ
+            return COND_BRANCH, 1, False
+        return ALU, 1, False  # IT, hints, CPS, extend, reverse, ADD/SUB SP
+    if op >> 2 == 0b1100:  # STM, LDM
+        return MULTIPLE, 1 + popcount(hw1 & 0xFF), False
+    if op >> 2 == 0b1101:
+        if (hw1 >> 8) & 0xF >= 0xE:  # UDF, SVC
+            return ALU, 1, False
+        return COND_BRANCH, 1, False
+    return BRANCH, 1, False  # B
+
+
+def _classify32(hw1, hw2):
+    op1 = (hw1 >> 11) & 3
+    if op1 == 0b01:
+        if hw1 & 0xFE40 == 0xE800:  # LDM, STM, POP.W, PUSH.W
+            load = bool(hw1 & 0x0010)
+            pc = load and bool(hw2 & 0x8000)
+            return (BRANCH if pc else MULTIPLE), 1 + popcount(hw2), pc
+        if hw1 & 0xFE40 == 0xE840:  # dual, exclusive, table branch
+            if hw1 & 0xFFF0 == 0xE8D0 and hw2 & 0xFFE0 == 0xF000:  # TBB, TBH
+                return BRANCH, 2, False
+            if hw1 & 0xFFE0 in (0xE840, 0xE850, 0xE8C0, 0xE8D0):  # exclusive
+                return (LOAD if hw1 & 0x0010 else STORE), 2, False
+            return (LOAD if hw1 & 0x0010 else STORE), 3, False  # LDRD, STRD
+        return ALU, 1, False  # shifted register, coprocessor
+    if op1 == 0b10:
+        if not hw2 & 0x8000:  # data processing, immediate
+            return ALU, 1, False
+        op2 = (hw2 >> 12) & 7
+        if op2 & 0b101 == 0b000:
+            if (hw1 >> 7) & 7 != 0b111:  # B<c>.W
+                return COND_BRANCH, 1, False
+            if hw1 & 0xFFF0 == 0xF3B0:  # DSB, DMB, ISB
+                return ALU, 4, False
+            return ALU, 2, False  # MSR, MRS
+        return BRANCH, 1, False  # B.W, BL
+    # op1 == 0b11
+    if hw1 & 0xFE00 in (0xF800, 0xF900):  # single load, store
+        if not hw1 & 0x0010:
+            return STORE, 2, False
+        pc = (hw2 >> 12) == 15 and (hw1 >> 5) & 3 == 2  # LDR PC, word loads only
+        return (BRANCH if pc else LOAD), 2, pc
+    if hw1 & 0xFF80 == 0xFB00:  # MUL, MLA, MLS
+        return ALU, (1 if (hw2 >> 12) == 15 else 2), False
+    if hw1 & 0xFF80 == 0xFB80:  # long multiply, divide
+        if (hw1 >> 4) & 7 in (0b001, 0b011) and (hw2 >> 4) & 0xF == 0xF:
+            return DIVIDE, 2, False
+        return ALU, 1, False
+    return ALU, 1, False  # register data processing, coprocessor
+
+
+def divide_cycles(dividend, divisor):
+    """UDIV, SDIV terminate early: 2 - 12 cycles by the bits of the quotient."""
+    dividend &= 0xFFFFFFFF
+    divisor &= 0xFFFFFFFF
+    if not divisor:
+        return 2
+    bits = dividend.bit_length() - divisor.bit_length()
+    return min(12, 2 + max(0, bits + 3) // 4)
+
+
+class FlashModel:
+    """FMC: 64 bit lines, LRU cache, the line after the last fetch is prefetched."""
+
+    def __init__(self):
+        self.lines = OrderedDict()
+        self.lastFetch = None
+        self.misses = 0
+
+    def access(self, address, fetch=True):
+        """Wait states of a fetch or data read from flash."""
+        line = address >> 3
+        if line in self.lines:
+            self.lines.move_to_end(line)
+            wait = 0
+        else:
+            sequential = fetch and self.lastFetch is not None and line == self.lastFetch + 1
+            wait = FLASH_SEQUENTIAL_WAIT if sequential else FLASH_WAIT
+            self.misses += 1
+            self.lines[line] = True
+            if len(self.lines) > FMC_LINES:
+                self.lines.popitem(last=False)
+        if fetch:
+            self.lastFetch = line
+        return wait
+
+
+class CycleModel:
+    """Cycles of the executed instructions, feed every fetched instruction to step()."""
+
+    def __init__(self):
+        self.cycles = 0
+        self.instructions = 0
+        self.flash = FlashModel()
+        self._last = None  # address, size, kind of the previous instruction
+
+    def step(self, pc, hw1, hw2=0, divide=None):
+        """Instruction at pc starts, divide(rn, rm) gives the operands of UDIV and SDIV."""
+        if self._last:
+            address, length, kind = self._last
+            if kind == BRANCH or (kind == COND_BRANCH and pc != address + length):
+                self.cycles += PIPELINE_REFILL
+        length = size(hw1)
+        if pc < FLASH_END:
+            self.cycles += self.flash.access(pc)
+            if length == 4 and (pc + 2) >> 3 != pc >> 3:
+                self.cycles += self.flash.access(pc + 2)
+
+        kind, base, _ = classify(hw1, hw2)
+        if kind in (LOAD, STORE) and self._last and self._last[2] in (LOAD, STORE):
+            base -= 1  # pipelined behind the previous load or store
+        if kind == DIVIDE and divide:
+            base = divide_cycles(*divide(hw1 & 0xF, hw2 & 0xF))
+        self.cycles += base
+        self.instructions += 1
+        self._last = (pc, length, kind)
+
+    def data_read(self, address):
+        """Load from flash (constants, literal pools)."""
+        if address < FLASH_END:
+            self.cycles += self.flash.access(address, fetch=False)
+
+    def wait(self, cycles):
+        """Time passed outside the executed code (stubbed delay())."""
+        self.cycles += cycles
+        self._last = None
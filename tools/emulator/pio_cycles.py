@@ -0,0 +1,26 @@
+"""PlatformIO targets of env:teensy31, the cycle regression on the built image:
+
+    pio run -e teensy31 -t cycles          # compare with tools/emulator/baseline.json
+    pio run -e teensy31 -t cycles_record   # store a new baseline
+
+unicorn and pyelftools in PlatformIO's Python: ~/.platformio/penv/bin/pip install unicorn pyelftools
+"""
+
+Import("env")  # noqa: F821, provided by PlatformIO
+
+script = env.subst("$PROJECT_DIR/tools/emulator/emulate.py")  # noqa: F821
+elf = "$BUILD_DIR/${PROGNAME}.elf"
+
+env.AddCustomTarget(  # noqa: F821
+    name="cycles",
+    dependencies=elf,
+    actions='"$PYTHONEXE" "%s" --elf %s' % (script, elf),
+    title="Cycles",
+    description="replay test/golden/scans.trace in the emulator, compare the cycles with baseline.json")
+
+env.AddCustomTarget(  # noqa: F821
+    name="cycles_record",
+    dependencies=elf,
+    actions='"$PYTHONEXE" "%s" --elf %s --record' % (script, elf),
+    title="Cycles record",
+    description="store the cycles of the replay as the new baseline.json")
@@ -0,0 +1,116 @@
+"""Peripheral model and replay of emulate.py, without unicorn and the teensy31 image.
+
+    python3 -m unittest discover tools/emulator
+"""
+
+import os
+import unittest
+
+import emulate
+import m4cycles
+
+GOLDEN = os.path.join(emulate.ROOT, 'test', 'golden')
+
+
+class PeripheralTest(unittest.TestCase):
+    def setUp(self):
+        self.model = m4cycles.CycleModel()
+        self.io = emulate.Peripherals(self.model)
+
+    def test_written_value_read_back(self):
+        self.io.write(0x40038008, 4, 0x12345678)  # FTM0_MOD
+        self.assertEqual(0x12345678, self.io.read(0x40038008, 4))
+        self.assertEqual(0x3456, self.io.read(0x40038009, 2))
+
+    def test_status_bits_ready(self):
+        self.io.write(0x4003B024, 1, 0x80)  # ADC0_SC3 CAL started
+        self.assertEqual(0, self.io.read(0x4003B024, 1) & 0x80)
+        self.assertEqual(0x80, self.io.read(0x4003B000, 4) & 0x80)  # ADC0_SC1A COCO
+        self.assertEqual(0x01, self.io.read(0x40020001, 1) & 0x01)  # FTFL_FCNFG EEERDY
+        self.assertEqual(0x8A000000, self.io.read(0x4002C02C, 4) & 0x8A000000)  # SPI0_SR
+
+    def test_inputs_pulled_up(self):
+        # SET_IN (27) is PTC9, TEST_IN (28) PTC8: open, parameter set 1, no test
+        self.io.write(0x400FF090, 4, 0)
+        self.assertEqual(0x300, self.io.read(0x400FF090, 4) & 0x300)  # GPIOC_PDIR
+
+    def test_bitband(self):
+        offset = (0x4003B008 - emulate.PERIPHERALS[0]) * 32 + 3 * 4  # ADC0_CFG1 bit 3
+        self.io.bitband_write(offset, 1)
+        self.assertEqual(0x08, self.io.read(0x4003B008, 1))
+        self.assertEqual(1, self.io.bitband_read(offset))
+        self.io.bitband_write(offset, 0)
+        self.assertEqual(0, self.io.read(0x4003B008, 1))
+
+    def test_clocks_from_cycles(self):
+        self.model.wait(emulate.CYCLES_PER_MS + 10)
+        self.assertEqual(emulate.CYCLES_PER_MS + 10, self.io.read(0xE0001004, 4))  # DWT_CYCCNT
+        self.assertEqual(emulate.CYCLES_PER_MS - 11, self.io.read(0xE000E018, 4))  # SYST_CVR
+
+
+class FakeFirmware:
+    """Variables only, callback_delay() publishes the settings the scan was processed with."""
+
+    def __init__(self):
+        self.constructors = ()
+        self.memory = {}
+        self.inclusive = {}
+        self.calls = []
+
+    def symbol(self, name):
+        return name
+
+    def write_int(self, name, value, index=0, size=4):
+        self.memory[name, index] = value
+
+    def get(self, name, index=0):
+        return self.memory.get((name, index), 0)
+
+    def call(self, name):
+        self.calls.append(name)
+        if name == 'adc0_dma_isr':
+            self.memory['dataRecipe', 0] = self.get('adcRecipe')
+            self.memory['dataFacet', 0] = self.get('adcFacet')
+        if name == 'callback_delay':
+            self.inclusive['updateResults'] = 50
+            slot = self.get('dataRecipe') * len(emulate.RECIPE_FIELDS)
+            self.published = (self.get('dataFacet'), self.get('recipes', slot),
+                              self.get('recipes', slot + 1), self.get('recipes', slot + 4))
+        return 100
+
+    def measurement(self):
+        return self.published
+
+
+class ReplayTest(unittest.TestCase):
+    def test_golden_corpus(self):
+        tolerance, expected = emulate.golden(os.path.join(GOLDEN, 'scans.csv'))
+        scans = list(emulate.traces(os.path.join(GOLDEN, 'scans.trace')))
+        self.assertEqual(len(expected), len(scans))
+        self.assertEqual((0, 0, 0, 0), tolerance)
+        for words, row in zip(scans, expected):
+            self.assertEqual(words[10], row[0])  # facet
+
+    def test_scan_processed_with_its_own_header(self):
+        fw = FakeFirmware()
+        rows, outputs = emulate.run(fw, os.path.join(GOLDEN, 'scans.trace'))
+        scans = list(emulate.traces(os.path.join(GOLDEN, 'scans.trace')))
+        self.assertEqual(len(scans), len(rows))
+        self.assertEqual(['setup', 'checkSET', 'adc0_dma_isr', 'callback_delay'], fw.calls[:4])
+        for words, output in zip(scans, outputs):
+            self.assertEqual((words[10], words[2], words[3], words[6]), output)
+        self.assertEqual(0, fw.get('setInput'))
+        self.assertEqual(0, fw.get('extTest'))
+        self.assertEqual({'adc0_dma_isr': 100, 'callback_delay': 100, 'updateResults': 50}, rows[0])
+
+    def test_mismatches(self):
+        expected = [(1, 74, 360, 266), (2, 74, 355, 258)]
+        self.assertEqual([], emulate.mismatches(expected, expected, (0, 0, 0, 0)))
+        outputs = [(1, 74, 360, 266), (2, 75, 355, 258)]
+        self.assertEqual([(1, outputs[1], expected[1])], emulate.mismatches(outputs, expected, (0, 0, 0, 0)))
+        self.assertEqual([], emulate.mismatches(outputs, expected, (0, 1, 0, 0)))
+        self.assertEqual(1, len(emulate.mismatches(outputs[:1], expected, (0, 1, 0, 0))))
+
+
+if __name__ == '__main__':
+    unittest.main()
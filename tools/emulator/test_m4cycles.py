@@ -0,0 +1,126 @@
+"""Decoder and timing checks, encodings assembled by llvm-mc -triple=thumbv7em -mcpu=cortex-m4.
+
+    python3 -m unittest discover tools/emulator
+"""
+
+import unittest
+
+import m4cycles as m4
+
+# encoding (little endian bytes as in the image), kind, base cycles, loads PC
+ENCODINGS = [
+    ('0120', 'movs r0, #1', m4.ALU, 1, False),
+    ('8818', 'adds r0, r1, r2', m4.ALU, 1, False),
+    ('0840', 'ands r0, r1', m4.ALU, 1, False),
+    ('8846', 'mov r8, r1', m4.ALU, 1, False),
+    ('7047', 'bx lr', m4.BRANCH, 1, False),
+    ('9847', 'blx r3', m4.BRANCH, 1, False),
+    ('0248', 'ldr r0, [pc, #8]', m4.LOAD, 2, False),
+    ('8858', 'ldr r0, [r1, r2]', m4.LOAD, 2, False),
+    ('8850', 'str r0, [r1, r2]', m4.STORE, 2, False),
+    ('c878', 'ldrb r0, [r1, #3]', m4.LOAD, 2, False),
+    ('4880', 'strh r0, [r1, #2]', m4.STORE, 2, False),
+    ('0198', 'ldr r0, [sp, #4]', m4.LOAD, 2, False),
+    ('0190', 'str r0, [sp, #4]', m4.STORE, 2, False),
+    ('02a8', 'add r0, sp, #8', m4.ALU, 1, False),
+    ('f0b5', 'push {r4, r5, r6, r7, lr}', m4.MULTIPLE, 6, False),
+    ('f0bd', 'pop {r4, r5, r6, r7, pc}', m4.BRANCH, 6, True),
+    ('10bc', 'pop {r4}', m4.MULTIPLE, 2, False),
+    ('00b1', 'cbz r0, +0', m4.COND_BRANCH, 1, False),
+    ('08bf', 'it eq', m4.ALU, 1, False),
+    ('72b6', 'cpsid i', m4.ALU, 1, False),
+    ('c8b2', 'uxtb r0, r1', m4.ALU, 1, False),
+    ('0ec0', 'stm r0!, {r1, r2, r3}', m4.MULTIPLE, 4, False),
+    ('06c8', 'ldm r0!, {r1, r2}', m4.MULTIPLE, 3, False),
+    ('00d0', 'beq +0', m4.COND_BRANCH, 1, False),
+    ('00e0', 'b +0', m4.BRANCH, 1, False),
+    ('90e81e00', 'ldm.w r0, {r1, r2, r3, r4}', m4.MULTIPLE, 5, False),
+    ('bde8f081', 'pop.w {r4, r5, r6, r7, r8, pc}', m4.BRANCH, 7, True),
+    ('d2e90001', 'ldrd r0, r1, [r2]', m4.LOAD, 3, False),
+    ('c2e90001', 'strd r0, r1, [r2]', m4.STORE, 3, False),
+    ('dfe800f0', 'tbb [pc, r0]', m4.BRANCH, 2, False),
+    ('dfe810f0', 'tbh [pc, r0, lsl #1]', m4.BRANCH, 2, False),
+    ('01eb8200', 'add.w r0, r1, r2, lsl #2', m4.ALU, 1, False),
+    ('01f58050', 'add.w r0, r1, #4096', m4.ALU, 1, False),
+    ('41f23420', 'movw r0, #4660', m4.ALU, 1, False),
+    ('01f0e481', 'beq.w far', m4.COND_BRANCH, 1, False),
+    ('01f0e2b9', 'b.w far', m4.BRANCH, 1, False),
+    ('01f0e0f9', 'bl far', m4.BRANCH, 1, False),
+    ('eff31080', 'mrs r0, primask', m4.ALU, 2, False),
+    ('80f31088', 'msr primask, r0', m4.ALU, 2, False),
+    ('bff34f8f', 'dsb sy', m4.ALU, 4, False),
+    ('d1f86400', 'ldr.w r0, [r1, #100]', m4.LOAD, 2, False),
+    ('c1f86400', 'str.w r0, [r1, #100]', m4.STORE, 2, False),
+    ('b1f90200', 'ldrsh.w r0, [r1, #2]', m4.LOAD, 2, False),
+    ('d1f800f0', 'ldr.w pc, [r1]', m4.BRANCH, 2, True),
+    ('01fa02f0', 'lsl.w r0, r1, r2', m4.ALU, 1, False),
+    ('01fb02f0', 'mul r0, r1, r2', m4.ALU, 1, False),
+    ('01fb0230', 'mla r0, r1, r2, r3', m4.ALU, 2, False),
+    ('a2fb0301', 'umull r0, r1, r2, r3', m4.ALU, 1, False),
+    ('b1fbf2f0', 'udiv r0, r1, r2', m4.DIVIDE, 2, False),
+    ('91fbf2f0', 'sdiv r0, r1, r2', m4.DIVIDE, 2, False),
+    ('51e8000f', 'ldrex r0, [r1]', m4.LOAD, 2, False),
+]
+
+
+def halfwords(hexbytes):
+    b = bytes.fromhex(hexbytes)
+    hw = [b[i] | b[i + 1] << 8 for i in range(0, len(b), 2)]
+    return hw + [0] * (2 - len(hw))
+
+
+class DecoderTest(unittest.TestCase):
+    def test_encodings(self):
+        for hexbytes, text, kind, base, pc in ENCODINGS:
+            hw1, hw2 = halfwords(hexbytes)
+            with self.subTest(text):
+                self.assertEqual(len(hexbytes) // 2, m4.size(hw1))
+                self.assertEqual((kind, base, pc), m4.classify(hw1, hw2))
+
+    def test_divide(self):
+        self.assertEqual(2, m4.divide_cycles(5, 7))
+        self.assertEqual(3, m4.divide_cycles(100, 10))
+        self.assertEqual(10, m4.divide_cycles(0xFFFFFFFF, 3))
+        self.assertEqual(10, m4.divide_cycles(0xFFFFFFFF, 1))
+        self.assertEqual(2, m4.divide_cycles(1, 0))
+
+
+class TimingTest(unittest.TestCase):
+    def run_code(self, program, model=None):
+        """program: (address, hex encoding) in execution order."""
+        model = model or m4.CycleModel()
+        for address, hexbytes in program:
+            model.step(address, *halfwords(hexbytes))
+        return model
+
+    def test_taken_branch_refills_pipeline(self):
+        ram = 0x1FFF8000  # no wait states
+        straight = self.run_code([(ram, '00d0'), (ram + 2, '0120')])  # beq not taken
+        taken = self.run_code([(ram, '00d0'), (ram + 4, '0120')])
+        self.assertEqual(2, straight.cycles)
+        self.assertEqual(2 + m4.PIPELINE_REFILL, taken.cycles)
+
+    def test_pipelined_loads(self):
+        ram = 0x1FFF8000
+        model = self.run_code([(ram, '8858'), (ram + 2, '8858'), (ram + 4, '8850')])
+        self.assertEqual(2 + 1 + 1, model.cycles)
+
+    def test_flash_wait_states(self):
+        # straight line code from flash, two 64 bit lines: a miss, then the prefetched line
+        program = [(0x100 + 2 * i, '0120') for i in range(8)]
+        model = self.run_code(program)
+        self.assertEqual(8 + m4.FLASH_WAIT + m4.FLASH_SEQUENTIAL_WAIT, model.cycles)
+        # the loop body is cached the second time
+        again = self.run_code(program, model)
+        self.assertEqual(8 + m4.FLASH_WAIT + m4.FLASH_SEQUENTIAL_WAIT + 8, again.cycles)
+
+    def test_flash_cache_lines(self):
+        flash = m4.FlashModel()
+        for line in range(m4.FMC_LINES + 1):
+            flash.access(line * 64)  # far apart, no prefetch
+        self.assertEqual(m4.FLASH_WAIT, flash.access(0))  # evicted
+        self.assertEqual(0, flash.access(m4.FMC_LINES * 64))
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,31 @@
+#!/bin/sh
+# code size of src/main.cpp per git revision, built on the host against test/shims (g++ -Os)
+# usage: tools/size.sh [rev ...]   no rev: the working tree
+# flash = .text* .rodata* .data*, compare revisions with each other, not with the teensy31 image
+# (x86-64 code, 8 byte pointers); with a teensy31 build the target size is printed too
+cd "$(dirname "$0")/.." || exit 1
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+size_of() {
+  g++ -std=gnu++17 -Os -w -c -Itest/shims -Isrc -Ilib/SimpleModbusSlave "$1" -o "$tmp/main.o" || return 1
+  size -A "$tmp/main.o" | awk -v rev="$2" '
+    $1 ~ /^\.text/ { text += $2 }
+    $1 ~ /^\.rodata|^\.data\.rel\.ro/ { rodata += $2 }
+    $1 ~ /^\.data/ && $1 !~ /^\.data\.rel\.ro/ { data += $2 }
+    $1 ~ /^\.bss/ { bss += $2 }
+    END { printf "%-12s text %6d  rodata %6d  data %5d  bss %5d  flash %6d\n", rev, text, rodata, data, bss, text + rodata + data }'
+}
+
+if [ $# -eq 0 ]; then
+  size_of src/main.cpp "worktree"
+else
+  for rev in "$@"; do
+    git show "$rev:src/main.cpp" > "$tmp/main.cpp" && size_of "$tmp/main.cpp" "$rev"
+  done
+fi
+
+elf=.pio/build/teensy31/firmware.elf
+if [ -f "$elf" ] && command -v arm-none-eabi-size > /dev/null; then
+  arm-none-eabi-size "$elf"
+fi